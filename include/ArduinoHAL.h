@@ -0,0 +1,151 @@
+#ifndef __ARDUINOHAL_H__
+#define __ARDUINOHAL_H__
+
+#include <Arduino.h>
+#include <FS.h>
+#include <SPI.h>
+#include <driver/uart.h>
+#include "HAL.h"
+#include "RawLog.h"
+#include "MPU6050_6Axis_MotionApps20.h"
+
+// HAL.h interfaces on top of the ESP32 drivers
+
+// file on an SD/FS volume, opened for appending
+class SDFileSink : public FileSink {
+    public:
+        bool open(fs::FS &fs, const char *path);
+        // file on the SD card
+        bool open(const char *path) override;
+        size_t write(const uint8_t *data, size_t len) override;
+        bool sync() override;
+        size_t size() override;
+        bool isOpen() override;
+        void close() override;
+    private:
+        File file;
+        size_t fileSize = 0;
+};
+
+// Log file on the SD card that is preallocated to its capacity when opened
+// and then overwritten in place, so appends never allocate clusters or grow
+// the directory entry. The valid length is committed to a journal file
+// (<path>.jnl) on every sync, alternating between two sectors that each
+// hold a sequence number and a CRC; a torn commit leaves the previous one
+// intact. Reopening after a reset continues at the committed length, close()
+// truncates the file to it and removes the journal. recover() does the same
+// for a file that is not going to be reopened.
+class SDPreallocatedSink : public FileSink {
+    public:
+        static const size_t MAX_PATH = 48;
+        // file size allocated on open, 0 to allocate as the file grows
+        void setCapacity(uint32_t bytes);
+        bool open(const char *path) override;
+        size_t write(const uint8_t *data, size_t len) override;
+        bool sync() override;
+        size_t size() override;
+        bool isOpen() override;
+        void close() override;
+        // truncates the file of a journal left behind by a reset to its
+        // committed length, false if path is not a journal
+        static bool recover(const char *journalPath);
+        // length committed to the journal of a file being written, false
+        // if it has none
+        static bool committedLength(const char *path, uint32_t &length);
+    private:
+        struct __attribute__((packed)) commit_t {
+            uint32_t magic;
+            uint32_t seq;
+            uint32_t length;
+            uint32_t crc;
+        };
+        static const uint32_t COMMIT_MAGIC = 0x4C4E4A4C;
+        // one sector per commit slot
+        static const uint16_t SLOT_SIZE = 512;
+        File file;
+        File journal;
+        char path[MAX_PATH];
+        char journalPath[MAX_PATH + 4];
+        uint32_t capacity = 0;
+        uint32_t length = 0;
+        uint32_t seq = 0;
+        bool commit();
+        static void journalFor(const char *path, char *journalPath, size_t size);
+        static bool readCommit(const char *journalPath, commit_t &last);
+        static bool truncate(const char *path, uint32_t length);
+};
+
+// Session in the raw log partition of the SD card (see RawLog.h). Whole
+// sectors go out as one multi-block write (CMD25) on the SPI bus shared
+// with SD, which must be mounted; the superblock is read and written with
+// SD.readRAW()/writeRAW(). A partial last sector is kept in RAM, written
+// padded on sync() and rewritten once it fills up. sync() also commits the
+// session length to the superblock.
+class SDRawSink : public BlockSink {
+    public:
+        static const uint32_t SPI_HZ = 20000000;
+        // locates the partition and loads its superblock
+        bool begin(SPIClass *spi, uint8_t ssPin);
+        // starts a session, or continues the last one if it has the same
+        // startTS
+        bool open(uint32_t startTS);
+        size_t write(const uint8_t *data, size_t len) override;
+        bool sync() override;
+        size_t size() override;
+        bool isOpen() override;
+        void close() override;
+    private:
+        // SD SPI mode protocol
+        static const uint8_t CMD_WRITE_MULTIPLE_BLOCK = 25;
+        static const uint8_t TOKEN_MULTI_WRITE = 0xFC;
+        static const uint8_t TOKEN_STOP_TRAN = 0xFD;
+        static const uint8_t DATA_ACCEPTED = 0x05;
+        static const uint32_t BUSY_TIMEOUT_MS = 500;
+        SPIClass *spi = nullptr;
+        uint8_t ssPin = 0;
+        // SDHC/SDXC cards take sector numbers, SDSC cards byte offsets
+        bool blockAddressing = true;
+        uint32_t partitionStart = 0;
+        raw_superblock_t super;
+        raw_session_t *session = nullptr;
+        uint8_t tail[RAW_LOG_SECTOR_SIZE] __attribute__((aligned(4)));
+        size_t tailUsed = 0;
+        bool commit();
+        bool writeBlocks(uint32_t sector, const uint8_t *data, uint32_t count);
+        uint8_t command(uint8_t cmd, uint32_t arg);
+        bool waitReady(uint32_t timeoutMs);
+};
+
+// files on the SD card, the ones being written through an
+// SDPreallocatedSink up to their committed length
+class SDFileStore : public FileStore {
+    public:
+        int32_t size(const char *path) override;
+        size_t read(const char *path, uint32_t offset, uint8_t *buffer, size_t len) override;
+};
+
+// ESP-IDF UART driver receive buffer
+class UARTByteSource : public ByteSource {
+    public:
+        explicit UARTByteSource(uart_port_t port) : port(port) {}
+        size_t read(uint8_t *buffer, size_t len) override;
+    private:
+        uart_port_t port;
+};
+
+// MPU6050 DMP FIFO
+class MPUFifoSource : public FifoSource {
+    public:
+        explicit MPUFifoSource(MPU6050 &mpu) : mpu(mpu) {}
+        uint16_t count() override;
+        bool read(uint8_t *buffer, uint16_t len) override;
+        bool overflowed() override;
+        void reset() override;
+        // the other interrupt status bits read since the last call
+        uint8_t takeStatus();
+    private:
+        MPU6050 &mpu;
+        uint8_t pendingStatus = 0;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __BENCHSUITE_H__
+#define __BENCHSUITE_H__
+
+#include "Benchmark.h"
+#include "HAL.h"
+
+// file the storage benchmarks append to, on the SD card or the host disk
+class BenchStorage {
+    public:
+        virtual ~BenchStorage() {}
+        // opens the benchmark file for appending, null on failure
+        virtual BlockSink* open() = 0;
+        // deletes the benchmark file
+        virtual void remove() = 0;
+        // raw block device for the raw_write benchmarks, null if there is
+        // none
+        virtual BlockSink* openRaw() { return nullptr; }
+};
+
+// Hot paths of the logger, measured the same way on the device and in the
+// native build:
+//   nmea_ingest, ubx_ingest    GPSParser alone fed one NMEA pair / NAV-PVT
+//                              frame
+//   nmea_read                  the NMEA pair through a ByteSource in the
+//                              chunks of GPSUtil::readBytes()
+//   mpu_decode                 MPUBatch decoding a 6-packet FIFO burst
+//   mpu_compress               one MPUCompressor block of records
+//   mpu_log_records            binary records through LogStream, without
+//                              the card; mpu_log_packed with smallest-three
+//                              quaternions (QuatCodec.h)
+//   gps_format                 the GPS log line with TextWriter, and with
+//                              snprintf in gps_format_printf
+//   log_append_<n>             LogStream writes of n bytes; the buffer is
+//                              LogStream::BUFFER_SIZE, a compile-time
+//                              constant, so the write size varies instead
+//   sink_append_<n>            unbuffered writes of n bytes
+//   raw_write_<n>              n bytes as one multi-block write to the raw
+//                              log partition, on the device only
+//   file_append_open           open, append one record, close (appendFile)
+//   lora_encode                one full uplink frame of fixes
+void runBenchmarks(Benchmark &bench, BenchStorage *storage);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "HAL.h"
+
+struct bench_result_t {
+    const char *name;
+    uint32_t calls;
+    // payload bytes processed over all calls
+    uint32_t bytes;
+    uint32_t totalUs;
+    uint32_t p50Us;
+    uint32_t p90Us;
+    uint32_t p99Us;
+    uint32_t maxUs;
+};
+
+// one call of a benchmark, returns the payload bytes it processed
+typedef size_t (*bench_fn_t)(void *ctx, uint32_t call);
+// receives each result as one JSON line, newline included
+typedef void (*bench_writer_t)(const char *line, void *arg);
+
+// Times every call of a function with halMicros() and reports throughput
+// and latency percentiles as JSON lines, so runs of different firmware
+// versions can be compared by a script.
+class Benchmark {
+    public:
+        static const uint16_t MAX_CALLS = 1024;
+        Benchmark(bench_writer_t writer, void *arg);
+        // first line of a report, names the target and the build
+        void header(const char *target);
+        const bench_result_t& run(const char *name, bench_fn_t fn, void *ctx, uint32_t calls);
+        static size_t format(const bench_result_t &result, char *line, size_t size);
+    private:
+        bench_writer_t writer;
+        void *writerArg;
+        bench_result_t result;
+        uint32_t latency[MAX_CALLS];
+        uint32_t percentile(uint32_t calls, uint8_t pct);
+};
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef __CRC32_H__
+#define __CRC32_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32 as in zlib (zlib.crc32 in the tools), used by the compressed MPU
+// blocks, the file journal, the raw log superblock, the GPS aid and the
+// log index.
+class CRC32 {
+    public:
+        static uint32_t compute(const uint8_t *data, size_t len);
+};
+
+#endif
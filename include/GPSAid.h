@@ -0,0 +1,45 @@
+#ifndef __GPSAID_H__
+#define __GPSAID_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "GPSParser.h"
+
+// last fix kept across reboots, in RTC memory and on the card
+struct __attribute__((packed)) gps_aid_t {
+    uint32_t magic;
+    // time of the fix, tells a new aid from the saved one
+    uint32_t ts;
+    // 1e-6 degrees
+    int32_t lat;
+    int32_t lng;
+    // decimetres, GPS_ACCURACY_UNKNOWN in NMEA mode
+    uint16_t hAcc;
+    uint16_t reserved;
+    // CRC-32 of the fields above
+    uint32_t crc;
+};
+
+// Start-up aiding for u-blox 8 receivers: the position of the last fix is
+// fed back with UBX-MGA-INI-POS_LLH so a receiver that lost its backup RAM
+// starts warm instead of searching the whole sky. The aid is sent after a
+// power cycle, when the system clock starts over at 1970, so neither the
+// time nor the age of the aid is known and no MGA-INI-TIME_UTC is sent.
+class GPSAid {
+    public:
+        static const uint32_t MAGIC = 0x44494147;
+        // MGA-INI-POS_LLH frame
+        static const size_t FRAME_SIZE = UBX_FRAME_OVERHEAD + 20;
+        static void fromFix(const gps_fix_t &fix, gps_aid_t &aid);
+        static bool valid(const gps_aid_t &aid);
+        // writes the aiding frame into out, which holds FRAME_SIZE bytes
+        static size_t frame(const gps_aid_t &aid, uint8_t *out);
+        // position accuracy in cm sent for aid
+        static uint32_t accuracyCm(const gps_aid_t &aid);
+    private:
+        // the altitude is not kept, its error adds to the position's
+        static const uint32_t BASE_ACCURACY_CM = 100000;
+        static const uint32_t UNKNOWN_ACCURACY_CM = 5000;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef __GPSPARSER_H__
+#define __GPSPARSER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <TinyGPS++.h>
+#include "HAL.h"
+#include "UBX.h"
+
+// position fix with coordinates in 1e-6 degrees
+struct gps_fix_t {
+    time_t ts;
+    int32_t lat;
+    int32_t lng;
+    // horizontal accuracy in decimetres, GPS_ACCURACY_UNKNOWN in NMEA mode
+    uint16_t hAcc;
+    // UBX NAV-PVT fixType: 2 2D, 3 3D, 4 GNSS + dead reckoning; 0 when an
+    // NMEA receiver does not tell
+    uint8_t fixType;
+    uint8_t numSV;
+};
+
+static const uint16_t GPS_ACCURACY_UNKNOWN = 0xFFFF;
+
+// UTC date and time reported by the receiver
+struct gps_time_t {
+    uint16_t year;
+    uint8_t month;
+    uint8_t day;
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    uint32_t usec;
+};
+
+// Receiver protocol decoding, NMEA through TinyGPSPlus or UBX NAV-PVT,
+// without any dependency on the UART or the system clock.
+class GPSParser {
+    public:
+        explicit GPSParser(bool ubx = false);
+        // the NMEA custom terms are registered by address
+        GPSParser(const GPSParser&) = delete;
+        GPSParser& operator=(const GPSParser&) = delete;
+        void setUBX(bool ubx);
+        // true when c completed a new valid fix, read it with fix()
+        bool feed(uint8_t c);
+        // feeds up to len bytes from source, returns the number of new fixes
+        size_t feed(ByteSource &source, size_t len);
+        const gps_fix_t& fix() const { return lastFix; }
+        // false until the receiver reported a valid date and time
+        bool hasTime() const { return timeValid; }
+        const gps_time_t& time() const { return lastTime; }
+        uint32_t fixes() const { return fixCount; }
+        static time_t toEpoch(const gps_time_t &t);
+        // "<ts>;<lat>;<lng>\n", the GPS log line layout; returns the length,
+        // 0 if str is too small
+        static size_t formatFix(const gps_fix_t &fix, char *str, size_t size);
+        // longest formatFix() line, NUL included
+        static const size_t FIX_LINE_SIZE = 48;
+    private:
+        bool ubxMode;
+        TinyGPSPlus nmea;
+        // GGA fix quality and GSA fix mode, from the GPS-only and the
+        // multi-GNSS talker
+        TinyGPSCustom ggaQuality[2];
+        TinyGPSCustom gsaMode[2];
+        UBXParser ubx;
+        gps_fix_t lastFix;
+        gps_time_t lastTime;
+        bool timeValid = false;
+        uint32_t fixCount = 0;
+        bool feedNMEA(uint8_t c);
+        uint8_t nmeaFixType();
+        bool feedUBX(uint8_t c);
+};
+
+#endif
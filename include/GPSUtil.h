@@ -1,30 +1,97 @@
 #ifndef __GPSUTIL_H__
 #define __GPSUTIL_H__
 
-#include <TinyGPS++.h>
-#include <TimeLib.h>
+#include <time.h>
+#include <driver/uart.h>
+#include <freertos/semphr.h>
+#include "ArduinoHAL.h"
+#include "GPSAid.h"
+#include "GPSParser.h"
+#include "SPSCQueue.h"
 
+typedef SPSCQueue<gps_fix_t, 16> GPSRing;
+
+// called from the GPS task for every new valid fix
+typedef void (*gps_fix_callback_t)(const gps_fix_t &fix, void *arg);
+
+// The receiver is read by a dedicated task blocked on the ESP-IDF UART
+// event queue. In NMEA mode the driver detects the '\n' ending each
+// sentence, so the task only wakes for complete sentences. In UBX mode the
+// receiver is switched to binary NAV-PVT output only, at a higher baud rate
+// and a 1-10 Hz navigation rate.
+//
+// Every fix also refreshes the start-up aid in RTC memory, which the
+// storage side copies to AID_FILE; sendAid() feeds it back after a power
+// cycle. The time to first fix after setup() and after every wake from
+// backup mode is measured.
 class GPSUtil {
     public:
         static GPSUtil* getInstance();
-        void setup();
+        void setup(uint8_t ubxRateHz = 0);
         bool isFixed();
         void updateSystemTime();
-        bool getLocation(char *locationStr);
+        bool getFix(gps_fix_t &fix);
+        bool waitFix(gps_fix_t &fix, unsigned long timeout_ms);
+        bool getLocation(char *locationStr, size_t size);
+        void setFixCallback(gps_fix_callback_t callback, void *arg);
+        void setBackup(bool on);
+        bool inBackup();
+        void sendAid(const gps_aid_t &aid);
+        bool getAid(gps_aid_t &aid);
+        // time to the first fix after setup or backup, 0 until it came
+        uint32_t ttffMs();
+        static constexpr const char *AID_FILE = "/gps_aid.bin";
+        GPSRing& fixes();
 
     private:
         GPSUtil();
         GPSUtil(const GPSUtil&) = delete;
         GPSUtil& operator=(const GPSUtil&) = delete;
-        static GPSUtil* pInstance;
         // GPS related variables
-        TinyGPSPlus gps;
-        HardwareSerial serial;
+        GPSParser parser;
+        // navigation rate in UBX mode, 0 in NMEA mode
+        uint8_t ubxRate = 0;
+        // receiver put in backup mode by setBackup()
+        bool backup = false;
+        // fixes waiting to be stored, filled from the fix callback
+        GPSRing fixRing;
+        // latest fix published by the task, guarded by fixMux
+        portMUX_TYPE fixMux = portMUX_INITIALIZER_UNLOCKED;
+        gps_fix_t lastFix = {};
+        bool fixValid = false;
+        bool fixUnread = false;
+        // start of the TTFF measurement, a fix is pending while ttffRunning
+        uint32_t ttffStartMs = 0;
+        uint32_t lastTTFFMs = 0;
+        bool ttffRunning = false;
+        SemaphoreHandle_t fixSemaphore = nullptr;
+        gps_fix_callback_t fixCallback = nullptr;
+        void *fixCallbackArg = nullptr;
+        QueueHandle_t uartQueue = nullptr;
+        TaskHandle_t taskHandle = nullptr;
+        // the task and semaphore live here, not on the heap
+        StaticSemaphore_t fixSemaphoreBuffer;
+        StaticTask_t taskBuffer;
         // GPS constants | GPS TX - PIN 4 | GPS RX - PIN 5
         // changed gps tx pin from 4 to 10 due to mega2560 limitations for rx signal 
         static const uint8_t GPS_RX_PIN = 12, GPS_TX_PIN = 15;
         static const uint32_t baudRate = 9600;
-        void readSerial(unsigned long timeout_ms);
+        static const uint32_t ubxBaudRate = 115200;
+        static const uart_port_t GPS_UART = UART_NUM_1;
+        static const int RX_BUFFER_SIZE = 1024;
+        static const int EVENT_QUEUE_SIZE = 16;
+        static const uint32_t TASK_STACK = 3072;
+        static const UBaseType_t TASK_PRIORITY = 4;
+        static const BaseType_t TASK_CORE = 1;
+        StackType_t taskStack[TASK_STACK];
+        UARTByteSource uart;
+        static void uartTask(void *arg);
+        void readBytes(size_t len);
+        void configureUBX(uint8_t rateHz);
+        void sendUBX(uint8_t msgClass, uint8_t msgId, const uint8_t *payload, uint16_t len);
+        void setSystemTime(const gps_time_t &time);
+        void publishFix(const gps_fix_t &fix);
+        void startTTFF();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,74 @@
+#ifndef __HAL_H__
+#define __HAL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Thin interfaces between the portable parsing, buffering and encoding code
+// and the hardware. The firmware implements them on top of the ESP32 UART,
+// SD, MPU6050 and LMIC drivers (see the *Util classes); the native build
+// uses the file and memory backed stand-ins in HostHAL.h.
+
+// bytes arriving from a serial port
+class ByteSource {
+    public:
+        virtual ~ByteSource() {}
+        // reads up to len bytes without blocking, returns the count read
+        virtual size_t read(uint8_t *buffer, size_t len) = 0;
+};
+
+// append-only file or block device
+class BlockSink {
+    public:
+        virtual ~BlockSink() {}
+        virtual size_t write(const uint8_t *data, size_t len) = 0;
+        // commits written data and metadata to the medium
+        virtual bool sync() = 0;
+        // bytes stored so far
+        virtual size_t size() = 0;
+        virtual bool isOpen() = 0;
+        virtual void close() = 0;
+};
+
+// append-only file opened by path
+class FileSink : public BlockSink {
+    public:
+        virtual bool open(const char *path) = 0;
+};
+
+// read access to the files of a volume
+class FileStore {
+    public:
+        virtual ~FileStore() {}
+        // size of the file, -1 if it does not exist
+        virtual int32_t size(const char *path) = 0;
+        // reads up to len bytes at offset, returns the count read
+        virtual size_t read(const char *path, uint32_t offset, uint8_t *buffer, size_t len) = 0;
+};
+
+// packet FIFO of an I2C sensor
+class FifoSource {
+    public:
+        virtual ~FifoSource() {}
+        // bytes waiting in the FIFO
+        virtual uint16_t count() = 0;
+        virtual bool read(uint8_t *buffer, uint16_t len) = 0;
+        // true if data was lost since the last call
+        virtual bool overflowed() = 0;
+        virtual void reset() = 0;
+};
+
+// uplink radio
+class RadioSink {
+    public:
+        virtual ~RadioSink() {}
+        // hands a frame to the radio, false if it cannot be accepted now
+        virtual bool send(const uint8_t *data, size_t len, uint8_t port) = 0;
+};
+
+// milliseconds since boot, millis() on the device
+uint32_t halMillis();
+// microseconds since boot, micros() on the device
+uint32_t halMicros();
+
+#endif
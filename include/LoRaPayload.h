@@ -0,0 +1,59 @@
+#ifndef __LORAPAYLOAD_H__
+#define __LORAPAYLOAD_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compact binary uplink payloads. A frame is an optional header byte
+// followed by one or more fix records:
+//
+//   header   bits 0-6 payload type, bit 7 set for 24-bit coordinates
+//   ts       unsigned LEB128 varint of (value << 1 | absolute); value is
+//            epoch seconds when absolute, otherwise seconds since the
+//            previous record of the frame
+//   lat/lng  int32 little-endian in 1e-6 degrees, or 24-bit little-endian
+//            fractions of the full range when packed (about 1.2 m / 2.4 m)
+//
+// The first record of every frame is absolute, so each frame decodes on its
+// own and a lost uplink never shifts the timestamps of the next ones. Both
+// sides must agree on the header and packing options.
+
+struct lora_fix_t {
+    uint32_t ts;
+    // 1e-6 degrees
+    int32_t lat;
+    int32_t lng;
+};
+
+static const uint8_t LORA_PAYLOAD_GPS = 1;
+static const uint8_t LORA_PAYLOAD_PACKED_FLAG = 0x80;
+
+class LoRaPayloadEncoder {
+    public:
+        LoRaPayloadEncoder(bool withHeader = true, bool packed = false);
+        void begin(uint8_t *buffer, size_t size, uint8_t type);
+        bool addFix(const lora_fix_t &fix);
+        size_t length() const { return used; }
+        uint8_t count() const { return records; }
+    private:
+        bool withHeader;
+        bool packed;
+        uint8_t *buffer = nullptr;
+        size_t size = 0;
+        size_t used = 0;
+        uint8_t records = 0;
+        // timestamp the next delta refers to
+        uint32_t lastTS = 0;
+};
+
+class LoRaPayloadDecoder {
+    public:
+        LoRaPayloadDecoder(bool withHeader = true, bool packed = false);
+        int decode(const uint8_t *frame, size_t len, lora_fix_t *fixes, size_t maxFixes,
+                   uint8_t *type = nullptr);
+    private:
+        bool withHeader;
+        bool packed;
+};
+
+#endif
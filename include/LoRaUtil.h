@@ -5,36 +5,61 @@
 #include <hal/hal.h>
 #include <SPI.h>
 #include <esp_log.h>
+#include "HAL.h"
+#include "UplinkQueue.h"
+#include "MotionFeatures.h"
 
-class LoRaUtil {
+// Fixes are queued and sent several per frame. A frame is built when LMIC
+// is idle and the duty-cycle budget allows it, as many queued fixes as fit
+// the current data rate go in, and they only leave the queue on
+// TX_COMPLETE, so a busy radio no longer loses data. The latest motion
+// feature window waits in a single slot and takes turns with the fix
+// frames, on its own port.
+class LoRaUtil : public RadioSink {
     public:
         static LoRaUtil* getInstance();
         void setup();
         void loop();
-        void send(char* data);
+        bool send(const uint8_t *data, size_t len, uint8_t port = PORT_DEFAULT) override;
+        void queueFix(const lora_fix_t &fix);
+        void queueMotion(const motion_features_t &features);
+        void flush();
+        bool flushing();
+        bool takeFix(lora_fix_t &fix);
+        bool isIdle();
+        bool canSleep(uint32_t ms);
+        void saveSession();
+        void onEvent(ev_t ev);
+        uint32_t droppedFixes();
+        uint8_t queuedFixes();
+        static const uint8_t PORT_DEFAULT = 1;
+        static const uint8_t PORT_GPS = 2;
+        static const uint8_t PORT_MOTION = 3;
     private:
         LoRaUtil();
         LoRaUtil(const LoRaUtil&) = delete;
         LoRaUtil& operator=(const LoRaUtil&) = delete;
-        static LoRaUtil* pInstance;
-        static const char *tag = "lora";
-        // This EUI must be in little-endian format, so least-significant-byte
-        // first. When copying an EUI from ttnctl output, this means to reverse
-        // the bytes. For TTN issued EUIs the last bytes should be 0xD5, 0xB3,
-        // 0x70.
-        static const u1_t PROGMEM APPEUI[8]={ FILLMEIN };
-        void os_getArtEui (u1_t* buf) { memcpy_P(buf, APPEUI, 8);}
-
-        // This should also be in little endian format, see above.
-        static const u1_t PROGMEM DEVEUI[8]={ FILLMEIN };
-        void os_getDevEui (u1_t* buf) { memcpy_P(buf, DEVEUI, 8);}
-
-        // This key should be in big endian format (or, since it is not really a
-        // number but a block of memory, endianness does not really apply). In
-        // practice, a key taken from ttnctl can be copied as-is.
-        static const u1_t PROGMEM APPKEY[16] = { FILLMEIN };
-        void os_getDevKey (u1_t* buf) {  memcpy_P(buf, APPKEY, 16);}
+        static constexpr const char *tag = "lora";
+        UplinkQueue uplinks;
+        motion_features_t motion = {};
+        bool motionQueued = false;
+        bool motionInFlight = false;
+        // the last frame carried fixes, motion goes next
+        bool fixesSent = false;
+        // the next frame goes out without batching, see flush()
+        bool flushRequested = false;
+        // fixes are held back this long to share a frame, unless one is full
+        static const uint32_t MIN_UPLINK_INTERVAL_MS = 30000;
+        ostime_t lastTxTime = 0;
+        osjob_t uplinkJob = {};
+        static void uplinkJobCallback(osjob_t *job);
+        bool pending();
+        bool restoreSession();
+        void scheduleUplink();
+        void transmit();
+        ostime_t earliestTxTime();
+        uint8_t maxPayload();
 };
 
 
-#endif
\ No newline at end of file
+#endif
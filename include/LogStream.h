@@ -0,0 +1,40 @@
+#ifndef __LOGSTREAM_H__
+#define __LOGSTREAM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "HAL.h"
+
+// Append-only log that keeps its sink open between records. Records are
+// collected in a RAM buffer and written in whole sectors, so the FAT lookup
+// and metadata update are paid once per flush instead of once per record.
+class LogStream {
+    public:
+        static const size_t SECTOR_SIZE = 512;
+        static const size_t BUFFER_SIZE = 8 * SECTOR_SIZE;
+        // partially filled sectors are pushed to the card after this period
+        static const uint32_t FLUSH_PERIOD_MS = 10000;
+        LogStream();
+        bool open(BlockSink *sink);
+        void close();
+        bool isOpen();
+        size_t size();
+        size_t write(const uint8_t *data, size_t len);
+        size_t print(const char *message);
+        bool flush();
+        void loop();
+        // ms until loop() flushes the buffer, UINT32_MAX when it is empty
+        uint32_t untilFlush();
+    private:
+        BlockSink *sink = nullptr;
+        // bytes already handed to the sink
+        size_t fileSize = 0;
+        // bytes waiting in buffer
+        size_t used = 0;
+        uint32_t lastFlushMs = 0;
+        uint8_t buffer[BUFFER_SIZE] __attribute__((aligned(4)));
+        bool writeSectors();
+        bool writeBuffer(size_t len);
+};
+
+#endif
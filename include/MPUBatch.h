@@ -0,0 +1,73 @@
+#ifndef __MPUBATCH_H__
+#define __MPUBATCH_H__
+
+#include <stdint.h>
+#include "HAL.h"
+#include "MPURecord.h"
+#include "SPSCQueue.h"
+
+const uint8_t NUM_SAMPLES = 100;
+
+typedef SPSCQueue<mpu_record_t, 512> MPURing;
+
+class MotionFeatures;
+
+// batch of decoded DMP packets, one array per channel
+struct mpu_batch_t {
+    // millis() at which each packet was produced
+    uint32_t ms[NUM_SAMPLES];
+    // raw Q14 quaternion (w, x, y, z) as read from the DMP FIFO
+    int16_t q[4][NUM_SAMPLES];
+    int16_t g[3][NUM_SAMPLES];
+    int16_t a[3][NUM_SAMPLES];
+    uint8_t count;
+};
+
+// Drains MotionApps20 packets from a DMP FIFO, decodes them into the SoA
+// batch and hands full batches over to the sample ring as log records, and
+// to the feature extraction if one is set.
+class MPUBatch {
+    public:
+        MPUBatch();
+        void setPacketSize(uint8_t size) { packetSize = size; }
+        // millis() value that record timestamps are relative to
+        void setTimeBase(uint32_t startMs) { timeBase = startMs; }
+        void setFeatures(MotionFeatures *features) { this->features = features; }
+        // reads every complete packet, the newest one produced at lastMs;
+        // false if the FIFO overflowed and was reset
+        bool drain(FifoSource &fifo, uint32_t lastMs);
+        // reads the oldest packet into record without touching the batch
+        bool readOne(FifoSource &fifo, uint32_t ms, mpu_record_t &record);
+        void decode(const uint8_t *packets, uint8_t count, uint32_t firstMs);
+        void clear() { batch.count = 0; }
+        MPURing& samples() { return sampleRing; }
+        // "<s>;<qw>;<qx>;<qy>;<qz>;<gX>;<gY>;<gZ>;<aX>;<aY>;<aZ>\n" as written by
+        // tools/mpu_decode.py; returns the length, 0 if str is too small
+        static size_t formatRecord(const mpu_record_t &record, char *str, size_t size);
+        // longest formatRecord() line, NUL included
+        static const size_t RECORD_LINE_SIZE = 96;
+        uint32_t overflows() const { return overflowCount; }
+        // bytes the FIFO held at the last drain()
+        uint16_t fifoCount() const { return lastFifoCount; }
+        // DMP output rate, MotionApps20 default (MPU6050_DMP_FIFO_RATE_DIVISOR 0x01)
+        static const uint16_t DMP_RATE_HZ = 100;
+        static const uint16_t SAMPLE_PERIOD_MS = 1000 / DMP_RATE_HZ;
+        static const uint16_t FIFO_SIZE = 1024;
+        static const uint8_t MAX_PACKET_SIZE = 42;
+    private:
+        // packets per I2C burst, limited by getFIFOBytes() uint8_t length
+        static const uint8_t MAX_BURST_PACKETS = 6;
+        uint8_t packetSize = MAX_PACKET_SIZE;
+        uint32_t timeBase = 0;
+        uint32_t overflowCount = 0;
+        uint16_t lastFifoCount = 0;
+        MotionFeatures *features = nullptr;
+        uint8_t fifoBuffer[MAX_BURST_PACKETS * MAX_PACKET_SIZE];
+        mpu_batch_t batch;
+        // records waiting to be stored, filled by the acquisition task
+        MPURing sampleRing;
+        void pushSamples();
+        void batchRecord(uint8_t i, mpu_record_t &record);
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef __MPUCOMPRESSOR_H__
+#define __MPUCOMPRESSOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "MPURecord.h"
+
+// Block compression of MPU records for MPU_LOG_VERSION_BLOCKS logs. Each
+// block holds up to BLOCK_RECORDS records and decodes on its own:
+//
+//   magic     uint32 MPU_BLOCK_MAGIC
+//   length    uint16 payload bytes
+//   count     uint8 records
+//   reserved  uint8
+//   crc       uint32 CRC-32 (zlib) of the payload
+//   payload   first record as a plain mpu_record_t, then for each of the
+//             11 channels (tMs, q[4], g[3], a[3]) the smallest delta to
+//             the previous record as a zigzag varint and a bit width, then
+//             for every further record and channel (delta - smallest) in
+//             that many bits, LSB first
+//
+// The sample clock makes the tMs deltas constant and the DMP channels
+// move little between samples, so most channels need only a few bits.
+// A torn or corrupted block fails its CRC and the decoder resynchronises
+// on the next magic.
+class MPUCompressor {
+    public:
+        static const uint8_t BLOCK_RECORDS = 64;
+        static const uint8_t CHANNELS = 11;
+        static const size_t HEADER_SIZE = 12;
+        static const size_t MAX_BLOCK_SIZE = HEADER_SIZE + sizeof(mpu_record_t) + CHANNELS * 6 +
+                                             ((BLOCK_RECORDS - 1) * (32 + 10 * 17) + 7) / 8;
+        // buffers a record, true when a full block is ready in block()
+        bool add(const mpu_record_t &record);
+        // encodes the buffered records into block(), returns its size
+        size_t finish();
+        const uint8_t* block() const { return out; }
+        size_t blockSize() const { return outSize; }
+        uint8_t pending() const { return count; }
+        // decodes one block, returns the record count or -1 if it is
+        // truncated or corrupted
+        static int decode(const uint8_t *block, size_t len, mpu_record_t *records, size_t maxRecords);
+    private:
+        mpu_record_t records[BLOCK_RECORDS];
+        uint8_t count = 0;
+        uint8_t out[MAX_BLOCK_SIZE];
+        size_t outSize = 0;
+};
+
+#endif
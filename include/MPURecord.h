@@ -0,0 +1,50 @@
+#ifndef __MPURECORD_H__
+#define __MPURECORD_H__
+
+#include <stdint.h>
+
+// Binary layout of the MPU log files (/<startTS>-mpu-NNNN.bin). A file starts
+// with one mpu_log_header_t. In version 1 files fixed-size mpu_record_t
+// entries follow; in MPU_LOG_VERSION_BLOCKS files the records come in
+// compressed blocks (see MPUCompressor.h). MPU_LOG_VERSION_PACKED files hold
+// records of recordSize bytes laid out like mpu_record_t but with the
+// quaternion in smallest-three form, quatBits per component (QuatCodec.h).
+// All fields are little-endian, which is the native byte order of the
+// ESP32, so records are written with a plain copy. Decode on the host with
+// tools/mpu_decode.py.
+//
+// Records come at the DMP rate (MPUBatch::DMP_RATE_HZ, 100 Hz), except in
+// the deep sleep duty cycle (DUTY_CYCLE_MODE): there every wake keeps a
+// single packet, about 1 Hz, and no motion features are extracted.
+
+static const uint32_t MPU_LOG_MAGIC = 0x55504D4A; // "JMPU"
+static const uint16_t MPU_LOG_VERSION = 1;
+static const uint16_t MPU_LOG_VERSION_BLOCKS = 2;
+static const uint16_t MPU_LOG_VERSION_PACKED = 3;
+static const uint32_t MPU_BLOCK_MAGIC = 0x4255504D; // "MPUB"
+
+struct __attribute__((packed)) mpu_log_header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+    // epoch seconds matching tMs == 0 in the records
+    uint32_t startTS;
+    // MPU_LOG_VERSION_PACKED only
+    uint8_t quatBits;
+    uint8_t reserved[3];
+};
+
+struct __attribute__((packed)) mpu_record_t {
+    // milliseconds since startTS
+    uint32_t tMs;
+    // quaternion w, x, y, z in Q14 as delivered by the DMP FIFO
+    int16_t q[4];
+    int16_t g[3];
+    int16_t a[3];
+};
+
+static_assert(sizeof(mpu_log_header_t) == 16, "mpu_log_header_t layout changed");
+static_assert(sizeof(mpu_record_t) == 24, "mpu_record_t layout changed");
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "MPU log format is little-endian");
+
+#endif
@@ -2,41 +2,101 @@
 #define __MPUUTIL_H__
 
 #include "SDUtil.h"
+#include "ArduinoHAL.h"
+#include "MPUBatch.h"
+#include "MPUCompressor.h"
+#include "MotionFeatures.h"
 #include <Wire.h>
+#include <atomic>
+#include <time.h>
 #include "I2Cdev.h"
 #include "MPU6050_6Axis_MotionApps20.h"
 
-const uint8_t NUM_SAMPLES = 100;
+// MPU logs are block compressed unless built with -DMPU_LOG_COMPRESSED=0
+#ifndef MPU_LOG_COMPRESSED
+#define MPU_LOG_COMPRESSED 1
+#endif
+// -DMPU_LOG_RAW=1 writes the MPU log to the raw log partition (RawLog.h)
+// instead of segment files
+#ifndef MPU_LOG_RAW
+#define MPU_LOG_RAW 0
+#endif
+// -DMPU_LOG_QUAT_BITS=10..15 writes uncompressed records with the
+// quaternion in smallest-three form (MPU_LOG_VERSION_PACKED, QuatCodec.h)
+#ifndef MPU_LOG_QUAT_BITS
+#define MPU_LOG_QUAT_BITS 0
+#endif
+// -DMPU_LOG_SAMPLES=0 keeps only the motion features, no sample log
+#ifndef MPU_LOG_SAMPLES
+#define MPU_LOG_SAMPLES 1
+#endif
 
 class MPUUtil {
     public:
         static MPUUtil* getInstance();
+        bool openLog(time_t startTS, bool compressed = MPU_LOG_COMPRESSED, bool raw = MPU_LOG_RAW,
+                     uint8_t quatBits = MPU_LOG_QUAT_BITS);
         void writeToFile();
+        bool takeFeatures(motion_features_t &features);
+        void flushLog();
         void readFromSensor();
+        bool readSample(mpu_record_t &record);
+        void writeRecord(const mpu_record_t &record);
         void setup();
         void wakeup();
+        void setNotifyTask(TaskHandle_t task);
+        MPURing& samples();
+        uint32_t fifoOverflows();
+        uint16_t fifoCount();
+        uint32_t maxSleepMs();
+        bool isMoving();
     private:
         MPUUtil();
         MPUUtil(const MPUUtil&) = delete;
         MPUUtil& operator=(const MPUUtil&) = delete;
-        static MPUUtil* pInstance;
         MPU6050 mpu;
         SDUtil* sd;
+        SegmentedLog* log = nullptr;
+        LogStream* rawLog = nullptr;
+        time_t logStartTS = 0;
+        // timestamp of the first record of the pending compressed block
+        uint32_t blockTS = 0;
+        bool logCompressed = false;
+        // smallest-three quaternion bits of packed records, 0 for Q14
+        uint8_t logQuatBits = 0;
+        MPUCompressor compressor;
+        MPUFifoSource fifo;
+        MPUBatch batch;
+        // one line per feature window goes to /<startTS>-motion.txt
+        MotionFeatures features;
+        char featuresPath[24] = "";
+        // log rotation, an hour of samples is about 1.4 MB compressed
+        static const uint32_t SEGMENT_BYTES = 4 * 1024 * 1024;
+        static const uint32_t SEGMENT_SPAN_S = 3600;
+        uint32_t recordTS(const mpu_record_t &record);
+        void append(uint32_t ts, const uint8_t *data, size_t len, uint16_t records);
+        // the CPU may sleep while the DMP fills half of its FIFO
+        static const uint32_t FIFO_SLEEP_MS = MPUBatch::FIFO_SIZE / MPUBatch::MAX_PACKET_SIZE *
+                                              MPUBatch::SAMPLE_PERIOD_MS / 2;
+        // motion detection: above 40 mg for 40 ms is motion, below 20 mg
+        // for 10 s is zero motion (2 mg, 1 ms and 64 ms per LSB)
+        static const uint8_t MOTION_THRESHOLD = 20;
+        static const uint8_t MOTION_DURATION = 40;
+        static const uint8_t ZERO_MOTION_THRESHOLD = 10;
+        static const uint8_t ZERO_MOTION_DURATION = 156;
+        // written by the acquisition task, read by the main loop
+        std::atomic<bool> moving{true};
+        void configureMotion();
+        void updateMotion(uint8_t status);
         // MPU-6050 constants
         static const uint8_t INTERRUPT_PIN = 2;
-        // TODO: considering migrate this to a class, research the best solution
-        struct mpu_samples_t {
-            time_t ts;
-            Quaternion q;
-            int16_t gX;
-            int16_t gY;
-            int16_t gZ;
-            int16_t aX;
-            int16_t aY;
-            int16_t aZ;
-        } mpu_samples[NUM_SAMPLES];
-        // RTC_DATA_ATTR uint8_t cur_sample = 0;
+        // interrupt state shared with dmpDataReady()
+        static volatile bool interruptPending;
+        static volatile uint32_t interruptMs;
+        static TaskHandle_t notifyTask;
+        static void dmpDataReady();
+        bool dmpReady = false;
 };
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,60 @@
+#ifndef __MEMORYBUDGET_H__
+#define __MEMORYBUDGET_H__
+
+#include <stddef.h>
+
+// Static RAM budget of the firmware. The *Util singletons, with their
+// rings, I/O buffers and task stacks, are all in static storage, so the
+// worst-case RAM use is fixed at link time. Each owner asserts its size
+// against its entry below. The totals are checked against what the chip
+// offers. The heap is left to the ESP-IDF drivers, SD, LMIC and FreeRTOS.
+// The boot report in main.cpp prints the actual sizes next to these.
+//
+// Placement: DRAM holds everything that is only needed while the chip is
+// awake. RTC slow memory survives deep sleep but is small, so it only
+// holds the duty-cycle buffers and the state that must outlive a wake:
+// the LoRaWAN session, the GPS aid and the start timestamp.
+
+// DRAM (.bss), one entry per singleton
+static const size_t MEM_SD_UTIL = 12 * 1024;
+static const size_t MEM_MPU_UTIL = 22 * 1024;
+static const size_t MEM_GPS_UTIL = 5 * 1024;
+static const size_t MEM_LORA_UTIL = 1024;
+static const size_t MEM_PIPELINE_UTIL = 15 * 1024;
+// rings and buffers within the singletons above
+static const size_t MEM_MPU_RING = 12 * 1024 + 64;
+static const size_t MEM_MPU_BATCH = 3 * 1024;
+static const size_t MEM_MPU_COMPRESSOR = 3 * 1024 + 256;
+static const size_t MEM_MOTION_FEATURES = 2 * 1024;
+static const size_t MEM_GPS_RING = 512;
+static const size_t MEM_LOG_STREAMS = 9 * 1024;
+static const size_t MEM_UPLINK_QUEUE = 512;
+// task stacks, in bytes as ESP-IDF counts them
+static const size_t MEM_PIPELINE_STACKS = 12 * 1024;
+static const size_t MEM_GPS_STACK = 3 * 1024;
+
+static const size_t MEM_DRAM_TOTAL = MEM_SD_UTIL + MEM_MPU_UTIL + MEM_GPS_UTIL +
+                                     MEM_LORA_UTIL + MEM_PIPELINE_UTIL;
+// about a third of the static DRAM, the rest stays available to the heap
+static const size_t MEM_DRAM_LIMIT = 64 * 1024;
+static_assert(MEM_DRAM_TOTAL <= MEM_DRAM_LIMIT, "singletons exceed the DRAM budget");
+
+// RTC slow memory (RTC_DATA_ATTR)
+static const size_t MEM_RTC_MPU_SAMPLES = 4 * 1024 + 768;
+static const size_t MEM_RTC_GPS_FIXES = 1024;
+static const size_t MEM_RTC_UPLINKS = 512;
+static const size_t MEM_RTC_TRACK = 512;
+static const size_t MEM_RTC_GPS_AID = 32;
+static const size_t MEM_RTC_LORA_SESSION = 256;
+static const size_t MEM_RTC_MPU_STATE = 8;
+// startTS, wakeCount
+static const size_t MEM_RTC_STATE = 32;
+
+static const size_t MEM_RTC_TOTAL = MEM_RTC_MPU_SAMPLES + MEM_RTC_GPS_FIXES + MEM_RTC_UPLINKS +
+                                    MEM_RTC_TRACK + MEM_RTC_GPS_AID + MEM_RTC_LORA_SESSION +
+                                    MEM_RTC_MPU_STATE + MEM_RTC_STATE;
+// 8 KB of RTC slow memory less the ULP reservation of the Arduino core
+static const size_t MEM_RTC_LIMIT = 8 * 1024 - 512;
+static_assert(MEM_RTC_TOTAL <= MEM_RTC_LIMIT, "RTC variables exceed the RTC budget");
+
+#endif
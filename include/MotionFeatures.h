@@ -0,0 +1,99 @@
+#ifndef __MOTIONFEATURES_H__
+#define __MOTIONFEATURES_H__
+
+#include <stdint.h>
+#include "MPUBatch.h"
+#include "SPSCQueue.h"
+
+// Activity summary of one feature window, small enough for a single LoRa
+// uplink (sent as is on LoRaUtil::PORT_MOTION) and logged one line per
+// window next to the MPU log. Little-endian like the MPU log records.
+struct __attribute__((packed)) motion_features_t {
+    // milliseconds since startTS at the first sample, as in mpu_record_t
+    uint32_t tMs;
+    uint16_t samples;
+    // dynamic acceleration, the magnitude with gravity filtered out, in mg
+    uint16_t rmsMg;
+    uint16_t peakMg;
+    // mean magnitude, about 1000 at rest
+    uint16_t meanMg;
+    uint16_t steps;
+    uint16_t impacts;
+    // orientation change summed over one-second steps, in degrees
+    uint16_t rotationDeg;
+    // orientation change from the start to the end of the window, degrees
+    uint8_t tiltDeg;
+    // seconds with rmsMg above ACTIVE_MG, in percent
+    uint8_t activePct;
+    // orientation at the end of the window, QuatCodec with ORIENTATION_BITS
+    uint8_t orientation[4];
+};
+
+static_assert(sizeof(motion_features_t) == 24, "motion_features_t layout changed");
+
+typedef SPSCQueue<motion_features_t, 4> FeatureRing;
+
+// Feature extraction over the SoA batches of MPUBatch, run by the producer
+// of the batches (the acquisition task). Each batch is converted to float
+// channels; the acceleration magnitude goes through a high-pass biquad that
+// removes gravity and a low-pass one that keeps the gait band for step
+// detection. The channel arithmetic, filters and RMS use the esp-dsp
+// vector routines when the library is available and a scalar fallback
+// otherwise, which is what the native build runs.
+class MotionFeatures {
+    public:
+        MotionFeatures();
+        void process(const mpu_batch_t &batch, uint32_t timeBase);
+        // completed windows, consumed by the storage side
+        FeatureRing& windows() { return ring; }
+        // "<s>;<samples>;<rms>;<peak>;<mean>;<steps>;<impacts>;<rotation>;<tilt>;<active>;
+        // <qw>;<qx>;<qy>;<qz>\n"; returns the length, 0 if str is too small
+        static size_t format(const motion_features_t &f, char *str, size_t size);
+        static const size_t LINE_SIZE = 112;
+        // batches of NUM_SAMPLES per window, a minute at the DMP rate
+        static const uint8_t WINDOW_BATCHES = 60;
+        // MotionApps20 FIFO acceleration scale
+        static constexpr float ACCEL_LSB_PER_G = 8192.0f;
+        static constexpr float HIGH_PASS_HZ = 0.3f;
+        static constexpr float STEP_BAND_HZ = 4.0f;
+        // gait peaks of the band-passed magnitude, at most one per STEP_MIN_MS
+        static constexpr float STEP_G = 0.12f;
+        static const uint16_t STEP_MIN_MS = 250;
+        // an impact starts above IMPACT_G and ends below half of it
+        static constexpr float IMPACT_G = 1.0f;
+        static constexpr float ACTIVE_MG = 50.0f;
+        static const uint8_t ORIENTATION_BITS = 10;
+    private:
+        float mag[NUM_SAMPLES];
+        float dynamic[NUM_SAMPLES];
+        float band[NUM_SAMPLES];
+        float scratch[NUM_SAMPLES];
+        // b0, b1, b2, a1, a2 and the two state words of each biquad
+        float highPass[5];
+        float highPassState[2];
+        float lowPass[5];
+        float lowPassState[2];
+        // step detector state across batches
+        float bandPrev[2];
+        uint32_t lastStepMs;
+        bool inImpact;
+        // running window
+        motion_features_t window;
+        uint8_t batches;
+        uint8_t activeBatches;
+        float sumSquares;
+        float sumMag;
+        float peak;
+        float rotation;
+        int16_t windowStartQ[4];
+        int16_t lastQ[4];
+        bool hasLastQ;
+        FeatureRing ring;
+        void magnitude(const mpu_batch_t &batch, uint8_t n);
+        void detect(const mpu_batch_t &batch, uint8_t n);
+        void closeWindow();
+        static void lowPassCoefficients(float *coef, float freq);
+        static void highPassCoefficients(float *coef, float freq);
+};
+
+#endif
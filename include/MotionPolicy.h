@@ -0,0 +1,39 @@
+#ifndef __MOTIONPOLICY_H__
+#define __MOTIONPOLICY_H__
+
+#include <stdint.h>
+
+enum gps_policy_t : uint8_t {
+    GPS_POLICY_MOVING,
+    GPS_POLICY_STATIONARY,
+    GPS_POLICY_BACKUP
+};
+
+// GPS sampling policy driven by the motion state of the MPU. While moving
+// the GPS is read at the fast period; once the MPU reports zero motion the
+// period stretches, and after backupAfterMs without motion the receiver is
+// put in backup mode and only woken for a heartbeat fix every heartbeatMs.
+// Any motion returns to the fast period at once.
+class MotionPolicy {
+    public:
+        MotionPolicy(uint32_t movingMs, uint32_t stationaryMs, uint32_t backupAfterMs,
+                     uint32_t heartbeatMs)
+            : movingMs(movingMs), stationaryMs(stationaryMs), backupAfterMs(backupAfterMs),
+              heartbeatMs(heartbeatMs) {}
+        // returns true when the policy changed
+        bool update(bool moving, uint32_t nowMs);
+        gps_policy_t policy() { return current; }
+        uint32_t gpsPeriodMs();
+        // the receiver sleeps between reads
+        bool gpsBackup() { return current == GPS_POLICY_BACKUP; }
+        static const char* name(gps_policy_t policy);
+    private:
+        uint32_t movingMs;
+        uint32_t stationaryMs;
+        uint32_t backupAfterMs;
+        uint32_t heartbeatMs;
+        gps_policy_t current = GPS_POLICY_MOVING;
+        uint32_t stillSinceMs = 0;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef __PIPELINEUTIL_H__
+#define __PIPELINEUTIL_H__
+
+#include <Arduino.h>
+#include <atomic>
+#include <driver/uart.h>
+#include <freertos/semphr.h>
+#include "SDUtil.h"
+#include "GPSUtil.h"
+#include "MPUUtil.h"
+#include "LoRaUtil.h"
+#include "MotionPolicy.h"
+#include "SPSCQueue.h"
+#include "Trace.h"
+#include "TrackFilter.h"
+
+// GPS policy change, logged by the storage task
+struct policy_event_t {
+    uint32_t ts;
+    uint32_t periodMs;
+    gps_policy_t policy;
+};
+
+// Splits the work into FreeRTOS tasks pinned to different cores. The
+// acquisition task services the MPU and the GPS task publishes fixes, both
+// on core 1, filling the MPUUtil and GPSUtil rings; the storage task on
+// core 0 drains them into SDUtil and LoRaUtil. A slow SD write therefore
+// only delays the consumer side of the rings. Fixes pass track() on the
+// way, only the ones it retains are logged and sent.
+//
+// Between the jobs of the main loop idle() puts the chip in light sleep,
+// for as long as the MPU FIFO, pending flushes and LMIC jobs allow. Both
+// tasks hold a lock while they run so the chip never sleeps in the middle
+// of a bus transfer; a GPS read waiting for its fix keeps the chip awake.
+class PipelineUtil {
+    public:
+        static PipelineUtil* getInstance();
+        void setup(SegmentedLog *gpsLog, MPUUtil *mpu);
+        void setLogs(SegmentedLog *gpsLog, MPUUtil *mpu, const char *policyPath = nullptr);
+        void logPolicy(uint32_t ts, gps_policy_t policy, uint32_t periodMs);
+        void requestGPSRead();
+        void cancelGPSRead();
+        void flushTrack();
+        uint32_t takeStoredFixes();
+        void idle(uint32_t waitMs, bool allowSleep);
+        void printStats();
+        // configure before setup()
+        TrackFilter& track();
+    private:
+        PipelineUtil();
+        PipelineUtil(const PipelineUtil&) = delete;
+        PipelineUtil& operator=(const PipelineUtil&) = delete;
+        static constexpr const char *tag = "pipeline";
+        // task constants
+        static const BaseType_t ACQUISITION_CORE = 1;
+        static const BaseType_t STORAGE_CORE = 0;
+        static const uint32_t ACQUISITION_STACK = 4096;
+        static const uint32_t STORAGE_STACK = 8192;
+        static const UBaseType_t ACQUISITION_PRIORITY = 3;
+        static const UBaseType_t STORAGE_PRIORITY = 2;
+        static const uint32_t ACQUISITION_PERIOD_MS = 5;
+        static const uint32_t STORAGE_PERIOD_MS = 5;
+        // trace statistics are appended to the stats file this often
+        static const uint32_t STATS_PERIOD_MS = 60000;
+        // the GPS start-up aid on the card is refreshed this often
+        static const uint32_t AID_SAVE_PERIOD_MS = 600000;
+        // shorter waits are not worth the light sleep entry and exit
+        static const uint32_t MIN_SLEEP_MS = 10;
+        static const uint32_t MAX_SLEEP_MS = 60000;
+        // longest wait without light sleep, bounds the console latency
+        static const uint32_t IDLE_POLL_MS = 100;
+        // console input wakes the chip, the bytes that wake it are lost
+        static const uart_port_t CONSOLE_UART = UART_NUM_0;
+        static const int CONSOLE_WAKEUP_EDGES = 3;
+        GPSUtil *gps;
+        SDUtil *sd;
+        LoRaUtil *lora;
+        MPUUtil *mpu = nullptr;
+        SegmentedLog *gpsLog = nullptr;
+        const char *policyPath = nullptr;
+        // written by the main loop, drained by the storage task
+        SPSCQueue<policy_event_t, 4> policyEvents;
+        TrackFilter trackFilter{};
+        TaskHandle_t acquisitionHandle = nullptr;
+        TaskHandle_t storageHandle = nullptr;
+        // the main loop, woken when fixes were stored
+        TaskHandle_t loopHandle = nullptr;
+        SemaphoreHandle_t acquisitionLock = nullptr;
+        SemaphoreHandle_t storageLock = nullptr;
+        // tasks and locks live here, not on the heap
+        StackType_t acquisitionStack[ACQUISITION_STACK];
+        StackType_t storageStack[STORAGE_STACK];
+        StaticTask_t acquisitionBuffer;
+        StaticTask_t storageBuffer;
+        StaticSemaphore_t acquisitionLockBuffer;
+        StaticSemaphore_t storageLockBuffer;
+        uint32_t sleepCount = 0;
+        uint32_t sleepTotalMs = 0;
+        std::atomic<bool> gpsReadRequested{false};
+#ifdef TRACE_ENABLED
+        // start of the pending read, written before gpsReadRequested is set
+        uint32_t gpsRequestCycles = 0;
+        uint32_t gpsRequestMs = 0;
+#endif
+        std::atomic<bool> trackFlushRequested{false};
+        std::atomic<uint32_t> storedFixes{0};
+        uint32_t reportedOverflows = 0;
+        uint32_t lastStatsMs = 0;
+        uint32_t lastAidMs = 0;
+        uint32_t savedAidTs = 0;
+        static void acquisitionTask(void *arg);
+        static void storageTask(void *arg);
+        static void onFix(const gps_fix_t &fix, void *arg);
+        void acquire();
+        void store();
+        void storeFix(const gps_fix_t &fix);
+        void saveAid();
+        void writePolicy();
+        void checkOverflows();
+        void traceQueues();
+        bool lockTasks();
+        void unlockTasks();
+        uint32_t sleepBudget(uint32_t maxMs);
+        void lightSleep(uint32_t ms);
+};
+
+#endif
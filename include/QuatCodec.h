@@ -0,0 +1,49 @@
+#ifndef __QUATCODEC_H__
+#define __QUATCODEC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "MPURecord.h"
+
+// Smallest-three quaternion encoding. The input is normalised and its
+// sign chosen so the largest component is positive; that component is
+// dropped and its index stored in 2 bits, the other three, which lie in
+// [-1/sqrt(2), 1/sqrt(2)], are quantised to `bits` bits each. The dropped
+// one is rebuilt from the unit norm. The value is stored LSB first: index
+// in bits 0-1, then the three components in index order.
+//
+// Against the Q14 quaternion of the DMP (8 bytes), rotation error bound
+// from maxErrorDeg() and the error measured over a million random
+// orientations with the native "quat" command:
+//
+//   bits  bytes  bound    max      rms
+//    10     4    0.51°    0.26°    0.09°
+//    11     5    0.26°    0.13°    0.05°
+//    12     5    0.14°    0.067°   0.023°
+//    13     6    0.076°   0.033°   0.011°
+//    14     6    0.045°   0.019°   0.007°
+//    15     6    0.029°   0.013°   0.002°
+class QuatCodec {
+    public:
+        static const uint8_t MIN_BITS = 10;
+        static const uint8_t MAX_BITS = 15;
+        // encoded size for bits per component
+        static size_t bytes(uint8_t bits) { return (2 + 3 * bits + 7) / 8; }
+        // q in Q14 (w, x, y, z); returns the bytes written to out
+        static size_t encode(const int16_t *q, uint8_t bits, uint8_t *out);
+        static void decode(const uint8_t *in, uint8_t bits, int16_t *q);
+        // bound on the rotation between a quaternion and its decoded copy
+        static float maxErrorDeg(uint8_t bits);
+        // rotation between two Q14 quaternions, 0 to 180 degrees
+        static float angleDeg(const int16_t *q1, const int16_t *q2);
+        // MPU_LOG_VERSION_PACKED record: tMs, encoded quaternion, g, a
+        static size_t recordSize(uint8_t bits) { return 4 + bytes(bits) + 12; }
+        static size_t packRecord(const mpu_record_t &record, uint8_t bits, uint8_t *out);
+        static void unpackRecord(const uint8_t *in, uint8_t bits, mpu_record_t &record);
+    private:
+        // quantisation steps over [-1/sqrt(2), 1/sqrt(2)], even so that 0 is
+        // exact; the top code is unused
+        static uint32_t steps(uint8_t bits) { return (1u << bits) - 2; }
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __RTCRING_H__
+#define __RTCRING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-size FIFO meant to be declared RTC_DATA_ATTR so its contents
+// survive deep sleep. It has no constructor, a zero-initialised instance
+// is empty. Not thread safe, it is only used from setup() between sleeps.
+template <typename T, uint16_t N>
+struct RTCRing {
+    uint16_t head;
+    uint16_t count;
+    // items lost because the ring was full
+    uint32_t overflows;
+    T items[N];
+
+    // the oldest item is dropped when the ring is full
+    bool push(const T &item) {
+        bool overwrote = count == N;
+        items[head] = item;
+        head = (head + 1) % N;
+        if (overwrote) {
+            overflows++;
+        } else {
+            count++;
+        }
+        return !overwrote;
+    }
+    bool pop(T &item) {
+        if (count == 0) {
+            return false;
+        }
+        item = items[(head + N - count) % N];
+        count--;
+        return true;
+    }
+    uint16_t size() const { return count; }
+    static constexpr uint16_t capacity() { return N; }
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef __RAWLOG_H__
+#define __RAWLOG_H__
+
+#include <stdint.h>
+
+// Layout of the raw log partition, an MBR partition of type
+// RAW_LOG_PARTITION_TYPE next to the FAT one that high-rate captures write
+// sector by sector without a file system. Partition sectors 0 and 1 hold
+// alternating copies of raw_superblock_t, the intact one with the higher
+// seq is current. Session data starts at RAW_LOG_DATA_SECTOR and sessions
+// follow each other; the bytes of a session are the stream a log file would
+// hold (an MPU log with its header, see MPURecord.h). All fields are
+// little-endian. tools/raw_extract.py copies the sessions out of a card
+// image or block device.
+
+static const uint8_t RAW_LOG_PARTITION_TYPE = 0xDA;
+static const uint32_t RAW_LOG_MAGIC = 0x4C574152;
+static const uint16_t RAW_LOG_VERSION = 1;
+static const uint16_t RAW_LOG_SECTOR_SIZE = 512;
+static const uint32_t RAW_LOG_DATA_SECTOR = 2;
+static const uint8_t RAW_LOG_MAX_SESSIONS = 30;
+
+struct __attribute__((packed)) raw_session_t {
+    // epoch seconds, a reopened log with the same startTS continues the
+    // session
+    uint32_t startTS;
+    // relative to the partition start
+    uint32_t firstSector;
+    uint32_t bytes;
+    uint32_t reserved;
+};
+
+struct __attribute__((packed)) raw_superblock_t {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t sessions;
+    uint8_t reserved;
+    uint32_t seq;
+    // partition size in sectors
+    uint32_t sectors;
+    raw_session_t session[RAW_LOG_MAX_SESSIONS];
+    // CRC-32 (zlib) of the fields above
+    uint32_t crc;
+};
+
+static_assert(sizeof(raw_superblock_t) <= RAW_LOG_SECTOR_SIZE, "superblock must fit a sector");
+
+#endif
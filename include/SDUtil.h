@@ -5,24 +5,56 @@
 #include <FS.h>
 #include <SD.h>
 #include <SPI.h>
+#include "ArduinoHAL.h"
+#include "LogStream.h"
+#include "SegmentedLog.h"
 
 class SDUtil {
     public:
         static SDUtil* getInstance();
         void setup();
+        void loop();
         void appendFile(const char *path, const char *message);
+        bool writeData(const char *path, const void *data, size_t len);
+        bool readData(const char *path, void *data, size_t len);
+        LogStream* openLog(const char *path);
+        void closeLog(LogStream *log);
+        SegmentedLog* openSegmentedLog(const char *base, const char *ext,
+                                       uint32_t maxBytes, uint32_t maxSpanS);
+        LogStream* openRawLog(uint32_t startTS);
+        BlockSink* openRawSink(uint32_t startTS);
+        uint16_t findLogRange(const char *base, uint32_t from, uint32_t to,
+                              log_range_t *ranges, uint16_t maxRanges);
+        void flushLogs();
+        uint32_t untilFlush();
+        void recoverLogs();
     private:
         SDUtil();
         SDUtil(const SDUtil&) = delete;
         SDUtil& operator=(const SDUtil&) = delete;
-        static SDUtil* pInstance;
         // SD card constants
         static const uint8_t SCLK_PIN = 25; 
         static const uint8_t MISO_PIN = 32;
         static const uint8_t MOSI_PIN = 13;
         static const uint8_t SS_PIN = 33;
+        static const uint8_t MAX_LOG_STREAMS = 2;
+        // index entries preallocated per segmented log, it grows past them
+        static const uint32_t INDEX_CAPACITY = 256 * sizeof(log_index_entry_t);
         // SD card related variables
-        SPIClass *hspi = NULL;
+        // a retried setup() reuses the bus instead of allocating another
+        SPIClass hspi{HSPI};
+        bool mounted = false;
+        SDFileSink logFiles[MAX_LOG_STREAMS];
+        LogStream logs[MAX_LOG_STREAMS];
+        // a segmented log uses the stream of its slot and writes its
+        // segments and index in place
+        SDPreallocatedSink segmentFiles[MAX_LOG_STREAMS];
+        SDPreallocatedSink indexFiles[MAX_LOG_STREAMS];
+        SegmentedLog segmentedLogs[MAX_LOG_STREAMS];
+        SDFileStore store;
+        SDRawSink rawSink;
+        bool rawReady = false;
+        int8_t freeSlot();
         void listDir(fs::FS &fs, const char *dirname, uint8_t levels);
         void createDir(fs::FS &fs, const char *path);
         void removeDir(fs::FS &fs, const char *path);
@@ -35,4 +67,4 @@ class SDUtil {
 };
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,57 @@
+#ifndef __SPSCQUEUE_H__
+#define __SPSCQUEUE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Lock-free single-producer/single-consumer ring. push() may only be
+// called from one task (or ISR) and pop() from one other task. Indices run
+// freely and are masked on access, so N must be a power of two.
+template <typename T, size_t N>
+class SPSCQueue {
+    static_assert(N && (N & (N - 1)) == 0, "SPSCQueue size must be a power of two");
+    public:
+        bool push(const T &item) {
+            uint32_t h = head.load(std::memory_order_relaxed);
+            size_t used = h - tail.load(std::memory_order_acquire);
+            if (used >= N) {
+                overflowCount.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            items[h & (N - 1)] = item;
+            head.store(h + 1, std::memory_order_release);
+            if (used + 1 > highWaterMark) {
+                highWaterMark = used + 1;
+            }
+            return true;
+        }
+        bool pop(T &item) {
+            uint32_t t = tail.load(std::memory_order_relaxed);
+            if (t == head.load(std::memory_order_acquire)) {
+                return false;
+            }
+            item = items[t & (N - 1)];
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+        size_t size() const {
+            return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+        }
+        bool empty() const { return size() == 0; }
+        static constexpr size_t capacity() { return N; }
+        // items rejected because the ring was full
+        uint32_t overflows() const { return overflowCount.load(std::memory_order_relaxed); }
+        // deepest fill level seen by the producer
+        size_t highWater() const { return highWaterMark; }
+    private:
+        T items[N];
+        // written by the producer only
+        std::atomic<uint32_t> head{0};
+        // written by the consumer only
+        std::atomic<uint32_t> tail{0};
+        std::atomic<uint32_t> overflowCount{0};
+        volatile size_t highWaterMark = 0;
+};
+
+#endif
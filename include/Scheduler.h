@@ -0,0 +1,35 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*scheduler_job_t)(void *arg);
+
+// Periodic jobs on millisecond deadlines. Each deadline advances by whole
+// periods from the previous one, so a late run does not shift the cadence,
+// and run() tells the caller how long it may sleep before the next one is
+// due. Times come from the caller (halMillis() on the device) and may wrap.
+class Scheduler {
+    public:
+        static const uint8_t MAX_JOBS = 8;
+        // first run one period after nowMs, returns the job id or -1 when full
+        int8_t every(uint32_t periodMs, scheduler_job_t job, void *arg, uint32_t nowMs);
+        // new period for a job, the next run is at most one new period away
+        void setPeriod(int8_t id, uint32_t periodMs, uint32_t nowMs);
+        // runs the jobs that are due, returns the ms until the next deadline
+        uint32_t run(uint32_t nowMs);
+        // ms until the next deadline, 0 if one is due
+        uint32_t untilNext(uint32_t nowMs);
+    private:
+        struct entry_t {
+            scheduler_job_t job;
+            void *arg;
+            uint32_t periodMs;
+            uint32_t nextMs;
+        };
+        entry_t jobs[MAX_JOBS];
+        uint8_t count = 0;
+};
+
+#endif
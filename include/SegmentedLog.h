@@ -0,0 +1,116 @@
+#ifndef __SEGMENTEDLOG_H__
+#define __SEGMENTEDLOG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "HAL.h"
+#include "LogStream.h"
+
+// Log split into numbered segment files (<base>-0000<ext>, <base>-0001<ext>,
+// ...) with an append-only index (<base>.idx) of log_index_entry_t. Each
+// segment gets a checkpoint entry when it starts, every CHECKPOINT_BYTES, on
+// flush() and at its end, and a segment entry with its time span, record
+// count and size when it is closed, so a time range is found from the index
+// alone.
+//
+// A new segment starts when the current one would exceed maxBytes or span
+// more than maxSpanS seconds. After a reboot or deep sleep the last segment
+// is continued from its latest checkpoint unless it was closed. Timestamps
+// are epoch seconds and must not decrease. Checkpoints may point past the
+// end of a segment that lost its buffered tail to a power failure; readers
+// clamp them to the file size.
+//
+// Every entry carries a CRC-32. An entry torn by a power failure is padded
+// to full size when the index is reopened, so the entries after it stay
+// aligned; open() and LogIndex::find() skip entries that fail the CRC.
+
+static const uint8_t LOG_INDEX_CHECKPOINT = 1;
+static const uint8_t LOG_INDEX_SEGMENT = 2;
+
+// records before offset have timestamps up to ts, the ones after from ts on
+struct __attribute__((packed)) log_index_entry_t {
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t segment;
+    // checkpoint: timestamp at offset; segment: last timestamp
+    uint32_t ts;
+    // first timestamp of the segment
+    uint32_t firstTs;
+    // records before offset
+    uint32_t records;
+    // checkpoint: byte offset of a record; segment: segment size
+    uint32_t offset;
+    // CRC-32 of the fields above
+    uint32_t crc;
+};
+
+static_assert(sizeof(log_index_entry_t) == 24, "log_index_entry_t layout changed");
+
+class SegmentedLog {
+    public:
+        static const uint32_t CHECKPOINT_BYTES = 64 * 1024;
+        static const uint8_t MAX_PATH = 48;
+        static const uint8_t MAX_HEADER = 32;
+        // base is the path without the segment number and extension
+        bool open(LogStream *log, FileSink *data, FileSink *index, FileStore *store,
+                  const char *base, const char *ext, uint32_t maxBytes, uint32_t maxSpanS);
+        // bytes written at the start of every segment, e.g. a file header
+        void setHeader(const void *header, size_t len);
+        // writes records entries with timestamp ts (the first one's for a
+        // block), never splitting them across segments
+        size_t write(uint32_t ts, const uint8_t *data, size_t len, uint16_t records = 1);
+        size_t print(uint32_t ts, const char *message);
+        bool flush();
+        void close();
+        bool isOpen() const { return opened; }
+        // number of the segment being written
+        uint16_t segment() const { return segmentNumber; }
+        static void segmentPath(const char *base, const char *ext, uint16_t segment, char *path, size_t size);
+        static void indexPath(const char *base, char *path, size_t size);
+        static bool isValid(const log_index_entry_t &entry);
+    private:
+        LogStream *log = nullptr;
+        FileSink *data = nullptr;
+        FileSink *index = nullptr;
+        char base[MAX_PATH];
+        char ext[8];
+        uint8_t header[MAX_HEADER];
+        uint8_t headerSize = 0;
+        uint32_t maxBytes = 0;
+        uint32_t maxSpanS = 0;
+        bool opened = false;
+        bool segmentOpen = false;
+        uint16_t segmentNumber = 0;
+        uint32_t firstTs = 0;
+        uint32_t lastTs = 0;
+        uint32_t records = 0;
+        uint32_t nextCheckpoint = 0;
+        // continuing a segment left open before the reboot
+        bool resumed = false;
+        // offset of the latest checkpoint
+        uint32_t lastCheckpoint = 0;
+        bool lastEntry(FileStore *store, const char *path, uint32_t size, log_index_entry_t &entry);
+        bool startSegment(uint32_t ts);
+        void endSegment();
+        void checkpoint(uint32_t ts);
+        void writeIndex(uint8_t type, uint32_t ts, uint32_t offset);
+};
+
+// part of a segment covering a time range, end is 0 up to the segment end
+struct log_range_t {
+    uint16_t segment;
+    uint32_t offset;
+    uint32_t end;
+};
+
+// Time range lookup on the index of a SegmentedLog, reading only the
+// index file.
+class LogIndex {
+    public:
+        // fills ranges with the segment parts that may hold records in
+        // [from, to], returns their count
+        static uint16_t find(FileStore &store, const char *base, uint32_t from, uint32_t to,
+                             log_range_t *ranges, uint16_t maxRanges);
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef __TEXTWRITER_H__
+#define __TEXTWRITER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Formats numbers into a caller buffer without printf or heap use. Writes
+// stop at the end of the buffer, which always stays NUL-terminated, and the
+// truncation is reported by overflowed().
+class TextWriter {
+    public:
+        TextWriter(char *buffer, size_t size);
+        TextWriter& put(char c);
+        TextWriter& str(const char *s);
+        // zero padded to minDigits
+        TextWriter& u32(uint32_t value, uint8_t minDigits = 1);
+        TextWriter& i32(int32_t value);
+        // value / 10^decimals, e.g. fixed(-8050000, 6) is "-8.050000"
+        TextWriter& fixed(int64_t value, uint8_t decimals);
+        // Q14 value (1.0 = 16384) rounded to decimals places
+        TextWriter& q14(int16_t value, uint8_t decimals);
+        // rounded to decimals places, at most 9, with the digits and sign
+        // printf("%.*f") gives
+        TextWriter& fixedFloat(float value, uint8_t decimals);
+        size_t length() const { return used; }
+        bool overflowed() const { return overflow; }
+        const char* c_str() const { return buffer; }
+    private:
+        char *buffer;
+        size_t size;
+        size_t used = 0;
+        bool overflow = false;
+        TextWriter& digits(uint64_t value, uint8_t minDigits);
+};
+
+#endif
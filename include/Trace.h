@@ -0,0 +1,95 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Hot path instrumentation, built with -DTRACE_ENABLED. Scoped timers read
+// the CPU cycle counter (halMicros() in the native build) and feed a log2
+// latency histogram per stage plus a fixed-size ring of the latest events;
+// queue gauges keep the depth and drop counts of the pipeline buffers.
+// Without TRACE_ENABLED the macros expand to nothing and no memory is used.
+
+enum trace_stage_t : uint8_t {
+    // from the read request to the fix handed to the pipeline
+    TRACE_GPS_READ,
+    TRACE_GPS_PARSE,
+    TRACE_MPU_READ,
+    TRACE_SD_APPEND,
+    TRACE_SD_WRITE,
+    TRACE_LORA_SEND,
+    TRACE_LORA_LOOP,
+    TRACE_STAGES
+};
+
+enum trace_queue_t : uint8_t {
+    TRACE_QUEUE_GPS,
+    TRACE_QUEUE_MPU,
+    // bytes in the DMP FIFO at the last drain
+    TRACE_QUEUE_MPU_FIFO,
+    TRACE_QUEUE_UPLINK,
+    TRACE_QUEUES
+};
+
+// receives the statistics one JSON line at a time, newline included
+typedef void (*trace_writer_t)(const char *line, void *arg);
+
+#ifdef TRACE_ENABLED
+
+#include "HAL.h"
+
+#ifdef ESP32
+#include <xtensa/hal.h>
+#endif
+
+struct trace_event_t {
+    // cycle count at the start of the stage
+    uint32_t start;
+    uint32_t us;
+    uint8_t stage;
+};
+
+class Trace {
+    public:
+        // bucket b counts durations in [2^(b-1), 2^b) us, bucket 0 below 1 us
+        static const uint8_t HIST_BUCKETS = 24;
+        static const uint8_t EVENT_RING_SIZE = 64;
+        static inline uint32_t cycles() {
+#ifdef ESP32
+            return xthal_get_ccount();
+#else
+            return halMicros();
+#endif
+        }
+        static void begin();
+        static void record(trace_stage_t stage, uint32_t start, uint32_t end);
+        // for spans the cycle counter may wrap in, it does after 17 s at 240 MHz
+        static void recordUs(trace_stage_t stage, uint32_t start, uint32_t us);
+        // depth now and drops so far of a pipeline queue
+        static void queue(trace_queue_t queue, uint32_t depth, uint32_t drops);
+        static void dump(trace_writer_t writer, void *arg, bool events);
+        static void reset();
+};
+
+class TraceScope {
+    public:
+        explicit TraceScope(trace_stage_t stage) : stage(stage), start(Trace::cycles()) {}
+        ~TraceScope() { Trace::record(stage, start, Trace::cycles()); }
+    private:
+        trace_stage_t stage;
+        uint32_t start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(stage) TraceScope TRACE_CONCAT(traceScope, __LINE__)(stage)
+#define TRACE_QUEUE(id, depth, drops) Trace::queue(id, depth, drops)
+
+#else
+
+#define TRACE_SCOPE(stage) do {} while (0)
+#define TRACE_QUEUE(id, depth, drops) do {} while (0)
+
+#endif
+
+#endif
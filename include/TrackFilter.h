@@ -0,0 +1,58 @@
+#ifndef __TRACKFILTER_H__
+#define __TRACKFILTER_H__
+
+#include <stdint.h>
+#include "GPSParser.h"
+
+// fix reduced to what the filter compares, coordinates in 1e-6 degrees
+struct track_point_t {
+    uint32_t ts;
+    int32_t lat;
+    int32_t lng;
+};
+
+// Streaming trajectory simplification (opening window with the
+// synchronized Euclidean distance). Fixes are held in a window after the
+// last retained one, the anchor; when a new fix makes a held one stray
+// more than the tolerance from where the straight anchor-to-fix movement
+// puts it at its time, the newest held fix is retained and becomes the
+// anchor. A full window also retains it, and a fix maxGapS after the anchor
+// is retained so a standing asset still reports. Distances are in integer
+// micro-degrees of latitude, longitudes scaled by a fixed-point cosine.
+//
+// Like RTCRing it has no constructor: a zero-initialised instance passes
+// every fix through until configure() sets a tolerance, so it can live in
+// RTC memory across deep sleep.
+class TrackFilter {
+    public:
+        static const uint8_t WINDOW = 32;
+        // toleranceM 0 retains every fix, maxGapS 0 has no time limit
+        void configure(uint16_t toleranceM, uint32_t maxGapS);
+        // feeds the next fix; returns true with a retained fix in out,
+        // which may be an earlier one
+        bool add(const gps_fix_t &fix, gps_fix_t &out);
+        // retains the newest held fix, e.g. before the receiver sleeps
+        bool flush(gps_fix_t &out);
+        uint32_t inputs() const { return inputCount; }
+        uint32_t retained() const { return retainedCount; }
+        // Q15 cosine of a latitude in 1e-6 degrees (Bhaskara I), 0.2% off
+        static int32_t cosQ15(int32_t lat);
+    private:
+        // micro-degrees of latitude
+        int32_t tolerance;
+        uint32_t maxGapS;
+        bool anchored;
+        track_point_t anchor;
+        int32_t anchorCos;
+        uint8_t held;
+        track_point_t window[WINDOW];
+        // newest held fix in full
+        gps_fix_t last;
+        uint32_t inputCount;
+        uint32_t retainedCount;
+        void setAnchor(const track_point_t &point);
+        bool deviates(const track_point_t &end) const;
+        static track_point_t point(const gps_fix_t &fix);
+};
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef __UBX_H__
+#define __UBX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// u-blox UBX binary protocol: frame builder for configuration messages and
+// an incremental frame parser. Payload structs are little-endian and are
+// read in place from the parser buffer.
+
+static const uint8_t UBX_SYNC1 = 0xB5;
+static const uint8_t UBX_SYNC2 = 0x62;
+// sync, class, id, length and checksum around the payload
+static const uint8_t UBX_FRAME_OVERHEAD = 8;
+
+static const uint8_t UBX_CLASS_NAV = 0x01;
+static const uint8_t UBX_CLASS_RXM = 0x02;
+static const uint8_t UBX_CLASS_ACK = 0x05;
+static const uint8_t UBX_CLASS_CFG = 0x06;
+static const uint8_t UBX_CLASS_MGA = 0x13;
+static const uint8_t UBX_NAV_PVT = 0x07;
+static const uint8_t UBX_ACK_ACK = 0x01;
+static const uint8_t UBX_CFG_PRT = 0x00;
+static const uint8_t UBX_CFG_MSG = 0x01;
+static const uint8_t UBX_CFG_RATE = 0x08;
+static const uint8_t UBX_RXM_PMREQ = 0x41;
+static const uint8_t UBX_MGA_INI = 0x40;
+
+// NAV-PVT, available on u-blox 7 and later receivers (NEO-M8N on T-Beam v1)
+struct __attribute__((packed)) ubx_nav_pvt_t {
+    uint32_t iTOW;
+    uint16_t year;
+    uint8_t month;
+    uint8_t day;
+    uint8_t hour;
+    uint8_t min;
+    uint8_t sec;
+    // bit 0 validDate, bit 1 validTime
+    uint8_t valid;
+    uint32_t tAcc;
+    int32_t nano;
+    // 0 no fix, 2 2D, 3 3D
+    uint8_t fixType;
+    // bit 0 gnssFixOK
+    uint8_t flags;
+    uint8_t flags2;
+    uint8_t numSV;
+    // 1e-7 degrees
+    int32_t lon;
+    int32_t lat;
+    // millimetres
+    int32_t height;
+    int32_t hMSL;
+    uint32_t hAcc;
+    uint32_t vAcc;
+    // mm/s
+    int32_t velN;
+    int32_t velE;
+    int32_t velD;
+    int32_t gSpeed;
+    // 1e-5 degrees
+    int32_t headMot;
+    uint32_t sAcc;
+    uint32_t headAcc;
+    // 0.01
+    uint16_t pDOP;
+    uint8_t reserved1[6];
+    int32_t headVeh;
+    int16_t magDec;
+    uint16_t magAcc;
+};
+
+static_assert(sizeof(ubx_nav_pvt_t) == 92, "ubx_nav_pvt_t layout changed");
+
+// writes a complete frame into out, which must hold len + UBX_FRAME_OVERHEAD
+// bytes, and returns its size
+size_t ubxBuildFrame(uint8_t msgClass, uint8_t msgId, const uint8_t *payload,
+                     uint16_t len, uint8_t *out);
+
+class UBXParser {
+    public:
+        static const uint16_t MAX_PAYLOAD = 100;
+        UBXParser();
+        // returns true when a frame with a valid checksum was completed
+        bool feed(uint8_t c);
+        uint8_t msgClass() const { return frameClass; }
+        uint8_t msgId() const { return frameId; }
+        uint16_t length() const { return frameLength; }
+        const uint8_t* payload() const { return buffer; }
+        // view of the last frame as T, or null if it is another message
+        template <typename T>
+        const T* as(uint8_t cls, uint8_t id) const {
+            if (frameClass != cls || frameId != id || frameLength != sizeof(T)) {
+                return nullptr;
+            }
+            return reinterpret_cast<const T*>(buffer);
+        }
+        uint32_t checksumErrors() const { return badFrames; }
+    private:
+        enum State { SYNC1, SYNC2, CLASS, ID, LENGTH1, LENGTH2, PAYLOAD, CHECK_A, CHECK_B };
+        State state;
+        uint8_t frameClass;
+        uint8_t frameId;
+        uint16_t frameLength;
+        uint16_t received;
+        uint8_t ckA;
+        uint8_t ckB;
+        uint32_t badFrames;
+        uint8_t buffer[MAX_PAYLOAD] __attribute__((aligned(4)));
+        void checksum(uint8_t c);
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef __UPLINKQUEUE_H__
+#define __UPLINKQUEUE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "HAL.h"
+#include "LoRaPayload.h"
+
+// Fixes waiting for an uplink. A frame packs as many queued fixes as fit
+// the payload limit and they only leave the queue once the radio reports
+// the frame as sent, so a busy radio no longer loses data. Scheduling is
+// left to the owner (LoRaUtil on the device).
+class UplinkQueue {
+    public:
+        static const uint8_t SIZE = 32;
+        // typical encoded fix: 1-byte time delta and two int32 coordinates
+        static const uint8_t FIX_RECORD_SIZE = 9;
+        // the port already tells the payload type, no header byte needed
+        UplinkQueue() : encoder(false, false) {}
+        // queues a fix; when full the oldest one that is not on air is
+        // dropped, or fix itself if the whole queue is
+        bool push(const lora_fix_t &fix);
+        // builds one frame from the head of the queue and sends it,
+        // returns the number of fixes in it
+        uint8_t transmit(RadioSink &radio, uint8_t maxPayload, uint8_t port);
+        // the frame on air was sent, its fixes leave the queue
+        void complete();
+        // the frame on air was lost, its fixes stay queued
+        void cancel() { pending = 0; }
+        // removes the oldest fix that is not on air
+        bool pop(lora_fix_t &fix);
+        // true when a frame of maxPayload bytes would be full
+        bool frameFull(uint8_t maxPayload) const { return queueCount >= maxPayload / FIX_RECORD_SIZE; }
+        uint8_t count() const { return queueCount; }
+        uint8_t inFlight() const { return pending; }
+        size_t frameLength() const { return encoder.length(); }
+        uint32_t dropped() const { return droppedCount; }
+    private:
+        LoRaPayloadEncoder encoder;
+        lora_fix_t queue[SIZE];
+        uint8_t queueHead = 0;
+        uint8_t queueCount = 0;
+        // fixes of the frame handed to the radio
+        uint8_t pending = 0;
+        uint32_t droppedCount = 0;
+        const lora_fix_t& queued(uint8_t i) const;
+        void dequeue(uint8_t count);
+};
+
+#endif
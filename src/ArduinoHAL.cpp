@@ -0,0 +1,538 @@
+#include "ArduinoHAL.h"
+#include <SD.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include "CRC32.h"
+#include "TextWriter.h"
+
+// VFS mount point of SD, truncate() needs the full path
+static const char *SD_MOUNT_POINT = "/sd";
+static const char *JOURNAL_EXT = ".jnl";
+
+uint32_t halMillis() {
+    return millis();
+}
+
+uint32_t halMicros() {
+    return micros();
+}
+
+bool SDFileSink::open(fs::FS &fs, const char *path) {
+    file = fs.open(path, FILE_APPEND);
+    if (!file) {
+        Serial.println("Failed to open file for appending");
+        return false;
+    }
+    fileSize = file.size();
+    return true;
+}
+
+bool SDFileSink::open(const char *path) {
+    return open(SD, path);
+}
+
+size_t SDFileSink::write(const uint8_t *data, size_t len) {
+    size_t written = file.write(data, len);
+    fileSize += written;
+    if (written != len) {
+        Serial.println("Append failed");
+    }
+    return written;
+}
+
+bool SDFileSink::sync() {
+    file.flush();
+    return true;
+}
+
+size_t SDFileSink::size() {
+    return fileSize;
+}
+
+bool SDFileSink::isOpen() {
+    return (bool)file;
+}
+
+void SDFileSink::close() {
+    file.close();
+}
+
+void SDPreallocatedSink::setCapacity(uint32_t bytes) {
+    capacity = bytes;
+}
+
+bool SDPreallocatedSink::open(const char *path) {
+    TextWriter(this->path, sizeof(this->path)).str(path);
+    journalFor(path, journalPath, sizeof(journalPath));
+    // a journal is left behind by a reset, its commit is the valid length
+    commit_t last;
+    bool journaled = readCommit(journalPath, last);
+    if (!SD.exists(path)) {
+        File created = SD.open(path, FILE_WRITE);
+        if (!created) {
+            Serial.println("Failed to create log file");
+            return false;
+        }
+        created.close();
+    }
+    file = SD.open(path, "r+");
+    if (!file) {
+        Serial.println("Failed to open log file");
+        return false;
+    }
+    length = file.size();
+    seq = 0;
+    if (journaled) {
+        length = last.length < length ? last.length : length;
+        seq = last.seq;
+    } else {
+        // the journal goes first, a preallocated file without one would be
+        // taken as full after a reset
+        File created = SD.open(journalPath, FILE_WRITE);
+        uint8_t zeros[SLOT_SIZE] = {};
+        bool ok = created && created.write(zeros, SLOT_SIZE) == SLOT_SIZE &&
+                  created.write(zeros, SLOT_SIZE) == SLOT_SIZE;
+        created.close();
+        if (!ok) {
+            Serial.println("Failed to create log journal");
+            file.close();
+            return false;
+        }
+    }
+    journal = SD.open(journalPath, "r+");
+    if (!journal || (!journaled && !commit())) {
+        Serial.println("Failed to open log journal");
+        journal.close();
+        file.close();
+        return false;
+    }
+    // grows the cluster chain in one go, FatFs extends the file on a seek
+    // past its end
+    if (file.size() < capacity && file.seek(capacity - 1)) {
+        file.write((uint8_t)0);
+        file.flush();
+    }
+    file.seek(length);
+    return true;
+}
+
+size_t SDPreallocatedSink::write(const uint8_t *data, size_t len) {
+    size_t written = file.write(data, len);
+    length += written;
+    if (written != len) {
+        Serial.println("Log write failed");
+    }
+    return written;
+}
+
+// makes the written data durable, then commits its length
+bool SDPreallocatedSink::sync() {
+    file.flush();
+    return commit();
+}
+
+size_t SDPreallocatedSink::size() {
+    return length;
+}
+
+bool SDPreallocatedSink::isOpen() {
+    return (bool)file;
+}
+
+void SDPreallocatedSink::close() {
+    if (!file) {
+        return;
+    }
+    sync();
+    file.close();
+    journal.close();
+    // the journal stays until the preallocated tail is gone
+    if (truncate(path, length)) {
+        SD.remove(journalPath);
+    }
+}
+
+bool SDPreallocatedSink::recover(const char *journalPath) {
+    size_t len = strlen(journalPath);
+    size_t ext = strlen(JOURNAL_EXT);
+    if (len <= ext || len - ext >= MAX_PATH || strcmp(journalPath + len - ext, JOURNAL_EXT)) {
+        return false;
+    }
+    char path[MAX_PATH];
+    memcpy(path, journalPath, len - ext);
+    path[len - ext] = '\0';
+    commit_t last;
+    if (!readCommit(journalPath, last)) {
+        return false;
+    }
+    if (!truncate(path, last.length)) {
+        return false;
+    }
+    Serial.printf("Recovered %s at %u bytes\n", path, last.length);
+    return SD.remove(journalPath);
+}
+
+bool SDPreallocatedSink::committedLength(const char *path, uint32_t &length) {
+    char journalPath[MAX_PATH + 4];
+    journalFor(path, journalPath, sizeof(journalPath));
+    commit_t last;
+    if (!readCommit(journalPath, last)) {
+        return false;
+    }
+    length = last.length;
+    return true;
+}
+
+bool SDPreallocatedSink::commit() {
+    commit_t record = { COMMIT_MAGIC, seq + 1, length, 0 };
+    record.crc = CRC32::compute((const uint8_t *)&record, offsetof(commit_t, crc));
+    // alternating slots, a torn write leaves the previous commit intact
+    if (!journal.seek((record.seq & 1) * SLOT_SIZE) ||
+        journal.write((const uint8_t *)&record, sizeof(record)) != sizeof(record)) {
+        return false;
+    }
+    journal.flush();
+    seq = record.seq;
+    return true;
+}
+
+void SDPreallocatedSink::journalFor(const char *path, char *journalPath, size_t size) {
+    TextWriter(journalPath, size).str(path).str(JOURNAL_EXT);
+}
+
+// latest intact commit of a journal
+bool SDPreallocatedSink::readCommit(const char *journalPath, commit_t &last) {
+    File journal = SD.open(journalPath, FILE_READ);
+    if (!journal) {
+        return false;
+    }
+    bool found = false;
+    for (uint8_t slot = 0; slot < 2; slot++) {
+        commit_t record;
+        if (!journal.seek(slot * SLOT_SIZE) ||
+            journal.read((uint8_t *)&record, sizeof(record)) != sizeof(record)) {
+            continue;
+        }
+        if (record.magic != COMMIT_MAGIC ||
+            record.crc != CRC32::compute((const uint8_t *)&record, offsetof(commit_t, crc))) {
+            continue;
+        }
+        if (!found || (int32_t)(record.seq - last.seq) > 0) {
+            last = record;
+            found = true;
+        }
+    }
+    journal.close();
+    return found;
+}
+
+bool SDPreallocatedSink::truncate(const char *path, uint32_t length) {
+    char vfsPath[MAX_PATH + 4];
+    TextWriter(vfsPath, sizeof(vfsPath)).str(SD_MOUNT_POINT).str(path);
+    return ::truncate(vfsPath, length) == 0;
+}
+
+// CRC-7 of an SD command frame, with the end bit set
+static uint8_t crc7(const uint8_t *data, size_t len) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint8_t d = data[i];
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc <<= 1;
+            if ((d ^ crc) & 0x80) {
+                crc ^= 0x09;
+            }
+            d <<= 1;
+        }
+    }
+    return (crc << 1) | 1;
+}
+
+// CRC-16/XMODEM of a data block, checked by cards with CRC enabled
+static uint16_t crc16(const uint8_t *data, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc = (uint8_t)(crc >> 8) | (crc << 8);
+        crc ^= data[i];
+        crc ^= (uint8_t)(crc & 0xFF) >> 4;
+        crc ^= crc << 12;
+        crc ^= (crc & 0xFF) << 5;
+    }
+    return crc;
+}
+
+bool SDRawSink::begin(SPIClass *spi, uint8_t ssPin) {
+    this->spi = spi;
+    this->ssPin = ssPin;
+    blockAddressing = SD.cardType() == CARD_SDHC;
+    // partition table of the MBR
+    uint8_t sector[RAW_LOG_SECTOR_SIZE];
+    if (!SD.readRAW(sector, 0) || sector[510] != 0x55 || sector[511] != 0xAA) {
+        Serial.println("Failed to read the card MBR");
+        return false;
+    }
+    uint32_t sectors = 0;
+    for (uint8_t i = 0; i < 4 && !sectors; i++) {
+        const uint8_t *entry = sector + 446 + i * 16;
+        if (entry[4] == RAW_LOG_PARTITION_TYPE) {
+            memcpy(&partitionStart, entry + 8, 4);
+            memcpy(&sectors, entry + 12, 4);
+        }
+    }
+    if (sectors <= RAW_LOG_DATA_SECTOR) {
+        Serial.println("No raw log partition");
+        return false;
+    }
+    // the intact superblock copy with the higher sequence number
+    bool found = false;
+    for (uint8_t slot = 0; slot < 2; slot++) {
+        raw_superblock_t copy;
+        if (!SD.readRAW(sector, partitionStart + slot)) {
+            continue;
+        }
+        memcpy(&copy, sector, sizeof(copy));
+        if (copy.magic != RAW_LOG_MAGIC || copy.version != RAW_LOG_VERSION ||
+            copy.sessions > RAW_LOG_MAX_SESSIONS ||
+            copy.crc != CRC32::compute((const uint8_t *)&copy, offsetof(raw_superblock_t, crc))) {
+            continue;
+        }
+        if (!found || (int32_t)(copy.seq - super.seq) > 0) {
+            super = copy;
+            found = true;
+        }
+    }
+    if (!found) {
+        memset(&super, 0, sizeof(super));
+        super.magic = RAW_LOG_MAGIC;
+        super.version = RAW_LOG_VERSION;
+    }
+    super.sectors = sectors;
+    session = nullptr;
+    return true;
+}
+
+bool SDRawSink::open(uint32_t startTS) {
+    if (!spi) {
+        return false;
+    }
+    session = nullptr;
+    tailUsed = 0;
+    raw_session_t *last = super.sessions ? &super.session[super.sessions - 1] : nullptr;
+    if (last && last->startTS == startTS) {
+        // the partial last sector is read back and rewritten as it fills
+        tailUsed = last->bytes % RAW_LOG_SECTOR_SIZE;
+        if (tailUsed && !SD.readRAW(tail, partitionStart + last->firstSector +
+                                          last->bytes / RAW_LOG_SECTOR_SIZE)) {
+            return false;
+        }
+        session = last;
+        return true;
+    }
+    uint32_t first = RAW_LOG_DATA_SECTOR;
+    if (last) {
+        first = last->firstSector + (last->bytes + RAW_LOG_SECTOR_SIZE - 1) / RAW_LOG_SECTOR_SIZE;
+    }
+    if (super.sessions == RAW_LOG_MAX_SESSIONS || first >= super.sectors) {
+        Serial.println("Raw log partition full");
+        return false;
+    }
+    session = &super.session[super.sessions++];
+    memset(session, 0, sizeof(*session));
+    session->startTS = startTS;
+    session->firstSector = first;
+    return commit();
+}
+
+size_t SDRawSink::write(const uint8_t *data, size_t len) {
+    if (!session) {
+        return 0;
+    }
+    size_t written = 0;
+    while (written < len) {
+        uint32_t sector = session->firstSector + session->bytes / RAW_LOG_SECTOR_SIZE;
+        if (sector >= super.sectors) {
+            Serial.println("Raw log partition full");
+            break;
+        }
+        size_t left = len - written;
+        if (!tailUsed && left >= RAW_LOG_SECTOR_SIZE) {
+            // whole sectors go out straight from the caller's buffer
+            uint32_t count = left / RAW_LOG_SECTOR_SIZE;
+            if (count > super.sectors - sector) {
+                count = super.sectors - sector;
+            }
+            if (!writeBlocks(sector, data + written, count)) {
+                break;
+            }
+            written += count * RAW_LOG_SECTOR_SIZE;
+            session->bytes += count * RAW_LOG_SECTOR_SIZE;
+            continue;
+        }
+        size_t chunk = left < RAW_LOG_SECTOR_SIZE - tailUsed ? left : RAW_LOG_SECTOR_SIZE - tailUsed;
+        memcpy(tail + tailUsed, data + written, chunk);
+        if (tailUsed + chunk == RAW_LOG_SECTOR_SIZE && !writeBlocks(sector, tail, 1)) {
+            break;
+        }
+        tailUsed = (tailUsed + chunk) % RAW_LOG_SECTOR_SIZE;
+        written += chunk;
+        session->bytes += chunk;
+    }
+    return written;
+}
+
+bool SDRawSink::sync() {
+    if (!session) {
+        return false;
+    }
+    if (tailUsed) {
+        memset(tail + tailUsed, 0, RAW_LOG_SECTOR_SIZE - tailUsed);
+        if (!writeBlocks(session->firstSector + session->bytes / RAW_LOG_SECTOR_SIZE, tail, 1)) {
+            return false;
+        }
+    }
+    return commit();
+}
+
+size_t SDRawSink::size() {
+    return session ? session->bytes : 0;
+}
+
+bool SDRawSink::isOpen() {
+    return session != nullptr;
+}
+
+void SDRawSink::close() {
+    sync();
+    session = nullptr;
+}
+
+// writes the superblock to the older of its two slots
+bool SDRawSink::commit() {
+    super.seq++;
+    super.crc = CRC32::compute((const uint8_t *)&super, offsetof(raw_superblock_t, crc));
+    uint8_t sector[RAW_LOG_SECTOR_SIZE] = {};
+    memcpy(sector, &super, sizeof(super));
+    return SD.writeRAW(sector, partitionStart + (super.seq & 1));
+}
+
+bool SDRawSink::writeBlocks(uint32_t sector, const uint8_t *data, uint32_t count) {
+    uint32_t address = partitionStart + sector;
+    if (!blockAddressing) {
+        address *= RAW_LOG_SECTOR_SIZE;
+    }
+    spi->beginTransaction(SPISettings(SPI_HZ, MSBFIRST, SPI_MODE0));
+    digitalWrite(ssPin, LOW);
+    bool started = waitReady(BUSY_TIMEOUT_MS) && command(CMD_WRITE_MULTIPLE_BLOCK, address) == 0;
+    bool ok = started;
+    for (uint32_t i = 0; ok && i < count; i++) {
+        const uint8_t *block = data + i * RAW_LOG_SECTOR_SIZE;
+        uint16_t crc = crc16(block, RAW_LOG_SECTOR_SIZE);
+        spi->transfer(TOKEN_MULTI_WRITE);
+        spi->writeBytes(block, RAW_LOG_SECTOR_SIZE);
+        spi->transfer(crc >> 8);
+        spi->transfer(crc & 0xFF);
+        ok = (spi->transfer(0xFF) & 0x1F) == DATA_ACCEPTED && waitReady(BUSY_TIMEOUT_MS);
+    }
+    if (started) {
+        // the card programs the last blocks after the stop token
+        spi->transfer(TOKEN_STOP_TRAN);
+        spi->transfer(0xFF);
+        ok = waitReady(BUSY_TIMEOUT_MS) && ok;
+    }
+    digitalWrite(ssPin, HIGH);
+    spi->transfer(0xFF);
+    spi->endTransaction();
+    if (!ok) {
+        Serial.println("Raw sector write failed");
+    }
+    return ok;
+}
+
+// sends a command frame and returns the R1 response
+uint8_t SDRawSink::command(uint8_t cmd, uint32_t arg) {
+    uint8_t frame[6] = {
+        (uint8_t)(0x40 | cmd), (uint8_t)(arg >> 24), (uint8_t)(arg >> 16),
+        (uint8_t)(arg >> 8), (uint8_t)arg, 0
+    };
+    frame[5] = crc7(frame, 5);
+    spi->writeBytes(frame, sizeof(frame));
+    uint8_t r1 = 0xFF;
+    for (uint8_t i = 0; i < 8 && (r1 & 0x80); i++) {
+        r1 = spi->transfer(0xFF);
+    }
+    return r1;
+}
+
+bool SDRawSink::waitReady(uint32_t timeoutMs) {
+    uint32_t start = millis();
+    while (spi->transfer(0xFF) != 0xFF) {
+        if (millis() - start > timeoutMs) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int32_t SDFileStore::size(const char *path) {
+    File file = SD.open(path, FILE_READ);
+    if (!file) {
+        return -1;
+    }
+    int32_t size = file.size();
+    file.close();
+    // past the committed length of a file being written are its
+    // preallocated clusters, whose content is undefined
+    uint32_t committed;
+    if (SDPreallocatedSink::committedLength(path, committed) && committed < (uint32_t)size) {
+        size = committed;
+    }
+    return size;
+}
+
+size_t SDFileStore::read(const char *path, uint32_t offset, uint8_t *buffer, size_t len) {
+    File file = SD.open(path, FILE_READ);
+    if (!file) {
+        return 0;
+    }
+    size_t read = file.seek(offset) ? file.read(buffer, len) : 0;
+    file.close();
+    return read;
+}
+
+size_t UARTByteSource::read(uint8_t *buffer, size_t len) {
+    int read = uart_read_bytes(port, buffer, len, 0);
+    return read > 0 ? read : 0;
+}
+
+uint16_t MPUFifoSource::count() {
+    return mpu.getFIFOCount();
+}
+
+// getFIFOBytes() takes at most 255 bytes per call
+bool MPUFifoSource::read(uint8_t *buffer, uint16_t len) {
+    while (len) {
+        uint8_t chunk = len > 255 ? 255 : len;
+        mpu.getFIFOBytes(buffer, chunk);
+        buffer += chunk;
+        len -= chunk;
+    }
+    return true;
+}
+
+// reading INT_STATUS clears it, the motion bits are kept for takeStatus()
+bool MPUFifoSource::overflowed() {
+    uint8_t status = mpu.getIntStatus();
+    pendingStatus |= status;
+    return status & (1 << MPU6050_INTERRUPT_FIFO_OFLOW_BIT);
+}
+
+uint8_t MPUFifoSource::takeStatus() {
+    uint8_t status = pendingStatus;
+    pendingStatus = 0;
+    return status;
+}
+
+void MPUFifoSource::reset() {
+    mpu.resetFIFO();
+}
@@ -0,0 +1,369 @@
+#include "BenchSuite.h"
+#include <stdio.h>
+#include <string.h>
+#include "GPSParser.h"
+#include "LogStream.h"
+#include "LoRaPayload.h"
+#include "MPUBatch.h"
+#include "MPUCompressor.h"
+#include "MotionFeatures.h"
+#include "QuatCodec.h"
+#include "UBX.h"
+
+static const char NMEA_PAIR[] =
+    "$GPGGA,120000.00,0803.00000,S,03454.00000,W,1,08,1.01,10.0,M,-5.0,M,,*45\r\n"
+    "$GPRMC,120000.00,A,0803.00000,S,03454.00000,W,0.010,,171026,,,A*60\r\n";
+
+// EU868 DR0-DR2 payload limit
+static const uint8_t LORA_FRAME_SIZE = 51;
+static const uint8_t MPU_BURST_PACKETS = 6;
+static const uint16_t STORAGE_CALLS = 256;
+// smallest-three width of the packed record benchmark
+static const uint8_t MPU_PACK_BITS = 12;
+
+// serves the NMEA pair like the UART driver, a few bytes per read
+class NMEASource : public ByteSource {
+    public:
+        size_t read(uint8_t *buffer, size_t len) override {
+            size_t left = sizeof(NMEA_PAIR) - 1 - pos;
+            len = len < left ? len : left;
+            memcpy(buffer, NMEA_PAIR + pos, len);
+            pos += len;
+            return len;
+        }
+        void rewind() { pos = 0; }
+    private:
+        size_t pos = 0;
+};
+
+struct gps_bench_t {
+    GPSParser parser;
+    NMEASource source;
+    gps_fix_t fix;
+    uint8_t frame[sizeof(ubx_nav_pvt_t) + UBX_FRAME_OVERHEAD];
+    size_t frameSize;
+    char line[GPSParser::FIX_LINE_SIZE];
+};
+
+// accepts and discards every write, so the record benchmarks time the
+// LogStream path without the card
+class NullSink : public BlockSink {
+    public:
+        size_t write(const uint8_t *data, size_t len) override { bytes += len; return len; }
+        bool sync() override { return true; }
+        size_t size() override { return bytes; }
+        bool isOpen() override { return true; }
+        void close() override {}
+    private:
+        size_t bytes = 0;
+};
+
+struct mpu_bench_t {
+    MPUBatch batch;
+    uint8_t packets[MPU_BURST_PACKETS * MPUBatch::MAX_PACKET_SIZE];
+    mpu_record_t records[10];
+    NullSink sink;
+    LogStream log;
+    uint8_t packed[sizeof(mpu_record_t)];
+};
+
+struct compress_bench_t {
+    MPUCompressor compressor;
+    mpu_record_t records[MPUCompressor::BLOCK_RECORDS];
+};
+
+struct features_bench_t {
+    MotionFeatures features;
+    mpu_batch_t batch;
+};
+
+struct storage_bench_t {
+    BenchStorage *storage;
+    BlockSink *sink;
+    LogStream log;
+    size_t writeSize;
+    uint8_t data[4096];
+};
+
+struct lora_bench_t {
+    LoRaPayloadEncoder encoder{false, false};
+    uint8_t frame[LORA_FRAME_SIZE];
+    lora_fix_t fix;
+};
+
+static size_t feedBytes(GPSParser &parser, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        parser.feed(data[i]);
+    }
+    return len;
+}
+
+static size_t nmeaIngest(void *ctx, uint32_t call) {
+    gps_bench_t *b = (gps_bench_t *)ctx;
+    return feedBytes(b->parser, (const uint8_t *)NMEA_PAIR, sizeof(NMEA_PAIR) - 1);
+}
+
+// the loop of GPSUtil::readBytes() without the UART and the fix queue
+static size_t nmeaRead(void *ctx, uint32_t call) {
+    gps_bench_t *b = (gps_bench_t *)ctx;
+    uint8_t buffer[64];
+    size_t total = 0;
+    b->source.rewind();
+    while (size_t read = b->source.read(buffer, sizeof(buffer))) {
+        for (size_t i = 0; i < read; i++) {
+            if (b->parser.feed(buffer[i])) {
+                b->fix = b->parser.fix();
+            }
+        }
+        total += read;
+    }
+    return total;
+}
+
+static size_t ubxIngest(void *ctx, uint32_t call) {
+    gps_bench_t *b = (gps_bench_t *)ctx;
+    return feedBytes(b->parser, b->frame, b->frameSize);
+}
+
+static size_t mpuDecode(void *ctx, uint32_t call) {
+    mpu_bench_t *b = (mpu_bench_t *)ctx;
+    b->batch.decode(b->packets, MPU_BURST_PACKETS, call * MPU_BURST_PACKETS * MPUBatch::SAMPLE_PERIOD_MS);
+    mpu_record_t record;
+    while (b->batch.samples().pop(record)) {
+    }
+    return sizeof(b->packets);
+}
+
+// version 1 records as MPUUtil::writeRecord() hands them to the log
+static size_t mpuLogRecords(void *ctx, uint32_t call) {
+    mpu_bench_t *b = (mpu_bench_t *)ctx;
+    size_t bytes = 0;
+    for (const mpu_record_t &r : b->records) {
+        bytes += b->log.write((const uint8_t *)&r, sizeof(r));
+    }
+    return bytes;
+}
+
+// MPU_LOG_VERSION_PACKED records, packed and logged
+static size_t mpuLogPacked(void *ctx, uint32_t call) {
+    mpu_bench_t *b = (mpu_bench_t *)ctx;
+    size_t bytes = 0;
+    for (const mpu_record_t &r : b->records) {
+        size_t len = QuatCodec::packRecord(r, MPU_PACK_BITS, b->packed);
+        bytes += b->log.write(b->packed, len);
+    }
+    return bytes;
+}
+
+static size_t mpuCompress(void *ctx, uint32_t call) {
+    compress_bench_t *b = (compress_bench_t *)ctx;
+    for (const mpu_record_t &r : b->records) {
+        b->compressor.add(r);
+    }
+    return sizeof(b->records);
+}
+
+static size_t mpuFeatures(void *ctx, uint32_t call) {
+    features_bench_t *b = (features_bench_t *)ctx;
+    b->features.process(b->batch, 0);
+    motion_features_t window;
+    b->features.windows().pop(window);
+    return sizeof(b->batch.a);
+}
+
+static gps_fix_t benchFix(uint32_t call) {
+    gps_fix_t fix = {};
+    fix.ts = 1792238400 + call;
+    fix.lat = -8050000 - (int32_t)call;
+    fix.lng = -34900000 + (int32_t)call;
+    return fix;
+}
+
+static size_t gpsFormat(void *ctx, uint32_t call) {
+    gps_bench_t *b = (gps_bench_t *)ctx;
+    return GPSParser::formatFix(benchFix(call), b->line, sizeof(b->line));
+}
+
+static size_t gpsFormatPrintf(void *ctx, uint32_t call) {
+    gps_bench_t *b = (gps_bench_t *)ctx;
+    gps_fix_t fix = benchFix(call);
+    int len = snprintf(b->line, sizeof(b->line), "%lu;%.6f;%.6f\n", (unsigned long)fix.ts,
+                       fix.lat / 1e6, fix.lng / 1e6);
+    return len > 0 ? len : 0;
+}
+
+static size_t logAppend(void *ctx, uint32_t call) {
+    storage_bench_t *b = (storage_bench_t *)ctx;
+    return b->log.write(b->data, b->writeSize);
+}
+
+static size_t sinkAppend(void *ctx, uint32_t call) {
+    storage_bench_t *b = (storage_bench_t *)ctx;
+    return b->sink->write(b->data, b->writeSize);
+}
+
+static size_t fileAppendOpen(void *ctx, uint32_t call) {
+    storage_bench_t *b = (storage_bench_t *)ctx;
+    BlockSink *sink = b->storage->open();
+    if (!sink) {
+        return 0;
+    }
+    size_t written = sink->write(b->data, b->writeSize);
+    sink->close();
+    return written;
+}
+
+static size_t loraEncode(void *ctx, uint32_t call) {
+    lora_bench_t *b = (lora_bench_t *)ctx;
+    b->encoder.begin(b->frame, sizeof(b->frame), LORA_PAYLOAD_GPS);
+    while (b->encoder.addFix(b->fix)) {
+        b->fix.ts += 5;
+        b->fix.lat += 37;
+        b->fix.lng -= 12;
+    }
+    return b->encoder.length();
+}
+
+// the fixtures live in static storage, not on the heap; they are only
+// linked into builds that run the benchmarks
+static void runGPS(Benchmark &bench) {
+    static gps_bench_t gpsBench;
+    gps_bench_t *b = &gpsBench;
+    b->parser.setUBX(false);
+    bench.run("nmea_ingest", nmeaIngest, b, Benchmark::MAX_CALLS);
+    bench.run("nmea_read", nmeaRead, b, Benchmark::MAX_CALLS);
+    ubx_nav_pvt_t pvt = {};
+    pvt.year = 2026;
+    pvt.month = 10;
+    pvt.day = 17;
+    pvt.hour = 12;
+    pvt.valid = 0x07;
+    pvt.fixType = 3;
+    pvt.flags = 0x01;
+    pvt.numSV = 9;
+    pvt.lat = -80500000;
+    pvt.lon = -349000000;
+    pvt.hAcc = 2500;
+    b->frameSize = ubxBuildFrame(UBX_CLASS_NAV, UBX_NAV_PVT, (const uint8_t *)&pvt,
+                                 sizeof(pvt), b->frame);
+    b->parser.setUBX(true);
+    bench.run("ubx_ingest", ubxIngest, b, Benchmark::MAX_CALLS);
+    bench.run("gps_format", gpsFormat, b, Benchmark::MAX_CALLS);
+    bench.run("gps_format_printf", gpsFormatPrintf, b, Benchmark::MAX_CALLS);
+}
+
+static void runMPU(Benchmark &bench) {
+    static mpu_bench_t mpuBench;
+    mpu_bench_t *b = &mpuBench;
+    for (size_t i = 0; i < sizeof(b->packets); i++) {
+        b->packets[i] = (uint8_t)(i * 37 + 11);
+    }
+    for (uint8_t i = 0; i < 10; i++) {
+        mpu_record_t &r = b->records[i];
+        r.tMs = 123456 + i * MPUBatch::SAMPLE_PERIOD_MS;
+        r.q[0] = 16000 - i;
+        r.q[1] = -1200 + i;
+        r.q[2] = 850;
+        r.q[3] = -310;
+        for (uint8_t c = 0; c < 3; c++) {
+            r.g[c] = -40 + 13 * c + i;
+            r.a[c] = 2048 * c - 1000 + i;
+        }
+    }
+    bench.run("mpu_decode", mpuDecode, b, Benchmark::MAX_CALLS);
+    static compress_bench_t compressBench;
+    compress_bench_t *c = &compressBench;
+    // slow rotation and small sensor noise around a fixed attitude
+    for (uint8_t i = 0; i < MPUCompressor::BLOCK_RECORDS; i++) {
+        mpu_record_t &r = c->records[i];
+        r = b->records[i % 10];
+        r.tMs = i * MPUBatch::SAMPLE_PERIOD_MS;
+        r.q[0] -= i / 4;
+        r.q[2] += i;
+        r.g[1] += (i * 7) % 9 - 4;
+        r.a[2] += (i * 13) % 31 - 15;
+    }
+    bench.run("mpu_compress", mpuCompress, c, Benchmark::MAX_CALLS);
+    static features_bench_t featuresBench;
+    features_bench_t *f = &featuresBench;
+    // walking: 2 Hz bounce on the vertical axis
+    for (uint8_t i = 0; i < NUM_SAMPLES; i++) {
+        f->batch.ms[i] = i * MPUBatch::SAMPLE_PERIOD_MS;
+        f->batch.q[0][i] = 16384 - i;
+        f->batch.q[1][i] = i * 3;
+        f->batch.q[2][i] = 0;
+        f->batch.q[3][i] = 0;
+        f->batch.a[0][i] = 300 - i;
+        f->batch.a[1][i] = 150;
+        f->batch.a[2][i] = 8192 + (i % 50 < 25 ? 2000 : -2000);
+    }
+    f->batch.count = NUM_SAMPLES;
+    bench.run("mpu_features", mpuFeatures, f, Benchmark::MAX_CALLS);
+    b->log.open(&b->sink);
+    bench.run("mpu_log_records", mpuLogRecords, b, Benchmark::MAX_CALLS);
+    bench.run("mpu_log_packed", mpuLogPacked, b, Benchmark::MAX_CALLS);
+    b->log.close();
+}
+
+static void runStorage(Benchmark &bench, BenchStorage *storage) {
+    static const size_t sizes[] = { sizeof(mpu_record_t), LogStream::SECTOR_SIZE, 4096 };
+    char name[24];
+    static storage_bench_t storageBench;
+    storage_bench_t *b = &storageBench;
+    b->storage = storage;
+    for (size_t i = 0; i < sizeof(b->data); i++) {
+        b->data[i] = (uint8_t)i;
+    }
+    storage->remove();
+    for (size_t size : sizes) {
+        b->writeSize = size;
+        b->sink = storage->open();
+        if (!b->sink || !b->log.open(b->sink)) {
+            break;
+        }
+        snprintf(name, sizeof(name), "log_append_%u", (unsigned)size);
+        bench.run(name, logAppend, b, STORAGE_CALLS);
+        b->log.close();
+        b->sink = storage->open();
+        if (!b->sink) {
+            break;
+        }
+        snprintf(name, sizeof(name), "sink_append_%u", (unsigned)size);
+        bench.run(name, sinkAppend, b, STORAGE_CALLS);
+        b->sink->close();
+        storage->remove();
+    }
+    b->writeSize = sizeof(mpu_record_t);
+    bench.run("file_append_open", fileAppendOpen, b, STORAGE_CALLS);
+    storage->remove();
+    // whole sectors only, a partial one would be rewritten on every call
+    static const size_t rawSizes[] = { LogStream::SECTOR_SIZE, 4096 };
+    b->sink = storage->openRaw();
+    for (size_t size : rawSizes) {
+        if (!b->sink) {
+            break;
+        }
+        b->writeSize = size;
+        snprintf(name, sizeof(name), "raw_write_%u", (unsigned)size);
+        bench.run(name, sinkAppend, b, STORAGE_CALLS);
+    }
+    if (b->sink) {
+        b->sink->close();
+    }
+}
+
+static void runLoRa(Benchmark &bench) {
+    static lora_bench_t loraBench;
+    lora_bench_t *b = &loraBench;
+    b->fix = { 1792238400, -8050000, -34900000 };
+    bench.run("lora_encode", loraEncode, b, Benchmark::MAX_CALLS);
+}
+
+void runBenchmarks(Benchmark &bench, BenchStorage *storage) {
+    runGPS(bench);
+    runMPU(bench);
+    if (storage) {
+        runStorage(bench, storage);
+    }
+    runLoRa(bench);
+}
@@ -0,0 +1,61 @@
+#include "Benchmark.h"
+#include <stdio.h>
+#include <algorithm>
+
+Benchmark::Benchmark(bench_writer_t writer, void *arg) : writer(writer), writerArg(arg), result() {
+}
+
+void Benchmark::header(const char *target) {
+    char line[96];
+    snprintf(line, sizeof(line), "{\"target\":\"%s\",\"build\":\"%s %s\"}\n",
+             target, __DATE__, __TIME__);
+    writer(line, writerArg);
+}
+
+const bench_result_t& Benchmark::run(const char *name, bench_fn_t fn, void *ctx, uint32_t calls) {
+    if (calls > MAX_CALLS) {
+        calls = MAX_CALLS;
+    }
+    result = bench_result_t();
+    result.name = name;
+    result.calls = calls;
+    for (uint32_t i = 0; i < calls; i++) {
+        uint32_t start = halMicros();
+        result.bytes += fn(ctx, i);
+        latency[i] = halMicros() - start;
+        result.totalUs += latency[i];
+    }
+    std::sort(latency, latency + calls);
+    result.p50Us = percentile(calls, 50);
+    result.p90Us = percentile(calls, 90);
+    result.p99Us = percentile(calls, 99);
+    result.maxUs = calls ? latency[calls - 1] : 0;
+    char line[256];
+    format(result, line, sizeof(line));
+    writer(line, writerArg);
+    return result;
+}
+
+// nearest-rank percentile of the sorted latencies
+uint32_t Benchmark::percentile(uint32_t calls, uint8_t pct) {
+    if (calls == 0) {
+        return 0;
+    }
+    uint32_t rank = (calls * pct + 99) / 100;
+    return latency[rank ? rank - 1 : 0];
+}
+
+size_t Benchmark::format(const bench_result_t &result, char *line, size_t size) {
+    uint32_t us = result.totalUs ? result.totalUs : 1;
+    int len = snprintf(line, size,
+                       "{\"bench\":\"%s\",\"calls\":%u,\"bytes\":%u,\"total_us\":%u,"
+                       "\"calls_per_s\":%u,\"bytes_per_s\":%u,"
+                       "\"p50_us\":%u,\"p90_us\":%u,\"p99_us\":%u,\"max_us\":%u}\n",
+                       result.name, (unsigned)result.calls, (unsigned)result.bytes,
+                       (unsigned)result.totalUs,
+                       (unsigned)((uint64_t)result.calls * 1000000 / us),
+                       (unsigned)((uint64_t)result.bytes * 1000000 / us),
+                       (unsigned)result.p50Us, (unsigned)result.p90Us,
+                       (unsigned)result.p99Us, (unsigned)result.maxUs);
+    return len > 0 ? (size_t)len : 0;
+}
@@ -0,0 +1,43 @@
+#include "GPSAid.h"
+#include <string.h>
+#include "CRC32.h"
+
+static uint32_t aidCRC(const gps_aid_t &aid) {
+    return CRC32::compute((const uint8_t *)&aid, offsetof(gps_aid_t, crc));
+}
+
+static void putU32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (v >> (8 * i)) & 0xFF;
+    }
+}
+
+void GPSAid::fromFix(const gps_fix_t &fix, gps_aid_t &aid) {
+    aid = {};
+    aid.magic = MAGIC;
+    aid.ts = fix.ts;
+    aid.lat = fix.lat;
+    aid.lng = fix.lng;
+    aid.hAcc = fix.hAcc;
+    aid.crc = aidCRC(aid);
+}
+
+bool GPSAid::valid(const gps_aid_t &aid) {
+    return aid.magic == MAGIC && aid.crc == aidCRC(aid);
+}
+
+uint32_t GPSAid::accuracyCm(const gps_aid_t &aid) {
+    uint32_t fixCm = aid.hAcc == GPS_ACCURACY_UNKNOWN ? UNKNOWN_ACCURACY_CM : aid.hAcc * 10u;
+    return BASE_ACCURACY_CM + fixCm;
+}
+
+size_t GPSAid::frame(const gps_aid_t &aid, uint8_t *out) {
+    // MGA-INI-POS_LLH
+    uint8_t pos[20] = {};
+    pos[0] = 0x01;
+    putU32(pos + 4, (uint32_t)(aid.lat * 10));
+    putU32(pos + 8, (uint32_t)(aid.lng * 10));
+    // altitude 0, covered by the accuracy
+    putU32(pos + 16, accuracyCm(aid));
+    return ubxBuildFrame(UBX_CLASS_MGA, UBX_MGA_INI, pos, sizeof(pos), out);
+}
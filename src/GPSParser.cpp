@@ -0,0 +1,143 @@
+#include "GPSParser.h"
+#include <math.h>
+#include "TextWriter.h"
+
+GPSParser::GPSParser(bool ubx) : ubxMode(ubx), lastFix(), lastTime() {
+    ggaQuality[0].begin(nmea, "GPGGA", 6);
+    ggaQuality[1].begin(nmea, "GNGGA", 6);
+    gsaMode[0].begin(nmea, "GPGSA", 2);
+    gsaMode[1].begin(nmea, "GNGSA", 2);
+}
+
+void GPSParser::setUBX(bool ubx) {
+    ubxMode = ubx;
+}
+
+bool GPSParser::feed(uint8_t c) {
+    bool fixed = ubxMode ? feedUBX(c) : feedNMEA(c);
+    if (fixed) {
+        fixCount++;
+    }
+    return fixed;
+}
+
+size_t GPSParser::feed(ByteSource &source, size_t len) {
+    uint8_t buffer[64];
+    size_t fixed = 0;
+    while (len) {
+        size_t read = source.read(buffer, len < sizeof(buffer) ? len : sizeof(buffer));
+        if (read == 0) {
+            break;
+        }
+        for (size_t i = 0; i < read; i++) {
+            fixed += feed(buffer[i]);
+        }
+        len -= read;
+    }
+    return fixed;
+}
+
+bool GPSParser::feedNMEA(uint8_t c) {
+    if (!nmea.encode(c)) {
+        return false;
+    }
+    if (nmea.time.isUpdated() && nmea.time.isValid() && nmea.date.isValid()) {
+        lastTime.year = nmea.date.year();
+        lastTime.month = nmea.date.month();
+        lastTime.day = nmea.date.day();
+        lastTime.hour = nmea.time.hour();
+        lastTime.minute = nmea.time.minute();
+        lastTime.second = nmea.time.second();
+        lastTime.usec = nmea.time.centisecond() * 10000UL;
+        timeValid = true;
+    }
+    if (!nmea.location.isUpdated() || !nmea.location.isValid()) {
+        return false;
+    }
+    uint8_t fixType = nmeaFixType();
+    // like NAV-PVT fixType 1, dead reckoning alone is not a fix
+    if (fixType == 1) {
+        return false;
+    }
+    lastFix.ts = timeValid ? toEpoch(lastTime) : 0;
+    lastFix.lat = (int32_t)lround(nmea.location.lat() * 1e6);
+    lastFix.lng = (int32_t)lround(nmea.location.lng() * 1e6);
+    lastFix.hAcc = GPS_ACCURACY_UNKNOWN;
+    lastFix.fixType = fixType;
+    lastFix.numSV = nmea.satellites.value();
+    return true;
+}
+
+// fix type of the latest epoch: GSA tells 2D from 3D, GGA quality 6 is
+// dead reckoning (1, as in NAV-PVT); without GSA the satellite count of GGA
+// decides, 0 if there is none either. RMC precedes GGA and GSA in an
+// epoch, so the values may be one epoch old.
+uint8_t GPSParser::nmeaFixType() {
+    for (TinyGPSCustom &quality : ggaQuality) {
+        if (quality.isValid() && quality.value()[0] == '6') {
+            return 1;
+        }
+    }
+    for (TinyGPSCustom &mode : gsaMode) {
+        const char *value = mode.isValid() ? mode.value() : "";
+        if (value[0] == '2' || value[0] == '3') {
+            return value[0] - '0';
+        }
+    }
+    if (!nmea.satellites.isValid()) {
+        return 0;
+    }
+    uint32_t satellites = nmea.satellites.value();
+    return satellites >= 4 ? 3 : satellites == 3 ? 2 : 0;
+}
+
+// NAV-PVT fields are read in place from the parser buffer
+bool GPSParser::feedUBX(uint8_t c) {
+    if (!ubx.feed(c)) {
+        return false;
+    }
+    const ubx_nav_pvt_t *pvt = ubx.as<ubx_nav_pvt_t>(UBX_CLASS_NAV, UBX_NAV_PVT);
+    if (!pvt) {
+        return false;
+    }
+    // valid date and time
+    if ((pvt->valid & 0x03) == 0x03) {
+        lastTime.year = pvt->year;
+        lastTime.month = pvt->month;
+        lastTime.day = pvt->day;
+        lastTime.hour = pvt->hour;
+        lastTime.minute = pvt->min;
+        lastTime.second = pvt->sec;
+        lastTime.usec = pvt->nano > 0 ? pvt->nano / 1000 : 0;
+        timeValid = true;
+    }
+    // gnssFixOK and at least a 2D fix
+    if (!(pvt->flags & 0x01) || pvt->fixType < 2 || pvt->fixType > 4) {
+        return false;
+    }
+    lastFix.ts = timeValid ? toEpoch(lastTime) : 0;
+    // 1e-7 to 1e-6 degrees, rounded
+    lastFix.lat = (pvt->lat + (pvt->lat >= 0 ? 5 : -5)) / 10;
+    lastFix.lng = (pvt->lon + (pvt->lon >= 0 ? 5 : -5)) / 10;
+    lastFix.hAcc = pvt->hAcc / 100 < GPS_ACCURACY_UNKNOWN ? pvt->hAcc / 100 : GPS_ACCURACY_UNKNOWN - 1;
+    lastFix.fixType = pvt->fixType;
+    lastFix.numSV = pvt->numSV;
+    return true;
+}
+
+// seconds since 1970-01-01 UTC, from the civil date
+time_t GPSParser::toEpoch(const gps_time_t &t) {
+    int32_t y = t.year - (t.month <= 2);
+    int32_t era = (y >= 0 ? y : y - 399) / 400;
+    int32_t yoe = y - era * 400;
+    int32_t doy = (153 * (t.month + (t.month > 2 ? -3 : 9)) + 2) / 5 + t.day - 1;
+    int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int64_t days = (int64_t)era * 146097 + doe - 719468;
+    return (time_t)(days * 86400 + t.hour * 3600 + t.minute * 60 + t.second);
+}
+
+size_t GPSParser::formatFix(const gps_fix_t &fix, char *str, size_t size) {
+    TextWriter out(str, size);
+    out.u32((uint32_t)fix.ts).put(';').fixed(fix.lat, 6).put(';').fixed(fix.lng, 6).put('\n');
+    return out.overflowed() ? 0 : out.length();
+}
@@ -1,75 +1,335 @@
 #include "GPSUtil.h"
+#include "MemoryBudget.h"
+#include <sys/time.h>
+#include "Trace.h"
 
-// global static pointer used to ensure a single instance of the class.
-GPSUtil *GPSUtil::pInstance = nullptr;
+// aid from the latest fix, survives resets and deep sleep but not a power
+// cycle; guarded by fixMux
+RTC_DATA_ATTR static gps_aid_t rtcAid;
+static_assert(sizeof(rtcAid) <= MEM_RTC_GPS_AID, "GPS aid exceeds its RTC budget");
 
 /*****************************************************************
-This function is called to create an instance of the class.
+This function is called to get the instance of the class.
 Calling the constructor publicly is not allowed. The constructor
-is private and is only called by this getInstance() function.
+is private and is only called by this getInstance() function,
+which builds the instance in static storage on first use.
 *****************************************************************/
 GPSUtil *GPSUtil::getInstance()
 {
-    if (!pInstance) // Only allow one instance of class to be generated.
-        pInstance = new GPSUtil();
-    return pInstance;
+    static GPSUtil instance;
+    return &instance;
 }
 
-GPSUtil::GPSUtil() : gps(), serial(HardwareSerial(1)){};
+GPSUtil::GPSUtil() : parser(), uart(GPS_UART)
+{
+    static_assert(sizeof(GPSUtil) <= MEM_GPS_UTIL, "GPSUtil exceeds its memory budget");
+    static_assert(sizeof(fixRing) <= MEM_GPS_RING, "GPS ring exceeds its memory budget");
+    static_assert(sizeof(taskStack) <= MEM_GPS_STACK, "GPS task stack exceeds its memory budget");
+}
 
-void GPSUtil::setup()
+// ubxRateHz selects the UBX NAV-PVT mode at that rate, 0 keeps NMEA
+void GPSUtil::setup(uint8_t ubxRateHz)
 {
+    if (taskHandle)
+        return;
     // init GPS serial interface
-    serial.begin(GPSUtil::baudRate, SERIAL_8N1, GPSUtil::GPS_RX_PIN, GPSUtil::GPS_TX_PIN);
+    uart_config_t config = {};
+    config.baud_rate = GPSUtil::baudRate;
+    config.data_bits = UART_DATA_8_BITS;
+    config.parity = UART_PARITY_DISABLE;
+    config.stop_bits = UART_STOP_BITS_1;
+    config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    uart_param_config(GPS_UART, &config);
+    uart_set_pin(GPS_UART, GPSUtil::GPS_TX_PIN, GPSUtil::GPS_RX_PIN,
+                 UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+    uart_driver_install(GPS_UART, RX_BUFFER_SIZE, 0, EVENT_QUEUE_SIZE, &uartQueue, 0);
+    if (ubxRateHz)
+    {
+        configureUBX(ubxRateHz);
+    }
+    else
+    {
+        // raise an event for every '\n' ending an NMEA sentence
+        uart_enable_pattern_det_baud_intr(GPS_UART, '\n', 1, 9, 0, 0);
+        uart_pattern_queue_reset(GPS_UART, EVENT_QUEUE_SIZE);
+    }
+    fixSemaphore = xSemaphoreCreateBinaryStatic(&fixSemaphoreBuffer);
+    startTTFF();
+    taskHandle = xTaskCreateStaticPinnedToCore(uartTask, "gps", TASK_STACK, this, TASK_PRIORITY,
+                                               taskStack, &taskBuffer, TASK_CORE);
+}
+
+void GPSUtil::uartTask(void *arg)
+{
+    GPSUtil *self = (GPSUtil *)arg;
+    uart_event_t event;
+    for (;;)
+    {
+        if (!xQueueReceive(self->uartQueue, &event, portMAX_DELAY))
+            continue;
+        switch (event.type)
+        {
+        case UART_DATA:
+            if (self->ubxRate)
+                self->readBytes(event.size);
+            break;
+        case UART_PATTERN_DET:
+        {
+            int pos = uart_pattern_pop_pos(GPS_UART);
+            if (pos < 0)
+            {
+                // the position queue overflowed, resynchronise on the next line
+                uart_flush_input(GPS_UART);
+                uart_pattern_queue_reset(GPS_UART, EVENT_QUEUE_SIZE);
+                break;
+            }
+            self->readBytes(pos + 1);
+            break;
+        }
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+            uart_flush_input(GPS_UART);
+            xQueueReset(self->uartQueue);
+            if (!self->ubxRate)
+                uart_pattern_queue_reset(GPS_UART, EVENT_QUEUE_SIZE);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// feeds a complete NMEA sentence or the received UBX bytes to the parser
+void GPSUtil::readBytes(size_t len)
+{
+    TRACE_SCOPE(TRACE_GPS_PARSE);
+    uint8_t buffer[64];
+    while (len)
+    {
+        size_t read = uart.read(buffer, len < sizeof(buffer) ? len : sizeof(buffer));
+        if (read == 0)
+            break;
+        for (size_t i = 0; i < read; i++)
+        {
+            if (!parser.feed(buffer[i]))
+                continue;
+            gps_fix_t fix = parser.fix();
+            // refresh system time
+            updateSystemTime();
+            if (!fix.ts)
+                fix.ts = time(nullptr);
+            publishFix(fix);
+        }
+        len -= read;
+    }
+}
+
+// puts the receiver in backup mode with UBX-RXM-PMREQ (u-blox 8 form, woken
+// by activity on its RX line), or wakes it up; works in NMEA mode too as the
+// receiver accepts UBX input either way
+void GPSUtil::setBackup(bool on)
+{
+    if (on == backup)
+        return;
+    if (on)
+    {
+        // infinite duration, backup flag, wake up on UART RX
+        uint8_t req[16] = {};
+        req[8] = 0x02;
+        req[12] = 0x08;
+        sendUBX(UBX_CLASS_RXM, UBX_RXM_PMREQ, req, sizeof(req));
+    }
+    else
+    {
+        // the receiver drops the bytes that wake it
+        static const uint8_t wake[8] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+        uart_write_bytes(GPS_UART, wake, sizeof(wake));
+        uart_wait_tx_done(GPS_UART, pdMS_TO_TICKS(100));
+        startTTFF();
+    }
+    backup = on;
+}
+
+bool GPSUtil::inBackup()
+{
+    return backup;
+}
+
+void GPSUtil::sendUBX(uint8_t msgClass, uint8_t msgId, const uint8_t *payload, uint16_t len)
+{
+    uint8_t frame[UBX_FRAME_OVERHEAD + 20];
+    size_t size = ubxBuildFrame(msgClass, msgId, payload, len, frame);
+    uart_write_bytes(GPS_UART, frame, size);
+    uart_wait_tx_done(GPS_UART, pdMS_TO_TICKS(100));
 }
 
-bool GPSUtil::getLocation(char *locationStr)
+// switches UART1 of the receiver to UBX-only output at ubxBaudRate, with
+// NAV-PVT as the single periodic message; the port setting is sent at both
+// baud rates as the receiver may still be configured from a previous boot
+void GPSUtil::configureUBX(uint8_t rateHz)
+{
+    if (rateHz > 10)
+        rateHz = 10;
+    ubxRate = rateHz;
+    parser.setUBX(true);
+    uint8_t prt[20] = {};
+    prt[0] = 1; // UART1
+    // 8N1
+    prt[4] = 0xD0;
+    prt[5] = 0x08;
+    prt[8] = ubxBaudRate & 0xFF;
+    prt[9] = (ubxBaudRate >> 8) & 0xFF;
+    prt[10] = (ubxBaudRate >> 16) & 0xFF;
+    // UBX in, UBX out
+    prt[12] = 0x01;
+    prt[14] = 0x01;
+    sendUBX(UBX_CLASS_CFG, UBX_CFG_PRT, prt, sizeof(prt));
+    uart_set_baudrate(GPS_UART, ubxBaudRate);
+    delay(100);
+    sendUBX(UBX_CLASS_CFG, UBX_CFG_PRT, prt, sizeof(prt));
+    // measurement period in ms, one solution per measurement, GPS time
+    uint16_t measRate = 1000 / rateHz;
+    uint8_t rate[6] = { (uint8_t)(measRate & 0xFF), (uint8_t)(measRate >> 8), 1, 0, 1, 0 };
+    sendUBX(UBX_CLASS_CFG, UBX_CFG_RATE, rate, sizeof(rate));
+    // NAV-PVT on every solution
+    uint8_t msg[3] = { UBX_CLASS_NAV, UBX_NAV_PVT, 1 };
+    sendUBX(UBX_CLASS_CFG, UBX_CFG_MSG, msg, sizeof(msg));
+    uart_flush_input(GPS_UART);
+}
+
+// sends the aiding position of GPSAid, a receiver that still has a
+// better one ignores it
+void GPSUtil::sendAid(const gps_aid_t &aid)
+{
+    uint8_t frame[GPSAid::FRAME_SIZE];
+    size_t size = GPSAid::frame(aid, frame);
+    uart_write_bytes(GPS_UART, frame, size);
+    uart_wait_tx_done(GPS_UART, pdMS_TO_TICKS(100));
+    ESP_LOGI("gps", "Aided start, position accuracy %u m", GPSAid::accuracyCm(aid) / 100);
+}
+
+// the aid of the latest fix, of a previous boot if there was none yet
+bool GPSUtil::getAid(gps_aid_t &aid)
+{
+    portENTER_CRITICAL(&fixMux);
+    aid = rtcAid;
+    portEXIT_CRITICAL(&fixMux);
+    return GPSAid::valid(aid);
+}
+
+uint32_t GPSUtil::ttffMs()
+{
+    portENTER_CRITICAL(&fixMux);
+    uint32_t ttff = lastTTFFMs;
+    portEXIT_CRITICAL(&fixMux);
+    return ttff;
+}
+
+void GPSUtil::startTTFF()
+{
+    portENTER_CRITICAL(&fixMux);
+    ttffStartMs = millis();
+    ttffRunning = true;
+    portEXIT_CRITICAL(&fixMux);
+}
+
+void GPSUtil::publishFix(const gps_fix_t &fix)
+{
+    gps_aid_t aid;
+    GPSAid::fromFix(fix, aid);
+    bool first = false;
+    portENTER_CRITICAL(&fixMux);
+    lastFix = fix;
+    fixValid = true;
+    fixUnread = true;
+    rtcAid = aid;
+    if (ttffRunning)
+    {
+        lastTTFFMs = millis() - ttffStartMs;
+        ttffRunning = false;
+        first = true;
+    }
+    portEXIT_CRITICAL(&fixMux);
+    if (first)
+        ESP_LOGI("gps", "TTFF %u ms", lastTTFFMs);
+    xSemaphoreGive(fixSemaphore);
+    if (fixCallback)
+    {
+        fixCallback(fix, fixCallbackArg);
+    }
+}
+
+// callback invoked from the GPS task on every new fix
+void GPSUtil::setFixCallback(gps_fix_callback_t callback, void *arg)
+{
+    fixCallbackArg = arg;
+    fixCallback = callback;
+}
+
+// returns the latest fix if it was not returned before
+bool GPSUtil::getFix(gps_fix_t &fix)
 {
     bool successFlag = false;
-    readSerial(1);
-    if (gps.location.isUpdated() && gps.location.isValid())
+    portENTER_CRITICAL(&fixMux);
+    if (fixUnread)
     {
-        // refresh system time
-        updateSystemTime();
-        char lat_str[20];
-        char lng_str[20];
-        dtostrf(gps.location.lat(), 4, 6, lat_str);
-        dtostrf(gps.location.lng(), 4, 6, lng_str);
-        sprintf(locationStr, "%lu;%s;%s\n", now(), lat_str, lng_str);
+        fix = lastFix;
+        fixUnread = false;
         successFlag = true;
     }
+    portEXIT_CRITICAL(&fixMux);
     return successFlag;
 }
 
-bool GPSUtil::isFixed()
+// blocks until a new fix arrives or timeout_ms elapses
+bool GPSUtil::waitFix(gps_fix_t &fix, unsigned long timeout_ms)
+{
+    if (getFix(fix))
+    {
+        return true;
+    }
+    if (xSemaphoreTake(fixSemaphore, pdMS_TO_TICKS(timeout_ms)) != pdTRUE)
+    {
+        return false;
+    }
+    return getFix(fix);
+}
+
+bool GPSUtil::getLocation(char *locationStr, size_t size)
 {
-    bool fixedFlag = false;
-    readSerial(1);
-    if (gps.location.isValid() && gps.location.isUpdated() &&
-        gps.time.isValid() && gps.time.isUpdated() &&
-        gps.date.isValid() && gps.date.isUpdated())
+    gps_fix_t fix;
+    if (!getFix(fix))
     {
-        fixedFlag = true;
+        return false;
     }
+    return GPSParser::formatFix(fix, locationStr, size) != 0;
+}
+
+GPSRing& GPSUtil::fixes()
+{
+    return fixRing;
+}
+
+bool GPSUtil::isFixed()
+{
+    portENTER_CRITICAL(&fixMux);
+    bool fixedFlag = fixValid;
+    portEXIT_CRITICAL(&fixMux);
     return fixedFlag;
 }
 
+// called from the GPS task, the parser is not shared with other tasks
 void GPSUtil::updateSystemTime()
 {
-    // set the system time from GPS
-    setTime(gps.time.hour(), gps.time.minute(), gps.time.second(),
-            gps.date.day(), gps.date.month(), gps.date.year());
+    if (!parser.hasTime())
+        return;
+    setSystemTime(parser.time());
 }
 
-// TODO: consider removing the timeout as it doesnt make sense for the new approach
-void GPSUtil::readSerial(unsigned long timeout_ms)
+void GPSUtil::setSystemTime(const gps_time_t &time)
 {
-    unsigned long start = millis();
-    do
-    {
-        while (serial.available())
-        {
-            gps.encode(serial.read());
-        }
-    } while (millis() - start < timeout_ms);
-}
\ No newline at end of file
+    // set the system time from GPS; only the libc clock is used, it is safe
+    // to read from every task and keeps running through deep sleep
+    struct timeval tv = { GPSParser::toEpoch(time), (suseconds_t)time.usec };
+    settimeofday(&tv, nullptr);
+}
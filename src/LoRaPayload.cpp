@@ -0,0 +1,135 @@
+#include "LoRaPayload.h"
+
+static const int64_t LAT_RANGE = 180000000;
+static const int64_t LNG_RANGE = 360000000;
+static const int64_t PACKED_MAX = 0xFFFFFF;
+
+static size_t putVarint(uint8_t *out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = value;
+    return n;
+}
+
+static size_t getVarint(const uint8_t *in, size_t len, uint64_t &value) {
+    value = 0;
+    for (size_t n = 0; n < len && n < 10; n++) {
+        value |= (uint64_t)(in[n] & 0x7F) << (7 * n);
+        if (!(in[n] & 0x80)) {
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+static size_t putCoordinate(uint8_t *out, int32_t value, int64_t range, bool packed) {
+    if (!packed) {
+        uint32_t v = (uint32_t)value;
+        for (size_t i = 0; i < 4; i++) {
+            out[i] = v >> (8 * i);
+        }
+        return 4;
+    }
+    int64_t v = ((int64_t)value + range / 2) * PACKED_MAX;
+    v = (v + range / 2) / range;
+    v = v < 0 ? 0 : (v > PACKED_MAX ? PACKED_MAX : v);
+    for (size_t i = 0; i < 3; i++) {
+        out[i] = v >> (8 * i);
+    }
+    return 3;
+}
+
+static int32_t getCoordinate(const uint8_t *in, int64_t range, bool packed) {
+    if (!packed) {
+        return (int32_t)((uint32_t)in[0] | (uint32_t)in[1] << 8 |
+                         (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24);
+    }
+    int64_t v = (int64_t)in[0] | (int64_t)in[1] << 8 | (int64_t)in[2] << 16;
+    return (int32_t)((v * range + PACKED_MAX / 2) / PACKED_MAX - range / 2);
+}
+
+LoRaPayloadEncoder::LoRaPayloadEncoder(bool withHeader, bool packed)
+    : withHeader(withHeader), packed(packed) {
+}
+
+// starts a new frame in buffer
+void LoRaPayloadEncoder::begin(uint8_t *buffer, size_t size, uint8_t type) {
+    this->buffer = buffer;
+    this->size = size;
+    used = 0;
+    records = 0;
+    if (withHeader && size) {
+        buffer[used++] = (type & 0x7F) | (packed ? LORA_PAYLOAD_PACKED_FLAG : 0);
+    }
+}
+
+// appends a record, returns false and leaves the frame as it was when the
+// record does not fit
+bool LoRaPayloadEncoder::addFix(const lora_fix_t &fix) {
+    uint8_t record[5 + 4 + 4];
+    bool absolute = records == 0 || fix.ts < lastTS;
+    uint64_t ts = absolute ? fix.ts : fix.ts - lastTS;
+    size_t n = putVarint(record, ts << 1 | (absolute ? 1 : 0));
+    n += putCoordinate(record + n, fix.lat, LAT_RANGE, packed);
+    n += putCoordinate(record + n, fix.lng, LNG_RANGE, packed);
+    if (used + n > size) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        buffer[used + i] = record[i];
+    }
+    used += n;
+    records++;
+    lastTS = fix.ts;
+    return true;
+}
+
+LoRaPayloadDecoder::LoRaPayloadDecoder(bool withHeader, bool packed)
+    : withHeader(withHeader), packed(packed) {
+}
+
+// decodes the records of one frame; returns the number of fixes, or -1 when
+// the frame is malformed or does not start with an absolute timestamp
+int LoRaPayloadDecoder::decode(const uint8_t *frame, size_t len, lora_fix_t *fixes,
+                               size_t maxFixes, uint8_t *type) {
+    size_t pos = 0;
+    bool isPacked = packed;
+    if (withHeader) {
+        if (len == 0) {
+            return -1;
+        }
+        isPacked = frame[0] & LORA_PAYLOAD_PACKED_FLAG;
+        if (type) {
+            *type = frame[0] & 0x7F;
+        }
+        pos++;
+    }
+    size_t coordinateSize = isPacked ? 3 : 4;
+    size_t count = 0;
+    uint32_t lastTS = 0;
+    while (pos < len && count < maxFixes) {
+        uint64_t ts;
+        size_t n = getVarint(frame + pos, len - pos, ts);
+        if (n == 0 || pos + n + 2 * coordinateSize > len) {
+            return -1;
+        }
+        pos += n;
+        if (ts & 1) {
+            lastTS = ts >> 1;
+        } else if (count) {
+            lastTS += ts >> 1;
+        } else {
+            return -1;
+        }
+        fixes[count].ts = lastTS;
+        fixes[count].lat = getCoordinate(frame + pos, LAT_RANGE, isPacked);
+        pos += coordinateSize;
+        fixes[count].lng = getCoordinate(frame + pos, LNG_RANGE, isPacked);
+        pos += coordinateSize;
+        count++;
+    }
+    return count;
+}
@@ -32,23 +32,25 @@
  *******************************************************************************/
 
 #include "LoRaUtil.h"
+#include "MemoryBudget.h"
+#include <sys/time.h>
+#include "Trace.h"
 
-// global static pointer used to ensure a single instance of the class.
-LoRaUtil* LoRaUtil::pInstance = nullptr;
 
 /*****************************************************************
-This function is called to create an instance of the class.
+This function is called to get the instance of the class.
 Calling the constructor publicly is not allowed. The constructor
-is private and is only called by this getInstance() function.
+is private and is only called by this getInstance() function,
+which builds the instance in static storage on first use.
 *****************************************************************/
 LoRaUtil* LoRaUtil::getInstance() {
-    if (!pInstance)   // Only allow one instance of class to be generated.
-        pInstance = new LoRaUtil();
-    return pInstance;
+    static LoRaUtil instance;
+    return &instance;
 }
 
 LoRaUtil::LoRaUtil() {
-    
+    static_assert(sizeof(LoRaUtil) <= MEM_LORA_UTIL, "LoRaUtil exceeds its memory budget");
+    static_assert(sizeof(uplinks) <= MEM_UPLINK_QUEUE, "uplink queue exceeds its memory budget");
 }
 
 //
@@ -65,6 +67,65 @@ LoRaUtil::LoRaUtil() {
 # define FILLMEIN (#dont edit this, edit the lines that use FILLMEIN)
 #endif
 
+// This EUI must be in little-endian format, so least-significant-byte
+// first. When copying an EUI from ttnctl output, this means to reverse
+// the bytes. For TTN issued EUIs the last bytes should be 0xD5, 0xB3,
+// 0x70.
+static const u1_t PROGMEM APPEUI[8]={ FILLMEIN };
+void os_getArtEui (u1_t* buf) { memcpy_P(buf, APPEUI, 8);}
+
+// This should also be in little endian format, see above.
+static const u1_t PROGMEM DEVEUI[8]={ FILLMEIN };
+void os_getDevEui (u1_t* buf) { memcpy_P(buf, DEVEUI, 8);}
+
+// This key should be in big endian format (or, since it is not really a
+// number but a block of memory, endianness does not really apply). In
+// practice, a key taken from ttnctl can be copied as-is.
+static const u1_t PROGMEM APPKEY[16] = { FILLMEIN };
+void os_getDevKey (u1_t* buf) {  memcpy_P(buf, APPKEY, 16);}
+
+// LMIC session kept in RTC slow memory, so a wake from deep sleep resumes
+// the OTAA session instead of joining again
+struct lora_session_t {
+    bool valid;
+    u4_t netid;
+    devaddr_t devaddr;
+    u1_t nwkKey[16];
+    u1_t artKey[16];
+    u4_t seqnoUp;
+    u4_t seqnoDn;
+    dr_t datarate;
+    s1_t txpow;
+    u1_t adrEnabled;
+    u1_t rxDelay;
+    u1_t rx1DrOffset;
+    dr_t dn2Dr;
+    u4_t dn2Freq;
+#if CFG_LMIC_EU_like
+    u4_t channelFreq[MAX_CHANNELS];
+    u2_t channelDrMap[MAX_CHANNELS];
+    u2_t channelMap;
+    // duty-cycle wait left per band when saved, in ms
+    int32_t bandWaitMs[MAX_BANDS];
+#endif
+    int32_t globalWaitMs;
+    // wall clock at save time, in ms
+    int64_t savedAtMs;
+};
+
+RTC_DATA_ATTR static lora_session_t session;
+static_assert(sizeof(session) <= MEM_RTC_LORA_SESSION, "LoRaWAN session exceeds its RTC budget");
+
+static int64_t wallClockMs() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static int32_t waitMs(ostime_t avail, ostime_t now) {
+    return avail - now > 0 ? osticks2ms(avail - now) : 0;
+}
+
 // Pin mapping
 const lmic_pinmap lmic_pins = {
     .nss = 18   ,
@@ -73,16 +134,269 @@ const lmic_pinmap lmic_pins = {
     .dio = {26, 3, 4},
 };
 
-void LoRaUtil::send(char* data) {
+// LMIC event callback
+void onEvent(ev_t ev) {
+    LoRaUtil::getInstance()->onEvent(ev);
+}
+
+void LoRaUtil::onEvent(ev_t ev) {
+    ESP_LOGI(tag, "event %d", ev);
+    switch (ev) {
+    case EV_JOINED:
+        saveSession();
+        scheduleUplink();
+        break;
+    case EV_TXCOMPLETE:
+        if (motionInFlight) {
+            motionInFlight = false;
+        } else {
+            uplinks.complete();
+        }
+        // keeps the frame counters current in case of an unexpected reset
+        saveSession();
+        scheduleUplink();
+        break;
+    case EV_TXCANCELED:
+    case EV_JOIN_FAILED:
+    case EV_REJOIN_FAILED:
+        // the fixes stay queued for the next frame
+        uplinks.cancel();
+        if (motionInFlight) {
+            // unless a newer window took the slot, this one is sent again
+            motionInFlight = false;
+            motionQueued = true;
+        }
+        scheduleUplink();
+        break;
+    default:
+        break;
+    }
+}
+
+bool LoRaUtil::send(const uint8_t *data, size_t len, uint8_t port) {
+    TRACE_SCOPE(TRACE_LORA_SEND);
     // Check if there is not a current TX/RX job running
     if (LMIC.opmode & OP_TXRXPEND) {
         ESP_LOGE(tag, "OP_TXRXPEND, not sending");
-    } else {
-        // Prepare upstream data transmission at the next possible time.
-        LMIC_setTxData2(1, data, sizeof(data)-1, 0);
-        ESP_LOGI(tag, "Packet queued");
+        return false;
     }
+    // Prepare upstream data transmission at the next possible time.
+    if (LMIC_setTxData2(port, (xref2u1_t)data, len, 0) != LMIC_ERROR_SUCCESS) {
+        ESP_LOGE(tag, "Packet of %u bytes rejected", len);
+        return false;
+    }
+    ESP_LOGI(tag, "Packet queued");
     // Next TX is scheduled after TX_COMPLETE event.
+    return true;
+}
+
+// queues a fix for the next uplink, the oldest one not on air is dropped
+// when full
+void LoRaUtil::queueFix(const lora_fix_t &fix) {
+    if (!uplinks.push(fix)) {
+        ESP_LOGW(tag, "Uplink queue full, fix dropped");
+    }
+    scheduleUplink();
+}
+
+// replaces a window that was not sent yet
+void LoRaUtil::queueMotion(const motion_features_t &features) {
+    motion = features;
+    motionQueued = true;
+    scheduleUplink();
+}
+
+// true if something waits and no frame is on air
+bool LoRaUtil::pending() {
+    return !uplinks.inFlight() && !motionInFlight && (uplinks.count() || motionQueued);
+}
+
+uint32_t LoRaUtil::droppedFixes() {
+    return uplinks.dropped();
+}
+
+uint8_t LoRaUtil::queuedFixes() {
+    return uplinks.count();
+}
+
+// application payload limit of the current data rate, per the regional
+// parameters and capped by the LMIC frame buffer
+uint8_t LoRaUtil::maxPayload() {
+#if defined(CFG_us915) || defined(CFG_au915)
+    static const uint8_t limits[] = { 11, 53, 125, 242, 242 };
+#else
+    static const uint8_t limits[] = { 51, 51, 51, 115, 222, 222, 222, 222 };
+#endif
+    uint8_t dr = LMIC.datarate < sizeof(limits) ? LMIC.datarate : sizeof(limits) - 1;
+    uint8_t limit = limits[dr];
+    return limit < MAX_LEN_PAYLOAD ? limit : MAX_LEN_PAYLOAD;
+}
+
+// first time the duty-cycle budget allows a transmission
+ostime_t LoRaUtil::earliestTxTime() {
+    ostime_t now = os_getTime();
+    ostime_t avail = now;
+#if CFG_LMIC_EU_like
+    // LMIC picks the band that frees up first
+    ostime_t band = LMIC.bands[0].avail;
+    for (uint8_t i = 1; i < MAX_BANDS; i++) {
+        if (LMIC.bands[i].avail - band < 0) {
+            band = LMIC.bands[i].avail;
+        }
+    }
+    if (band - avail > 0) {
+        avail = band;
+    }
+#endif
+    if (LMIC.globalDutyAvail - avail > 0) {
+        avail = LMIC.globalDutyAvail;
+    }
+    return avail;
+}
+
+// arms the uplink job for the earliest moment a frame is worth sending
+void LoRaUtil::scheduleUplink() {
+    if (!pending()) {
+        return;
+    }
+    ostime_t at = earliestTxTime();
+    // a full or flushed frame goes out as soon as allowed, otherwise wait
+    // for more fixes
+    if (!flushRequested && !uplinks.frameFull(maxPayload())) {
+        ostime_t batched = lastTxTime + ms2osticks(MIN_UPLINK_INTERVAL_MS);
+        if (batched - at > 0) {
+            at = batched;
+        }
+    }
+    os_setTimedCallback(&uplinkJob, at, uplinkJobCallback);
+}
+
+void LoRaUtil::uplinkJobCallback(osjob_t *job) {
+    LoRaUtil::getInstance()->transmit();
+}
+
+// builds one frame from the head of the queue and hands it to LMIC
+void LoRaUtil::transmit() {
+    if (LMIC.opmode & OP_TXRXPEND) {
+        // rescheduled from the TX_COMPLETE event
+        return;
+    }
+    if (motionQueued && (fixesSent || uplinks.count() == 0)) {
+        // motion_features_t is sent as is, it is little-endian like LMIC
+        if (!send((const uint8_t *)&motion, sizeof(motion), PORT_MOTION)) {
+            return;
+        }
+        motionQueued = false;
+        motionInFlight = true;
+        flushRequested = false;
+        fixesSent = false;
+        lastTxTime = os_getTime();
+        ESP_LOGI(tag, "motion window in %u bytes", sizeof(motion));
+        return;
+    }
+    uint8_t count = uplinks.transmit(*this, maxPayload(), PORT_GPS);
+    if (count == 0) {
+        return;
+    }
+    flushRequested = false;
+    fixesSent = true;
+    lastTxTime = os_getTime();
+    ESP_LOGI(tag, "%u fixes in %u bytes", count, uplinks.frameLength());
+}
+
+// sends one frame of whatever is queued as soon as the join and the duty
+// cycle allow, without waiting for more fixes to share it
+void LoRaUtil::flush() {
+    if (!pending()) {
+        return;
+    }
+    flushRequested = true;
+    os_setTimedCallback(&uplinkJob, earliestTxTime(), uplinkJobCallback);
+}
+
+// true until the flushed frame, and the join before it, are done
+bool LoRaUtil::flushing() {
+    return flushRequested || !isIdle();
+}
+
+// removes the oldest queued fix, e.g. to keep the queue in RTC memory
+// over deep sleep; a frame on air counts as lost
+bool LoRaUtil::takeFix(lora_fix_t &fix) {
+    uplinks.cancel();
+    return uplinks.pop(fix);
+}
+
+// true when no frame or join is in progress
+bool LoRaUtil::isIdle() {
+    return !uplinks.inFlight() && !motionInFlight && !(LMIC.opmode & (OP_TXRXPEND | OP_JOINING));
+}
+
+// true if no frame is on air and no LMIC job is due within ms
+bool LoRaUtil::canSleep(uint32_t ms) {
+    return isIdle() && !os_queryTimeCriticalJobs(ms2osticks(ms));
+}
+
+// copies the joined session to RTC memory, also call it before deep sleep
+void LoRaUtil::saveSession() {
+    if (LMIC.devaddr == 0) {
+        return;
+    }
+    ostime_t now = os_getTime();
+    session.netid = LMIC.netid;
+    session.devaddr = LMIC.devaddr;
+    memcpy(session.nwkKey, LMIC.nwkKey, sizeof(session.nwkKey));
+    memcpy(session.artKey, LMIC.artKey, sizeof(session.artKey));
+    session.seqnoUp = LMIC.seqnoUp;
+    session.seqnoDn = LMIC.seqnoDn;
+    session.datarate = LMIC.datarate;
+    session.txpow = LMIC.txpow;
+    session.adrEnabled = LMIC.adrEnabled;
+    session.rxDelay = LMIC.rxDelay;
+    session.rx1DrOffset = LMIC.rx1DrOffset;
+    session.dn2Dr = LMIC.dn2Dr;
+    session.dn2Freq = LMIC.dn2Freq;
+#if CFG_LMIC_EU_like
+    memcpy(session.channelFreq, LMIC.channelFreq, sizeof(session.channelFreq));
+    memcpy(session.channelDrMap, LMIC.channelDrMap, sizeof(session.channelDrMap));
+    session.channelMap = LMIC.channelMap;
+    for (uint8_t i = 0; i < MAX_BANDS; i++) {
+        session.bandWaitMs[i] = waitMs(LMIC.bands[i].avail, now);
+    }
+#endif
+    session.globalWaitMs = waitMs(LMIC.globalDutyAvail, now);
+    session.savedAtMs = wallClockMs();
+    session.valid = true;
+}
+
+// loads the saved session into a freshly reset LMIC
+bool LoRaUtil::restoreSession() {
+    if (!session.valid) {
+        return false;
+    }
+    LMIC_setSession(session.netid, session.devaddr, session.nwkKey, session.artKey);
+    LMIC.seqnoUp = session.seqnoUp;
+    LMIC.seqnoDn = session.seqnoDn;
+    LMIC_setAdrMode(session.adrEnabled);
+    LMIC_setDrTxpow(session.datarate, session.txpow);
+    LMIC.rxDelay = session.rxDelay;
+    LMIC.rx1DrOffset = session.rx1DrOffset;
+    LMIC.dn2Dr = session.dn2Dr;
+    LMIC.dn2Freq = session.dn2Freq;
+    // the LMIC clock restarted, carry over what is left of the duty-cycle waits
+    int32_t slept = (int32_t)(wallClockMs() - session.savedAtMs);
+    ostime_t now = os_getTime();
+#if CFG_LMIC_EU_like
+    memcpy(LMIC.channelFreq, session.channelFreq, sizeof(session.channelFreq));
+    memcpy(LMIC.channelDrMap, session.channelDrMap, sizeof(session.channelDrMap));
+    LMIC.channelMap = session.channelMap;
+    for (uint8_t i = 0; i < MAX_BANDS; i++) {
+        int32_t left = session.bandWaitMs[i] - slept;
+        LMIC.bands[i].avail = now + ms2osticks(left > 0 ? left : 0);
+    }
+#endif
+    int32_t left = session.globalWaitMs - slept;
+    LMIC.globalDutyAvail = now + ms2osticks(left > 0 ? left : 0);
+    return true;
 }
 
 void LoRaUtil::setup() {
@@ -91,10 +405,17 @@ void LoRaUtil::setup() {
     os_init();
     // Reset the MAC state. Session and pending data transfers will be discarded.
     LMIC_reset();
-    // Start job (sending automatically starts OTAA too)
-    send("testando");
+    // only a power-on starts a new OTAA session
+    if (esp_reset_reason() != ESP_RST_POWERON && restoreSession()) {
+        ESP_LOGI(tag, "Session restored, seqnoUp %u", session.seqnoUp);
+        return;
+    }
+    session.valid = false;
+    // the queued frames go out once joined
+    LMIC_startJoining();
 }
 
 void LoRaUtil::loop() {
+    TRACE_SCOPE(TRACE_LORA_LOOP);
     os_runloop_once();
 }
\ No newline at end of file
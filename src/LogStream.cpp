@@ -0,0 +1,105 @@
+#include "LogStream.h"
+#include <string.h>
+#include "Trace.h"
+
+LogStream::LogStream() {
+
+}
+
+// starts logging at the end of an opened sink
+bool LogStream::open(BlockSink *sink) {
+    if (!sink || !sink->isOpen()) {
+        return false;
+    }
+    this->sink = sink;
+    fileSize = sink->size();
+    used = 0;
+    lastFlushMs = halMillis();
+    return true;
+}
+
+void LogStream::close() {
+    if (!isOpen()) {
+        return;
+    }
+    flush();
+    sink->close();
+    sink = nullptr;
+}
+
+bool LogStream::isOpen() {
+    return sink && sink->isOpen();
+}
+
+// bytes logged so far, buffered ones included
+size_t LogStream::size() {
+    return fileSize + used;
+}
+
+size_t LogStream::write(const uint8_t *data, size_t len) {
+    if (!isOpen()) {
+        return 0;
+    }
+    size_t written = 0;
+    while (written < len) {
+        size_t chunk = len - written < BUFFER_SIZE - used ? len - written : BUFFER_SIZE - used;
+        memcpy(buffer + used, data + written, chunk);
+        used += chunk;
+        written += chunk;
+        if (used == BUFFER_SIZE && !writeSectors()) {
+            break;
+        }
+    }
+    return written;
+}
+
+size_t LogStream::print(const char *message) {
+    return write((const uint8_t *)message, strlen(message));
+}
+
+// writes everything buffered, including a partial sector, and commits it
+// to the medium
+bool LogStream::flush() {
+    if (!isOpen()) {
+        return false;
+    }
+    lastFlushMs = halMillis();
+    if (used == 0) {
+        return true;
+    }
+    bool ok = writeBuffer(used);
+    return sink->sync() && ok;
+}
+
+void LogStream::loop() {
+    if (used && halMillis() - lastFlushMs >= FLUSH_PERIOD_MS) {
+        flush();
+    }
+}
+
+uint32_t LogStream::untilFlush() {
+    if (!used) {
+        return UINT32_MAX;
+    }
+    uint32_t elapsed = halMillis() - lastFlushMs;
+    return elapsed < FLUSH_PERIOD_MS ? FLUSH_PERIOD_MS - elapsed : 0;
+}
+
+// writes the longest buffered prefix that ends on a sector boundary of the
+// file, so the card only sees whole-sector writes after the first one
+bool LogStream::writeSectors() {
+    size_t tail = (fileSize + used) % SECTOR_SIZE;
+    if (used <= tail) {
+        return true;
+    }
+    return writeBuffer(used - tail);
+}
+
+bool LogStream::writeBuffer(size_t len) {
+    TRACE_SCOPE(TRACE_SD_WRITE);
+    size_t written = sink->write(buffer, len);
+    fileSize += written;
+    used -= written;
+    memmove(buffer, buffer + written, used);
+    return written == len;
+}
@@ -0,0 +1,107 @@
+#include "MPUBatch.h"
+#include "MotionFeatures.h"
+#include "TextWriter.h"
+
+MPUBatch::MPUBatch() {
+    batch.count = 0;
+}
+
+bool MPUBatch::drain(FifoSource &fifo, uint32_t lastMs) {
+    bool overflow = fifo.overflowed();
+    uint16_t fifoCount = fifo.count();
+    lastFifoCount = fifoCount;
+    // on overflow the packet boundaries are lost, start over
+    if (overflow || fifoCount >= FIFO_SIZE) {
+        fifo.reset();
+        overflowCount++;
+        return false;
+    }
+    uint16_t packets = fifoCount / packetSize;
+    if (packets == 0) {
+        return true;
+    }
+    // the newest packet belongs to the last interrupt
+    uint32_t packetMs = lastMs - (uint32_t)(packets - 1) * SAMPLE_PERIOD_MS;
+    while (packets) {
+        uint8_t burst = packets < MAX_BURST_PACKETS ? packets : MAX_BURST_PACKETS;
+        fifo.read(fifoBuffer, burst * packetSize);
+        decode(fifoBuffer, burst, packetMs);
+        packets -= burst;
+        packetMs += burst * SAMPLE_PERIOD_MS;
+    }
+    return true;
+}
+
+bool MPUBatch::readOne(FifoSource &fifo, uint32_t ms, mpu_record_t &record) {
+    if (fifo.count() < packetSize) {
+        return false;
+    }
+    fifo.read(fifoBuffer, packetSize);
+    uint8_t pending = batch.count;
+    batch.count = 0;
+    decode(fifoBuffer, 1, ms);
+    batchRecord(0, record);
+    batch.count = pending;
+    return true;
+}
+
+// MotionApps20 packet: quaternion as 4 int32 at 0, gyro as 3 int32 at 16
+// and accel as 3 int32 at 28, all big-endian; the upper halves are kept
+void MPUBatch::decode(const uint8_t *packets, uint8_t count, uint32_t firstMs) {
+    for (uint8_t p = 0; p < count; p++) {
+        const uint8_t *packet = packets + p * packetSize;
+        uint8_t i = batch.count;
+        batch.ms[i] = firstMs + p * SAMPLE_PERIOD_MS;
+        for (uint8_t c = 0; c < 4; c++) {
+            batch.q[c][i] = (packet[4 * c] << 8) | packet[4 * c + 1];
+        }
+        for (uint8_t c = 0; c < 3; c++) {
+            batch.g[c][i] = (packet[16 + 4 * c] << 8) | packet[17 + 4 * c];
+            batch.a[c][i] = (packet[28 + 4 * c] << 8) | packet[29 + 4 * c];
+        }
+        if (++batch.count == NUM_SAMPLES) {
+            pushSamples();
+        }
+    }
+}
+
+// hands the decoded batch over to the storage task
+void MPUBatch::pushSamples() {
+    mpu_record_t record;
+    if (features) {
+        features->process(batch, timeBase);
+    }
+    for (uint8_t i = 0; i < batch.count; i++) {
+        batchRecord(i, record);
+        // a full ring is accounted in its overflow counter
+        sampleRing.push(record);
+    }
+    batch.count = 0;
+}
+
+void MPUBatch::batchRecord(uint8_t i, mpu_record_t &record) {
+    record.tMs = batch.ms[i] - timeBase;
+    for (uint8_t c = 0; c < 4; c++) {
+        record.q[c] = batch.q[c][i];
+    }
+    for (uint8_t c = 0; c < 3; c++) {
+        record.g[c] = batch.g[c][i];
+        record.a[c] = batch.a[c][i];
+    }
+}
+
+size_t MPUBatch::formatRecord(const mpu_record_t &record, char *str, size_t size) {
+    TextWriter out(str, size);
+    out.fixed(record.tMs, 3);
+    for (uint8_t c = 0; c < 4; c++) {
+        out.put(';').q14(record.q[c], 6);
+    }
+    for (uint8_t c = 0; c < 3; c++) {
+        out.put(';').i32(record.g[c]);
+    }
+    for (uint8_t c = 0; c < 3; c++) {
+        out.put(';').i32(record.a[c]);
+    }
+    out.put('\n');
+    return out.overflowed() ? 0 : out.length();
+}
@@ -0,0 +1,195 @@
+#include "MPUCompressor.h"
+#include <string.h>
+#include "CRC32.h"
+
+// channel c of a record, tMs first
+static inline int32_t channel(const mpu_record_t &r, uint8_t c) {
+    if (c == 0) {
+        return (int32_t)r.tMs;
+    }
+    if (c < 5) {
+        return r.q[c - 1];
+    }
+    if (c < 8) {
+        return r.g[c - 5];
+    }
+    return r.a[c - 8];
+}
+
+static inline void setChannel(mpu_record_t &r, uint8_t c, int32_t value) {
+    if (c == 0) {
+        r.tMs = (uint32_t)value;
+    } else if (c < 5) {
+        r.q[c - 1] = (int16_t)value;
+    } else if (c < 8) {
+        r.g[c - 5] = (int16_t)value;
+    } else {
+        r.a[c - 8] = (int16_t)value;
+    }
+}
+
+// wrapping difference, tMs may cross 2^31
+static inline int32_t delta(int32_t value, int32_t previous) {
+    return (int32_t)((uint32_t)value - (uint32_t)previous);
+}
+
+static inline uint8_t bitWidth(uint32_t value) {
+    return value ? 32 - __builtin_clz(value) : 0;
+}
+
+static size_t putVarint(uint8_t *out, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+static size_t getVarint(const uint8_t *in, size_t len, uint32_t &value) {
+    value = 0;
+    for (size_t n = 0; n < len && n < 5; n++) {
+        value |= (uint32_t)(in[n] & 0x7F) << (7 * n);
+        if (!(in[n] & 0x80)) {
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+static void putLE(uint8_t *out, uint32_t value, uint8_t bytes) {
+    for (uint8_t i = 0; i < bytes; i++) {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint32_t getLE(const uint8_t *in, uint8_t bytes) {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < bytes; i++) {
+        value |= (uint32_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+bool MPUCompressor::add(const mpu_record_t &record) {
+    records[count++] = record;
+    if (count < BLOCK_RECORDS) {
+        return false;
+    }
+    finish();
+    return true;
+}
+
+size_t MPUCompressor::finish() {
+    outSize = 0;
+    if (count == 0) {
+        return 0;
+    }
+    uint8_t *payload = out + HEADER_SIZE;
+    size_t used = 0;
+    memcpy(payload, &records[0], sizeof(mpu_record_t));
+    used += sizeof(mpu_record_t);
+    int32_t base[CHANNELS];
+    uint8_t width[CHANNELS];
+    if (count > 1) {
+        for (uint8_t c = 0; c < CHANNELS; c++) {
+            int32_t lo = delta(channel(records[1], c), channel(records[0], c));
+            int32_t hi = lo;
+            for (uint8_t i = 2; i < count; i++) {
+                int32_t d = delta(channel(records[i], c), channel(records[i - 1], c));
+                lo = d < lo ? d : lo;
+                hi = d > hi ? d : hi;
+            }
+            base[c] = lo;
+            width[c] = bitWidth((uint32_t)hi - (uint32_t)lo);
+            uint32_t zigzag = ((uint32_t)lo << 1) ^ (uint32_t)(lo >> 31);
+            used += putVarint(payload + used, zigzag);
+            payload[used++] = width[c];
+        }
+        uint64_t bits = 0;
+        uint8_t nbits = 0;
+        for (uint8_t i = 1; i < count; i++) {
+            for (uint8_t c = 0; c < CHANNELS; c++) {
+                if (!width[c]) {
+                    continue;
+                }
+                uint32_t value = (uint32_t)delta(channel(records[i], c), channel(records[i - 1], c)) -
+                                 (uint32_t)base[c];
+                bits |= (uint64_t)value << nbits;
+                nbits += width[c];
+                while (nbits >= 8) {
+                    payload[used++] = (uint8_t)bits;
+                    bits >>= 8;
+                    nbits -= 8;
+                }
+            }
+        }
+        if (nbits) {
+            payload[used++] = (uint8_t)bits;
+        }
+    }
+    putLE(out, MPU_BLOCK_MAGIC, 4);
+    putLE(out + 4, used, 2);
+    out[6] = count;
+    out[7] = 0;
+    putLE(out + 8, CRC32::compute(payload, used), 4);
+    outSize = HEADER_SIZE + used;
+    count = 0;
+    return outSize;
+}
+
+int MPUCompressor::decode(const uint8_t *block, size_t len, mpu_record_t *out, size_t maxRecords) {
+    if (len < HEADER_SIZE || getLE(block, 4) != MPU_BLOCK_MAGIC) {
+        return -1;
+    }
+    size_t payloadLen = getLE(block + 4, 2);
+    uint8_t records = block[6];
+    const uint8_t *payload = block + HEADER_SIZE;
+    if (records == 0 || records > maxRecords || payloadLen < sizeof(mpu_record_t) ||
+        len < HEADER_SIZE + payloadLen || CRC32::compute(payload, payloadLen) != getLE(block + 8, 4)) {
+        return -1;
+    }
+    memcpy(&out[0], payload, sizeof(mpu_record_t));
+    size_t used = sizeof(mpu_record_t);
+    if (records == 1) {
+        return 1;
+    }
+    int32_t base[CHANNELS];
+    uint8_t width[CHANNELS];
+    for (uint8_t c = 0; c < CHANNELS; c++) {
+        uint32_t zigzag;
+        size_t n = getVarint(payload + used, payloadLen - used, zigzag);
+        if (n == 0 || used + n >= payloadLen) {
+            return -1;
+        }
+        used += n;
+        base[c] = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+        width[c] = payload[used++];
+        if (width[c] > 32) {
+            return -1;
+        }
+    }
+    uint64_t bits = 0;
+    uint8_t nbits = 0;
+    for (uint8_t i = 1; i < records; i++) {
+        for (uint8_t c = 0; c < CHANNELS; c++) {
+            uint32_t value = 0;
+            if (width[c]) {
+                while (nbits < width[c]) {
+                    if (used >= payloadLen) {
+                        return -1;
+                    }
+                    bits |= (uint64_t)payload[used++] << nbits;
+                    nbits += 8;
+                }
+                value = (uint32_t)(bits & ((1ULL << width[c]) - 1));
+                bits >>= width[c];
+                nbits -= width[c];
+            }
+            int32_t d = (int32_t)(value + (uint32_t)base[c]);
+            setChannel(out[i], c, (int32_t)((uint32_t)channel(out[i - 1], c) + (uint32_t)d));
+        }
+    }
+    return records;
+}
@@ -1,83 +1,244 @@
 #include "MPUUtil.h"
+#include "MemoryBudget.h"
+#include "QuatCodec.h"
+#include "TextWriter.h"
+#include "Trace.h"
 
-// global static pointer used to ensure a single instance of the class.
-MPUUtil* MPUUtil::pInstance = nullptr;
+static_assert(MPU_LOG_QUAT_BITS == 0 || (MPU_LOG_QUAT_BITS >= QuatCodec::MIN_BITS &&
+                                         MPU_LOG_QUAT_BITS <= QuatCodec::MAX_BITS),
+              "MPU_LOG_QUAT_BITS out of range");
+
+volatile bool MPUUtil::interruptPending = false;
+volatile uint32_t MPUUtil::interruptMs = 0;
+TaskHandle_t MPUUtil::notifyTask = nullptr;
+
+// DMP packet size once setup() has initialised the DMP, 0 before; survives
+// deep sleep but not a power cycle, which also resets the sensor
+RTC_DATA_ATTR static uint8_t rtcPacketSize = 0;
+static_assert(sizeof(rtcPacketSize) <= MEM_RTC_MPU_STATE, "MPU state exceeds its RTC budget");
 
 /*****************************************************************
-This function is called to create an instance of the class.
+This function is called to get the instance of the class.
 Calling the constructor publicly is not allowed. The constructor
-is private and is only called by this getInstance() function.
+is private and is only called by this getInstance() function,
+which builds the instance in static storage on first use.
 *****************************************************************/
 MPUUtil* MPUUtil::getInstance() {
-    if (!pInstance)   // Only allow one instance of class to be generated.
-        pInstance = new MPUUtil();
-    return pInstance;
+    static MPUUtil instance;
+    return &instance;
 }
 
-MPUUtil::MPUUtil() {
+MPUUtil::MPUUtil() : fifo(mpu) {
+    static_assert(sizeof(MPUUtil) <= MEM_MPU_UTIL, "MPUUtil exceeds its memory budget");
+    static_assert(sizeof(MPURing) <= MEM_MPU_RING, "MPU ring exceeds its memory budget");
+    // decode buffers of the batch, without its ring
+    static_assert(sizeof(MPUBatch) - sizeof(MPURing) <= MEM_MPU_BATCH,
+                  "MPU batch exceeds its memory budget");
+    static_assert(sizeof(compressor) <= MEM_MPU_COMPRESSOR, "MPU compressor exceeds its memory budget");
+    static_assert(sizeof(features) <= MEM_MOTION_FEATURES, "motion features exceed their memory budget");
     sd = SDUtil::getInstance();
+    batch.setFeatures(&features);
+}
+
+// opens the segmented binary sample log (/<startTS>-mpu-NNNN.bin), every
+// segment starts with the file header and decodes on its own; a raw log
+// is a single session in the raw log partition. Feature windows go to
+// /<startTS>-motion.txt either way. quatBits selects packed records over
+// compressed blocks.
+bool MPUUtil::openLog(time_t startTS, bool compressed, bool raw, uint8_t quatBits) {
+    TextWriter(featuresPath, sizeof(featuresPath)).put('/').u32(startTS).str("-motion.txt");
+    // millis() value matching startTS
+    batch.setTimeBase(millis() - (uint32_t)(time(nullptr) - startTS) * 1000);
+    if (!MPU_LOG_SAMPLES) {
+        return true;
+    }
+    if (raw) {
+        rawLog = sd->openRawLog(startTS);
+    } else {
+        char base[SegmentedLog::MAX_PATH];
+        TextWriter(base, sizeof(base)).put('/').u32(startTS).str("-mpu");
+        log = sd->openSegmentedLog(base, ".bin", SEGMENT_BYTES, SEGMENT_SPAN_S);
+    }
+    if (!log && !rawLog) {
+        return false;
+    }
+    logStartTS = startTS;
+    logQuatBits = quatBits;
+    logCompressed = compressed && !quatBits;
+    mpu_log_header_t header = {};
+    header.magic = MPU_LOG_MAGIC;
+    header.startTS = startTS;
+    if (quatBits) {
+        header.version = MPU_LOG_VERSION_PACKED;
+        header.recordSize = QuatCodec::recordSize(quatBits);
+        header.quatBits = quatBits;
+    } else {
+        header.version = compressed ? MPU_LOG_VERSION_BLOCKS : MPU_LOG_VERSION;
+        header.recordSize = sizeof(mpu_record_t);
+    }
+    if (!rawLog) {
+        log->setHeader(&header, sizeof(header));
+    } else if (rawLog->size() == 0) {
+        rawLog->write((const uint8_t *)&header, sizeof(header));
+    }
+    return true;
+}
+
+// drains the sample ring into the log, called by the storage task
+void MPUUtil::writeToFile() {
+    mpu_record_t record;
+    while (batch.samples().pop(record)) {
+        writeRecord(record);
+    }
+}
+
+// logs the next completed feature window and returns it for the uplink,
+// called by the storage task
+bool MPUUtil::takeFeatures(motion_features_t &window) {
+    if (!features.windows().pop(window)) {
+        return false;
+    }
+    char line[MotionFeatures::LINE_SIZE];
+    if (featuresPath[0] && MotionFeatures::format(window, line, sizeof(line))) {
+        sd->appendFile(featuresPath, line);
+    }
+    return true;
+}
+
+void MPUUtil::writeRecord(const mpu_record_t &record) {
+    if (!log && !rawLog) {
+        return;
+    }
+    if (logQuatBits) {
+        uint8_t packed[sizeof(mpu_record_t)];
+        size_t size = QuatCodec::packRecord(record, logQuatBits, packed);
+        append(recordTS(record), packed, size, 1);
+        return;
+    }
+    if (!logCompressed) {
+        append(recordTS(record), (const uint8_t *)&record, sizeof(record), 1);
+        return;
+    }
+    if (compressor.pending() == 0) {
+        blockTS = recordTS(record);
+    }
+    if (compressor.add(record)) {
+        append(blockTS, compressor.block(), compressor.blockSize(), MPUCompressor::BLOCK_RECORDS);
+    }
+}
+
+void MPUUtil::append(uint32_t ts, const uint8_t *data, size_t len, uint16_t records) {
+    if (rawLog) {
+        rawLog->write(data, len);
+    } else {
+        log->write(ts, data, len, records);
+    }
+}
+
+uint32_t MPUUtil::recordTS(const mpu_record_t &record) {
+    return logStartTS + record.tMs / 1000;
+}
+
+// writes the records of a partial compressed block, call before the log
+// is flushed to the card for a while (deep sleep)
+void MPUUtil::flushLog() {
+    uint8_t records = compressor.pending();
+    if ((log || rawLog) && logCompressed && compressor.finish()) {
+        append(blockTS, compressor.block(), compressor.blockSize(), records);
+    }
+}
+
+// reads a single fresh packet, used by the deep sleep duty cycle where the
+// FIFO is not drained continuously; record.tMs is left to the caller
+bool MPUUtil::readSample(mpu_record_t &record) {
+    if (!dmpReady) {
+        return false;
+    }
+    fifo.reset();
+    unsigned long start = millis();
+    while (!batch.readOne(fifo, millis(), record)) {
+        if (millis() - start > 3 * MPUBatch::SAMPLE_PERIOD_MS) {
+            return false;
+        }
+        delay(1);
+    }
+    return true;
 }
 
-#if 0
-void MPUUtil::writeToFile(char* filename) {
-  // sprintf(filename, "/%lu-mpu.txt", start_ts);
-#ifdef DEBUG
-  Serial.println(F("writing accelerometer data..."));
-#endif
-  char sample_str[200];
-  char qw_str[20];
-  char qx_str[20];
-  char qy_str[20];
-  char qz_str[20];
-  // escreve todas as amostras coletadas
-  for (uint8_t i = 0; i < NUM_SAMPLES; i++) {
-    dtostrf(mpu_samples[i].q.w, 4, 6, qw_str);
-    dtostrf(mpu_samples[i].q.x, 4, 6, qx_str);
-    dtostrf(mpu_samples[i].q.y, 4, 6, qy_str);
-    dtostrf(mpu_samples[i].q.z, 4, 6, qz_str);
-    sprintf(sample_str, "%lu;%s;%s;%s;%s;%d;%d;%d;%d;%d;%d\n",
-            mpu_samples[i].ts, qw_str, qx_str, qy_str, qz_str,
-            mpu_samples[i].gX, mpu_samples[i].gY, mpu_samples[i].gZ,
-            mpu_samples[i].aX, mpu_samples[i].aY, mpu_samples[i].aZ);
-    // escreve valor 'x' do acelerometro no arquivo
-    sd->appendFile(SD, filename, sample_str);
-#ifdef DEBUG
-    if(i == 0) Serial.println(mpu_samples[0].ts);
-    // Serial.println(sample_str);
-#endif
-  }
-#ifdef DEBUG
-  Serial.println(F("ok"));
-#endif
-}
-#endif
+MPURing& MPUUtil::samples() {
+    return batch.samples();
+}
+
+// FIFO overflows detected (and recovered from) since boot
+uint32_t MPUUtil::fifoOverflows() {
+    return batch.overflows();
+}
+
+uint16_t MPUUtil::fifoCount() {
+    return batch.fifoCount();
+}
+
+// how long the FIFO may go undrained, the interrupt does not wake the CPU
+uint32_t MPUUtil::maxSleepMs() {
+    return dmpReady ? FIFO_SLEEP_MS : UINT32_MAX;
+}
 
+// task woken by the data ready interrupt, usually the acquisition task
+void MPUUtil::setNotifyTask(TaskHandle_t task) {
+    notifyTask = task;
+}
+
+void IRAM_ATTR MPUUtil::dmpDataReady() {
+    interruptMs = millis();
+    interruptPending = true;
+    if (notifyTask) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(notifyTask, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+}
+
+// drains every complete packet from the DMP FIFO in multi-packet bursts,
+// called after the data ready interrupt fired
 void MPUUtil::readFromSensor() {
-#if 0
-  uint16_t fifo_count = mpu.getFIFOCount();
-#ifdef DEBUG
-  Serial.print("ps: "); Serial.print(packet_size);
-  Serial.print(" | fc: "); Serial.println(fifo_count);
-#endif
-  while(fifo_count >= packet_size) {
-    fifo_count -= packet_size;
-    mpu_samples[cur_sample].ts = now();
-    mpu.dmpGetQuaternion(&mpu_samples[cur_sample].q, fifo_buffer);
-    mpu_samples[cur_sample].gX = (fifo_buffer[16] << 8) | fifo_buffer[17];
-    mpu_samples[cur_sample].gY = (fifo_buffer[20] << 8) | fifo_buffer[21];
-    mpu_samples[cur_sample].gZ = (fifo_buffer[24] << 8) | fifo_buffer[25];
-    mpu_samples[cur_sample].aX = (fifo_buffer[28] << 8) | fifo_buffer[29];
-    mpu_samples[cur_sample].aY = (fifo_buffer[32] << 8) | fifo_buffer[33];
-    mpu_samples[cur_sample].aZ = (fifo_buffer[36] << 8) | fifo_buffer[37];
-    cur_sample++;
-    // if buffer full
-    if (cur_sample == NUM_SAMPLES) {
-      write_mpu_data();
-      // reset buffer index
-      cur_sample = 0;
-    }
-  }
-#endif
+    if (!dmpReady || !interruptPending) {
+        return;
+    }
+    interruptPending = false;
+    TRACE_SCOPE(TRACE_MPU_READ);
+    if (!batch.drain(fifo, interruptMs)) {
+        ESP_LOGW("mpu", "FIFO overflow, reset");
+    }
+    updateMotion(fifo.takeStatus());
+}
+
+// last motion state reported by the motion interrupts, moving until the
+// first zero motion interrupt
+bool MPUUtil::isMoving() {
+    return moving;
+}
+
+// the motion and zero motion interrupts share the INT pin with the DMP;
+// the accelerometer high pass filter only feeds the motion detectors
+void MPUUtil::configureMotion() {
+    mpu.setDHPFMode(MPU6050_DHPF_5);
+    mpu.setMotionDetectionThreshold(MOTION_THRESHOLD);
+    mpu.setMotionDetectionDuration(MOTION_DURATION);
+    mpu.setZeroMotionDetectionThreshold(ZERO_MOTION_THRESHOLD);
+    mpu.setZeroMotionDetectionDuration(ZERO_MOTION_DURATION);
+    mpu.setIntMotionEnabled(true);
+    mpu.setIntZeroMotionEnabled(true);
+}
+
+// the zero motion interrupt fires both when stillness starts and when it
+// ends, MOT_DETECT_STATUS tells which
+void MPUUtil::updateMotion(uint8_t status) {
+    if (status & (1 << MPU6050_INTERRUPT_ZMOT_BIT)) {
+        moving = !mpu.getZeroMotionDetected();
+    }
+    if (status & (1 << MPU6050_INTERRUPT_MOT_BIT)) {
+        moving = true;
+    }
 }
 
 void MPUUtil::setup() {
@@ -92,56 +253,59 @@ void MPUUtil::setup() {
     Serial.println(F("Testing device connections..."));
     Serial.println(mpu.testConnection() ? F("MPU6050 connection successful") : F("MPU6050 connection failed"));
 
-#if 0
-    // wait for ready
-    Serial.println(F("\nSend any character to begin DMP programming and demo: "));
-    while (Serial.available() && Serial.read()); // empty buffer
-    while (!Serial.available());                 // wait for data
-    while (Serial.available() && Serial.read()); // empty buffer again
-
-    if(rst_reason == ESP_RST_POWERON) {
-        // load and configure the DMP
-        Serial.println(F("Initializing DMP..."));
-        dev_status = mpu.dmpInitialize();
-
-        // supply your own gyro offsets here, scaled for min sensitivity
-        mpu.setXGyroOffset(220);
-        mpu.setYGyroOffset(76);
-        mpu.setZGyroOffset(-85);
-        mpu.setZAccelOffset(1788); // 1688 factory default for my test chip
-
-        // make sure it worked (returns 0 if so)
-        if (dev_status == 0) {
-            // Calibration Time: generate offsets and calibrate our MPU6050
-            mpu.CalibrateAccel(6);
-            mpu.CalibrateGyro(6);
-            mpu.PrintActiveOffsets();
-            // turn on the DMP, now that it's ready
-            Serial.println(F("Enabling DMP..."));
-            mpu.setDMPEnabled(true);
-
-            // enable Arduino interrupt detection
-            Serial.print(F("Enabling interrupt detection (Arduino external interrupt "));
-            Serial.print(digitalPinToInterrupt(INTERRUPT_PIN));
-            Serial.println(F(")..."));
-            attachInterrupt(digitalPinToInterrupt(INTERRUPT_PIN), dmpDataReady, RISING);
-            mpu_int_status = mpu.getIntStatus();
-
-            // set our DMP Ready flag so the main loop() function knows it's okay to use it
-            Serial.println(F("DMP ready! Waiting for first interrupt..."));
-            dmp_ready = true;
-
-            // get expected DMP packet size for later comparison
-            packet_size = mpu.dmpGetFIFOPacketSize();
-        } else {
-            // ERROR!
-            // 1 = initial memory load failed
-            // 2 = DMP configuration updates failed
-            // (if it's going to break, usually the code will be 1)
-            Serial.print(F("DMP Initialization failed (code "));
-            Serial.print(dev_status);
-            Serial.println(F(")"));
-        }
+    // load and configure the DMP
+    Serial.println(F("Initializing DMP..."));
+    uint8_t devStatus = mpu.dmpInitialize();
+
+    // supply your own gyro offsets here, scaled for min sensitivity
+    mpu.setXGyroOffset(220);
+    mpu.setYGyroOffset(76);
+    mpu.setZGyroOffset(-85);
+    mpu.setZAccelOffset(1788); // 1688 factory default for my test chip
+
+    // make sure it worked (returns 0 if so)
+    if (devStatus == 0) {
+        // Calibration Time: generate offsets and calibrate our MPU6050
+        mpu.CalibrateAccel(6);
+        mpu.CalibrateGyro(6);
+        mpu.PrintActiveOffsets();
+        configureMotion();
+        // turn on the DMP, now that it's ready
+        Serial.println(F("Enabling DMP..."));
+        mpu.setDMPEnabled(true);
+        // get expected DMP packet size for later comparison
+        rtcPacketSize = mpu.dmpGetFIFOPacketSize();
+        wakeup();
+    } else {
+        rtcPacketSize = 0;
+        // ERROR!
+        // 1 = initial memory load failed
+        // 2 = DMP configuration updates failed
+        // (if it's going to break, usually the code will be 1)
+        Serial.print(F("DMP Initialization failed (code "));
+        Serial.print(devStatus);
+        Serial.println(F(")"));
+    }
+}
+
+// resumes sampling with a DMP that was configured before deep sleep
+void MPUUtil::wakeup() {
+    Wire.begin();
+    Wire.setClock(400000);
+    pinMode(INTERRUPT_PIN, INPUT);
+    // the DMP must have been initialised by setup() and still be running: a
+    // sensor that lost power comes back with the DMP disabled
+    if (rtcPacketSize == 0 || !mpu.getDMPEnabled()) {
+        ESP_LOGE("mpu", "DMP not initialised, sampling disabled");
+        dmpReady = false;
+        return;
     }
-    #endif
-}
\ No newline at end of file
+    batch.setPacketSize(rtcPacketSize);
+    // packets queued while sleeping are stale and the FIFO has overflowed
+    mpu.resetFIFO();
+    batch.clear();
+    attachInterrupt(digitalPinToInterrupt(INTERRUPT_PIN), dmpDataReady, RISING);
+    mpu.getIntStatus();
+    // set our DMP Ready flag so the acquisition task knows it's okay to use it
+    dmpReady = true;
+}
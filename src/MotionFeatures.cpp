@@ -0,0 +1,228 @@
+#include "MotionFeatures.h"
+#include <math.h>
+#include <string.h>
+#include "QuatCodec.h"
+#include "TextWriter.h"
+
+#if defined(ESP_PLATFORM) && __has_include(<esp_dsp.h>)
+#include <esp_dsp.h>
+#define MOTION_FEATURES_DSP
+#endif
+
+// vector routines, esp-dsp on the device and plain loops elsewhere
+
+static void vecMul(const float *a, const float *b, float *out, int n) {
+#ifdef MOTION_FEATURES_DSP
+    dsps_mul_f32(a, b, out, n, 1, 1, 1);
+#else
+    for (int i = 0; i < n; i++) {
+        out[i] = a[i] * b[i];
+    }
+#endif
+}
+
+static void vecAdd(const float *a, const float *b, float *out, int n) {
+#ifdef MOTION_FEATURES_DSP
+    dsps_add_f32(a, b, out, n, 1, 1, 1);
+#else
+    for (int i = 0; i < n; i++) {
+        out[i] = a[i] + b[i];
+    }
+#endif
+}
+
+static void vecAddC(const float *in, float *out, int n, float c) {
+#ifdef MOTION_FEATURES_DSP
+    dsps_addc_f32(in, out, n, c, 1, 1);
+#else
+    for (int i = 0; i < n; i++) {
+        out[i] = in[i] + c;
+    }
+#endif
+}
+
+static float vecDot(const float *a, const float *b, int n) {
+    float sum = 0;
+#ifdef MOTION_FEATURES_DSP
+    dsps_dotprod_f32(a, b, &sum, n);
+#else
+    for (int i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+#endif
+    return sum;
+}
+
+// direct form II, coef and w laid out as esp-dsp expects them
+static void vecBiquad(const float *in, float *out, int n, float *coef, float *w) {
+#ifdef MOTION_FEATURES_DSP
+    dsps_biquad_f32(in, out, n, coef, w);
+#else
+    for (int i = 0; i < n; i++) {
+        float d0 = in[i] - coef[3] * w[0] - coef[4] * w[1];
+        out[i] = coef[0] * d0 + coef[1] * w[0] + coef[2] * w[1];
+        w[1] = w[0];
+        w[0] = d0;
+    }
+#endif
+}
+
+static uint16_t clampU16(float value) {
+    return value < 0 ? 0 : value > 65535.0f ? 65535 : (uint16_t)(value + 0.5f);
+}
+
+MotionFeatures::MotionFeatures() {
+    lowPassCoefficients(lowPass, STEP_BAND_HZ / MPUBatch::DMP_RATE_HZ);
+    highPassCoefficients(highPass, HIGH_PASS_HZ / MPUBatch::DMP_RATE_HZ);
+    memset(lowPassState, 0, sizeof(lowPassState));
+    memset(highPassState, 0, sizeof(highPassState));
+    memset(bandPrev, 0, sizeof(bandPrev));
+    lastStepMs = 0;
+    inImpact = false;
+    batches = 0;
+    hasLastQ = false;
+}
+
+// Butterworth (Q 0.707) biquads per the RBJ cookbook, freq in cycles per
+// sample
+void MotionFeatures::lowPassCoefficients(float *coef, float freq) {
+    float w0 = 2 * (float)M_PI * freq;
+    float alpha = sinf(w0) / (2 * (float)M_SQRT1_2);
+    float c = cosf(w0);
+    float a0 = 1 + alpha;
+    coef[0] = (1 - c) / 2 / a0;
+    coef[1] = (1 - c) / a0;
+    coef[2] = coef[0];
+    coef[3] = -2 * c / a0;
+    coef[4] = (1 - alpha) / a0;
+}
+
+void MotionFeatures::highPassCoefficients(float *coef, float freq) {
+    float w0 = 2 * (float)M_PI * freq;
+    float alpha = sinf(w0) / (2 * (float)M_SQRT1_2);
+    float c = cosf(w0);
+    float a0 = 1 + alpha;
+    coef[0] = (1 + c) / 2 / a0;
+    coef[1] = -(1 + c) / a0;
+    coef[2] = coef[0];
+    coef[3] = -2 * c / a0;
+    coef[4] = (1 - alpha) / a0;
+}
+
+void MotionFeatures::process(const mpu_batch_t &batch, uint32_t timeBase) {
+    uint8_t n = batch.count;
+    if (n == 0) {
+        return;
+    }
+    if (batches == 0) {
+        memset(&window, 0, sizeof(window));
+        window.tMs = batch.ms[0] - timeBase;
+        sumSquares = 0;
+        sumMag = 0;
+        peak = 0;
+        rotation = 0;
+        activeBatches = 0;
+        for (uint8_t c = 0; c < 4; c++) {
+            windowStartQ[c] = batch.q[c][0];
+        }
+    }
+    magnitude(batch, n);
+    // the 1 g offset is removed first so the high-pass starts without a
+    // transient; it takes out the rest of gravity and any bias
+    vecAddC(mag, scratch, n, -1.0f);
+    vecBiquad(scratch, dynamic, n, highPass, highPassState);
+    vecBiquad(dynamic, band, n, lowPass, lowPassState);
+    float squares = vecDot(dynamic, dynamic, n);
+    sumSquares += squares;
+    if (sqrtf(squares / n) * 1000 > ACTIVE_MG) {
+        activeBatches++;
+    }
+    detect(batch, n);
+    // orientation change since the end of the previous batch
+    int16_t q[4];
+    for (uint8_t c = 0; c < 4; c++) {
+        q[c] = batch.q[c][n - 1];
+        if (!hasLastQ) {
+            lastQ[c] = batch.q[c][0];
+        }
+    }
+    rotation += QuatCodec::angleDeg(lastQ, q);
+    memcpy(lastQ, q, sizeof(lastQ));
+    hasLastQ = true;
+    window.samples += n;
+    if (++batches == WINDOW_BATCHES) {
+        closeWindow();
+    }
+}
+
+// acceleration magnitude in g into mag
+void MotionFeatures::magnitude(const mpu_batch_t &batch, uint8_t n) {
+    static const float scale = 1.0f / ACCEL_LSB_PER_G;
+    for (uint8_t c = 0; c < 3; c++) {
+        for (uint8_t i = 0; i < n; i++) {
+            scratch[i] = batch.a[c][i] * scale;
+        }
+        if (c == 0) {
+            vecMul(scratch, scratch, mag, n);
+        } else {
+            vecMul(scratch, scratch, band, n);
+            vecAdd(mag, band, mag, n);
+        }
+    }
+    for (uint8_t i = 0; i < n; i++) {
+        mag[i] = sqrtf(mag[i]);
+        sumMag += mag[i];
+    }
+}
+
+// peak, impacts on the dynamic acceleration and steps on the gait band
+void MotionFeatures::detect(const mpu_batch_t &batch, uint8_t n) {
+    for (uint8_t i = 0; i < n; i++) {
+        float d = dynamic[i];
+        if (fabsf(d) > peak) {
+            peak = fabsf(d);
+        }
+        if (!inImpact && d > IMPACT_G) {
+            inImpact = true;
+            window.impacts++;
+        } else if (inImpact && d < IMPACT_G / 2) {
+            inImpact = false;
+        }
+        // the previous sample was a local maximum
+        float b = band[i];
+        if (bandPrev[0] > STEP_G && bandPrev[0] > bandPrev[1] && bandPrev[0] >= b &&
+            batch.ms[i] - lastStepMs >= STEP_MIN_MS) {
+            window.steps++;
+            lastStepMs = batch.ms[i];
+        }
+        bandPrev[1] = bandPrev[0];
+        bandPrev[0] = b;
+    }
+}
+
+void MotionFeatures::closeWindow() {
+    window.rmsMg = clampU16(sqrtf(sumSquares / window.samples) * 1000);
+    window.peakMg = clampU16(peak * 1000);
+    window.meanMg = clampU16(sumMag / window.samples * 1000);
+    window.rotationDeg = clampU16(rotation);
+    window.tiltDeg = (uint8_t)(QuatCodec::angleDeg(windowStartQ, lastQ) + 0.5f);
+    window.activePct = activeBatches * 100 / batches;
+    QuatCodec::encode(lastQ, ORIENTATION_BITS, window.orientation);
+    // a full ring is accounted in its overflow counter
+    ring.push(window);
+    batches = 0;
+}
+
+size_t MotionFeatures::format(const motion_features_t &f, char *str, size_t size) {
+    TextWriter out(str, size);
+    out.fixed(f.tMs, 3).put(';').u32(f.samples).put(';').u32(f.rmsMg).put(';').u32(f.peakMg)
+        .put(';').u32(f.meanMg).put(';').u32(f.steps).put(';').u32(f.impacts)
+        .put(';').u32(f.rotationDeg).put(';').u32(f.tiltDeg).put(';').u32(f.activePct);
+    int16_t q[4];
+    QuatCodec::decode(f.orientation, ORIENTATION_BITS, q);
+    for (uint8_t c = 0; c < 4; c++) {
+        out.put(';').q14(q[c], 4);
+    }
+    out.put('\n');
+    return out.overflowed() ? 0 : out.length();
+}
@@ -0,0 +1,40 @@
+#include "MotionPolicy.h"
+
+bool MotionPolicy::update(bool moving, uint32_t nowMs) {
+    gps_policy_t next = current;
+    if (moving) {
+        next = GPS_POLICY_MOVING;
+    } else if (current == GPS_POLICY_MOVING) {
+        next = GPS_POLICY_STATIONARY;
+        stillSinceMs = nowMs;
+    } else if (current == GPS_POLICY_STATIONARY && nowMs - stillSinceMs >= backupAfterMs) {
+        next = GPS_POLICY_BACKUP;
+    }
+    if (next == current) {
+        return false;
+    }
+    current = next;
+    return true;
+}
+
+uint32_t MotionPolicy::gpsPeriodMs() {
+    switch (current) {
+        case GPS_POLICY_STATIONARY:
+            return stationaryMs;
+        case GPS_POLICY_BACKUP:
+            return heartbeatMs;
+        default:
+            return movingMs;
+    }
+}
+
+const char* MotionPolicy::name(gps_policy_t policy) {
+    switch (policy) {
+        case GPS_POLICY_STATIONARY:
+            return "stationary";
+        case GPS_POLICY_BACKUP:
+            return "backup";
+        default:
+            return "moving";
+    }
+}
@@ -0,0 +1,339 @@
+#include "PipelineUtil.h"
+#include "MemoryBudget.h"
+#include "TextWriter.h"
+#include <esp_sleep.h>
+
+
+/*****************************************************************
+This function is called to get the instance of the class.
+Calling the constructor publicly is not allowed. The constructor
+is private and is only called by this getInstance() function,
+which builds the instance in static storage on first use.
+*****************************************************************/
+PipelineUtil* PipelineUtil::getInstance() {
+    static PipelineUtil instance;
+    return &instance;
+}
+
+PipelineUtil::PipelineUtil() {
+    static_assert(sizeof(PipelineUtil) <= MEM_PIPELINE_UTIL, "PipelineUtil exceeds its memory budget");
+    static_assert(sizeof(acquisitionStack) + sizeof(storageStack) <= MEM_PIPELINE_STACKS,
+                  "task stacks exceed their memory budget");
+    gps = GPSUtil::getInstance();
+    sd = SDUtil::getInstance();
+    lora = LoRaUtil::getInstance();
+}
+
+// starts both tasks, the MPU is optional and skipped when null
+void PipelineUtil::setup(SegmentedLog *gpsLog, MPUUtil *mpu) {
+    this->gpsLog = gpsLog;
+    this->mpu = mpu;
+    loopHandle = xTaskGetCurrentTaskHandle();
+    acquisitionLock = xSemaphoreCreateMutexStatic(&acquisitionLockBuffer);
+    storageLock = xSemaphoreCreateMutexStatic(&storageLockBuffer);
+    uart_set_wakeup_threshold(CONSOLE_UART, CONSOLE_WAKEUP_EDGES);
+    esp_sleep_enable_uart_wakeup(CONSOLE_UART);
+    storageHandle = xTaskCreateStaticPinnedToCore(storageTask, "storage", STORAGE_STACK, this,
+                                                  STORAGE_PRIORITY, storageStack, &storageBuffer,
+                                                  STORAGE_CORE);
+    acquisitionHandle = xTaskCreateStaticPinnedToCore(acquisitionTask, "acquisition", ACQUISITION_STACK,
+                                                      this, ACQUISITION_PRIORITY, acquisitionStack,
+                                                      &acquisitionBuffer, ACQUISITION_CORE);
+    if (mpu) {
+        mpu->setNotifyTask(acquisitionHandle);
+    }
+    gps->setFixCallback(onFix, this);
+    ESP_LOGI(tag, "Pipeline started");
+}
+
+// attaches the logs to the running tasks, e.g. once the first fix gave
+// them a name; policyPath must outlive the pipeline
+void PipelineUtil::setLogs(SegmentedLog *gpsLog, MPUUtil *mpu, const char *policyPath) {
+    xSemaphoreTake(acquisitionLock, portMAX_DELAY);
+    xSemaphoreTake(storageLock, portMAX_DELAY);
+    this->gpsLog = gpsLog;
+    this->mpu = mpu;
+    this->policyPath = policyPath;
+    if (mpu) {
+        mpu->setNotifyTask(acquisitionHandle);
+    }
+    unlockTasks();
+}
+
+// asks the acquisition task to sample the next valid GPS fix
+void PipelineUtil::requestGPSRead() {
+#ifdef TRACE_ENABLED
+    if (!gpsReadRequested) {
+        gpsRequestCycles = Trace::cycles();
+        gpsRequestMs = millis();
+    }
+#endif
+    gpsReadRequested = true;
+}
+
+// drops a read request that got no fix, e.g. before the receiver sleeps
+void PipelineUtil::cancelGPSRead() {
+    gpsReadRequested = false;
+}
+
+// stores the fix the track filter holds back, e.g. the last one before the
+// receiver sleeps
+void PipelineUtil::flushTrack() {
+    trackFlushRequested = true;
+    xTaskNotifyGive(storageHandle);
+}
+
+// queues a GPS policy change for the policy log, called by the main loop
+void PipelineUtil::logPolicy(uint32_t ts, gps_policy_t policy, uint32_t periodMs) {
+    policy_event_t event = { ts, periodMs, policy };
+    if (policyEvents.push(event)) {
+        xTaskNotifyGive(storageHandle);
+    }
+}
+
+TrackFilter& PipelineUtil::track() {
+    return trackFilter;
+}
+
+// number of fixes stored since the last call
+uint32_t PipelineUtil::takeStoredFixes() {
+    return storedFixes.exchange(0);
+}
+
+#ifdef TRACE_ENABLED
+static const char *STATS_FILE = "/stats.jsonl";
+
+static void printTraceLine(const char *line, void *arg) {
+    Serial.print(line);
+}
+
+static void appendTraceLine(const char *line, void *arg) {
+    ((SDUtil *)arg)->appendFile(STATS_FILE, line);
+}
+#endif
+
+// waits up to waitMs for the next job of the main loop, in light sleep if
+// nothing in the pipeline needs the CPU that long
+void PipelineUtil::idle(uint32_t waitMs, bool allowSleep) {
+    waitMs = waitMs < MAX_SLEEP_MS ? waitMs : MAX_SLEEP_MS;
+    uint32_t sleepMs = 0;
+    if (allowSleep && waitMs >= MIN_SLEEP_MS && lockTasks()) {
+        sleepMs = sleepBudget(waitMs);
+        if (sleepMs >= MIN_SLEEP_MS) {
+            lightSleep(sleepMs);
+        }
+        unlockTasks();
+    }
+    if (sleepMs < MIN_SLEEP_MS) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs < IDLE_POLL_MS ? waitMs : IDLE_POLL_MS));
+    }
+}
+
+// takes both task locks without waiting, false if a task is running
+bool PipelineUtil::lockTasks() {
+    if (xSemaphoreTake(acquisitionLock, 0) != pdTRUE) {
+        return false;
+    }
+    if (xSemaphoreTake(storageLock, 0) != pdTRUE) {
+        xSemaphoreGive(acquisitionLock);
+        return false;
+    }
+    return true;
+}
+
+void PipelineUtil::unlockTasks() {
+    xSemaphoreGive(storageLock);
+    xSemaphoreGive(acquisitionLock);
+}
+
+// how long the chip may sleep, 0 if it has to stay awake; called with
+// both task locks held
+uint32_t PipelineUtil::sleepBudget(uint32_t maxMs) {
+    if (gpsReadRequested || gps->fixes().size()) {
+        return 0;
+    }
+    uint32_t budget = maxMs;
+    if (mpu) {
+        if (mpu->samples().size()) {
+            return 0;
+        }
+        budget = budget < mpu->maxSleepMs() ? budget : mpu->maxSleepMs();
+    }
+    budget = budget < sd->untilFlush() ? budget : sd->untilFlush();
+    return lora->canSleep(budget) ? budget : 0;
+}
+
+void PipelineUtil::lightSleep(uint32_t ms) {
+    Serial.flush();
+    esp_sleep_enable_timer_wakeup((uint64_t)ms * 1000);
+    uint32_t start = millis();
+    esp_light_sleep_start();
+    sleepCount++;
+    sleepTotalMs += millis() - start;
+}
+
+void PipelineUtil::printStats() {
+    GPSRing &fixes = gps->fixes();
+    Serial.printf("gps ring: %u/%u, high water %u, overflows %u\n",
+                  fixes.size(), fixes.capacity(), fixes.highWater(), fixes.overflows());
+    if (mpu) {
+        MPURing &samples = mpu->samples();
+        Serial.printf("mpu ring: %u/%u, high water %u, overflows %u\n",
+                      samples.size(), samples.capacity(), samples.highWater(), samples.overflows());
+    }
+    Serial.printf("light sleep: %u times, %u ms\n", sleepCount, sleepTotalMs);
+    Serial.printf("gps ttff: %u ms\n", gps->ttffMs());
+    // everything of ours is static, a shrinking heap points at a driver
+    Serial.printf("heap: %u free, %u min free, %u largest block\n",
+                  ESP.getFreeHeap(), ESP.getMinFreeHeap(), ESP.getMaxAllocHeap());
+    Serial.printf("track: %u fixes, %u retained\n", trackFilter.inputs(), trackFilter.retained());
+#ifdef TRACE_ENABLED
+    Trace::dump(printTraceLine, nullptr, true);
+#endif
+}
+
+void PipelineUtil::acquisitionTask(void *arg) {
+    PipelineUtil *pipeline = (PipelineUtil *)arg;
+    for (;;) {
+        xSemaphoreTake(pipeline->acquisitionLock, portMAX_DELAY);
+        pipeline->acquire();
+        xSemaphoreGive(pipeline->acquisitionLock);
+        // woken early by the MPU data ready interrupt
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ACQUISITION_PERIOD_MS));
+    }
+}
+
+void PipelineUtil::storageTask(void *arg) {
+    PipelineUtil *pipeline = (PipelineUtil *)arg;
+    for (;;) {
+        // woken early when the acquisition side produced data
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(STORAGE_PERIOD_MS));
+        xSemaphoreTake(pipeline->storageLock, portMAX_DELAY);
+        pipeline->store();
+        xSemaphoreGive(pipeline->storageLock);
+    }
+}
+
+void PipelineUtil::acquire() {
+    bool produced = false;
+    if (mpu) {
+        size_t before = mpu->samples().size();
+        mpu->readFromSensor();
+        produced = mpu->samples().size() != before;
+    }
+    if (produced) {
+        xTaskNotifyGive(storageHandle);
+    }
+}
+
+// runs in the GPS task, which is the only producer of the GPS ring
+void PipelineUtil::onFix(const gps_fix_t &fix, void *arg) {
+    PipelineUtil *pipeline = (PipelineUtil *)arg;
+    if (pipeline->gpsReadRequested.exchange(false)) {
+#ifdef TRACE_ENABLED
+        Trace::recordUs(TRACE_GPS_READ, pipeline->gpsRequestCycles,
+                        (millis() - pipeline->gpsRequestMs) * 1000);
+#endif
+        pipeline->gps->fixes().push(fix);
+        xTaskNotifyGive(pipeline->storageHandle);
+    }
+}
+
+void PipelineUtil::store() {
+    gps_fix_t fix, retained;
+    uint32_t stored = 0;
+    // stored counts every fix read, retained or not
+    while (gps->fixes().pop(fix)) {
+        if (trackFilter.add(fix, retained)) {
+            storeFix(retained);
+        }
+        stored++;
+    }
+    if (trackFlushRequested.exchange(false) && trackFilter.flush(retained)) {
+        storeFix(retained);
+    }
+    if (stored) {
+        storedFixes += stored;
+        xTaskNotifyGive(loopHandle);
+    }
+    if (mpu) {
+        mpu->writeToFile();
+        motion_features_t window;
+        while (mpu->takeFeatures(window)) {
+            lora->queueMotion(window);
+        }
+    }
+    lora->loop();
+    sd->loop();
+    writePolicy();
+    saveAid();
+    checkOverflows();
+    traceQueues();
+#ifdef TRACE_ENABLED
+    if (millis() - lastStatsMs >= STATS_PERIOD_MS) {
+        lastStatsMs = millis();
+        Trace::dump(appendTraceLine, sd, false);
+    }
+#endif
+}
+
+void PipelineUtil::storeFix(const gps_fix_t &fix) {
+    char strBuffer[GPSParser::FIX_LINE_SIZE];
+    if (gpsLog && GPSParser::formatFix(fix, strBuffer, sizeof(strBuffer))) {
+        gpsLog->print(fix.ts, strBuffer);
+    }
+    lora_fix_t uplink = { (uint32_t)fix.ts, fix.lat, fix.lng };
+    lora->queueFix(uplink);
+}
+
+// policy changes are rare, each line is appended on its own
+void PipelineUtil::writePolicy() {
+    policy_event_t event;
+    while (policyEvents.pop(event)) {
+        char line[40];
+        TextWriter(line, sizeof(line)).u32(event.ts).put(';').str(MotionPolicy::name(event.policy))
+            .put(';').u32(event.periodMs / 1000).put('\n');
+        if (policyPath && policyPath[0]) {
+            sd->appendFile(policyPath, line);
+        }
+    }
+}
+
+// the first fix is saved at once, later ones (and retries) every
+// AID_SAVE_PERIOD_MS
+void PipelineUtil::saveAid() {
+    gps_aid_t aid;
+    if (!gps->getAid(aid) || aid.ts == savedAidTs) {
+        return;
+    }
+    if (lastAidMs && millis() - lastAidMs < AID_SAVE_PERIOD_MS) {
+        return;
+    }
+    lastAidMs = millis();
+    if (sd->writeData(GPSUtil::AID_FILE, &aid, sizeof(aid))) {
+        savedAidTs = aid.ts;
+    }
+}
+
+// reports samples dropped since the last check
+void PipelineUtil::checkOverflows() {
+    uint32_t overflows = gps->fixes().overflows();
+    if (mpu) {
+        overflows += mpu->samples().overflows();
+    }
+    if (overflows != reportedOverflows) {
+        ESP_LOGW(tag, "%u samples dropped", overflows - reportedOverflows);
+        reportedOverflows = overflows;
+        printStats();
+    }
+}
+
+// depth and drops of every pipeline buffer, for the trace statistics
+void PipelineUtil::traceQueues() {
+    TRACE_QUEUE(TRACE_QUEUE_GPS, gps->fixes().size(), gps->fixes().overflows());
+    if (mpu) {
+        TRACE_QUEUE(TRACE_QUEUE_MPU, mpu->samples().size(), mpu->samples().overflows());
+        TRACE_QUEUE(TRACE_QUEUE_MPU_FIFO, mpu->fifoCount(), mpu->fifoOverflows());
+    }
+    TRACE_QUEUE(TRACE_QUEUE_UPLINK, lora->queuedFixes(), lora->droppedFixes());
+}
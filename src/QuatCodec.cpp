@@ -0,0 +1,125 @@
+#include "QuatCodec.h"
+#include <math.h>
+#include <string.h>
+
+static const float Q14 = 16384.0f;
+
+size_t QuatCodec::encode(const int16_t *q, uint8_t bits, uint8_t *out) {
+    float v[4];
+    float norm = 0;
+    for (uint8_t c = 0; c < 4; c++) {
+        v[c] = q[c];
+        norm += v[c] * v[c];
+    }
+    if (norm == 0) {
+        v[0] = 1;
+        norm = 1;
+    }
+    norm = sqrtf(norm);
+    uint8_t largest = 0;
+    for (uint8_t c = 1; c < 4; c++) {
+        if (fabsf(v[c]) > fabsf(v[largest])) {
+            largest = c;
+        }
+    }
+    // q and -q are the same rotation
+    float scale = (v[largest] < 0 ? -1 : 1) / norm;
+    uint32_t levels = steps(bits);
+    uint64_t packed = largest;
+    uint8_t shift = 2;
+    for (uint8_t c = 0; c < 4; c++) {
+        if (c == largest) {
+            continue;
+        }
+        float x = (v[c] * scale + (float)M_SQRT1_2) / (float)M_SQRT2 * levels + 0.5f;
+        uint32_t u = x <= 0 ? 0 : x >= levels ? levels : (uint32_t)x;
+        packed |= (uint64_t)u << shift;
+        shift += bits;
+    }
+    size_t size = bytes(bits);
+    for (size_t i = 0; i < size; i++) {
+        out[i] = (packed >> (8 * i)) & 0xFF;
+    }
+    return size;
+}
+
+void QuatCodec::decode(const uint8_t *in, uint8_t bits, int16_t *q) {
+    uint64_t packed = 0;
+    size_t size = bytes(bits);
+    for (size_t i = 0; i < size; i++) {
+        packed |= (uint64_t)in[i] << (8 * i);
+    }
+    uint8_t largest = packed & 0x03;
+    uint32_t levels = steps(bits);
+    float v[4];
+    float sum = 0;
+    uint8_t shift = 2;
+    for (uint8_t c = 0; c < 4; c++) {
+        if (c == largest) {
+            continue;
+        }
+        uint32_t u = (packed >> shift) & ((1u << bits) - 1);
+        v[c] = u * (float)M_SQRT2 / levels - (float)M_SQRT1_2;
+        sum += v[c] * v[c];
+        shift += bits;
+    }
+    v[largest] = sum < 1 ? sqrtf(1 - sum) : 0;
+    for (uint8_t c = 0; c < 4; c++) {
+        q[c] = (int16_t)lroundf(v[c] * Q14);
+    }
+}
+
+// With e half a quantisation step the three kept components are off by at
+// most e each. They sum to at most 1.5 in magnitude and the rebuilt one is
+// at least 1/2, so it is off by at most 6e(1 + e) and the quaternions
+// differ by d <= sqrt(39) e (1 + e), plus the Q14 rounding of the output;
+// the rotation angle is 4 asin(d / 2).
+float QuatCodec::maxErrorDeg(uint8_t bits) {
+    float e = (float)M_SQRT2 / steps(bits) / 2;
+    float d = sqrtf(39.0f) * e * (1 + e) + 2 / Q14;
+    return 4 * asinf(d / 2 < 1 ? d / 2 : 1) * (180 / (float)M_PI);
+}
+
+// from the chord between the normalised quaternions, which unlike the acos
+// of their dot product stays accurate for small angles in float
+float QuatCodec::angleDeg(const int16_t *q1, const int16_t *q2) {
+    float n1 = 0, n2 = 0, dot = 0;
+    for (uint8_t c = 0; c < 4; c++) {
+        n1 += (float)q1[c] * q1[c];
+        n2 += (float)q2[c] * q2[c];
+        dot += (float)q1[c] * q2[c];
+    }
+    if (n1 == 0 || n2 == 0) {
+        return 0;
+    }
+    n1 = 1 / sqrtf(n1);
+    // q and -q are the same rotation
+    n2 = (dot < 0 ? -1 : 1) / sqrtf(n2);
+    float d = 0;
+    for (uint8_t c = 0; c < 4; c++) {
+        float diff = q1[c] * n1 - q2[c] * n2;
+        d += diff * diff;
+    }
+    d = sqrtf(d) / 2;
+    return 4 * asinf(d < 1 ? d : 1) * (180 / (float)M_PI);
+}
+
+size_t QuatCodec::packRecord(const mpu_record_t &record, uint8_t bits, uint8_t *out) {
+    int16_t q[4];
+    memcpy(out, &record.tMs, 4);
+    memcpy(q, record.q, sizeof(q));
+    size_t size = 4 + encode(q, bits, out + 4);
+    memcpy(out + size, record.g, sizeof(record.g));
+    memcpy(out + size + sizeof(record.g), record.a, sizeof(record.a));
+    return size + sizeof(record.g) + sizeof(record.a);
+}
+
+void QuatCodec::unpackRecord(const uint8_t *in, uint8_t bits, mpu_record_t &record) {
+    int16_t q[4];
+    memcpy(&record.tMs, in, 4);
+    decode(in + 4, bits, q);
+    memcpy(record.q, q, sizeof(q));
+    size_t offset = 4 + bytes(bits);
+    memcpy(record.g, in + offset, sizeof(record.g));
+    memcpy(record.a, in + offset + sizeof(record.g), sizeof(record.a));
+}
@@ -1,32 +1,33 @@
 #include "SDUtil.h"
-
-// global static pointer used to ensure a single instance of the class.
-SDUtil* SDUtil::pInstance = nullptr;
-
-
+#include "MemoryBudget.h"
+#include "TextWriter.h"
+#include "Trace.h"
 
 /*****************************************************************
-This function is called to create an instance of the class.
+This function is called to get the instance of the class.
 Calling the constructor publicly is not allowed. The constructor
-is private and is only called by this getInstance() function.
+is private and is only called by this getInstance() function,
+which builds the instance in static storage on first use.
 *****************************************************************/
 SDUtil* SDUtil::getInstance() {
-    if (!pInstance)   // Only allow one instance of class to be generated.
-        pInstance = new SDUtil();
-    return pInstance;
+    static SDUtil instance;
+    return &instance;
 }
 
 SDUtil::SDUtil() {
-    
+    static_assert(sizeof(SDUtil) <= MEM_SD_UTIL, "SDUtil exceeds its memory budget");
+    static_assert(sizeof(logs) <= MEM_LOG_STREAMS, "log buffers exceed their memory budget");
 }
 
 void SDUtil::setup() {
+    if (mounted) {
+        return;
+    }
     // init SD card SPI interface
-    hspi = new SPIClass(HSPI);
     pinMode(SS_PIN, OUTPUT); //HSPI SS
     // SCLK = 25, MISO = 32, MOSI = 13, SS = 33
-    hspi->begin(SCLK_PIN, MISO_PIN, MOSI_PIN, SS_PIN); //SCLK, MISO, MOSI, SS
-    if (!SD.begin(SS_PIN, *hspi)) {
+    hspi.begin(SCLK_PIN, MISO_PIN, MOSI_PIN, SS_PIN); //SCLK, MISO, MOSI, SS
+    if (!SD.begin(SS_PIN, hspi)) {
         Serial.println("Card Mount Failed");
         return;
     }
@@ -37,6 +38,133 @@ void SDUtil::setup() {
         Serial.println("No SD card attached");
         return;
     }
+    mounted = true;
+}
+
+void SDUtil::loop() {
+    for (uint8_t i = 0; i < MAX_LOG_STREAMS; i++) {
+        logs[i].loop();
+    }
+}
+
+int8_t SDUtil::freeSlot() {
+    if (!mounted) {
+        Serial.println("Card not mounted, log not opened");
+        return -1;
+    }
+    for (uint8_t i = 0; i < MAX_LOG_STREAMS; i++) {
+        if (!logs[i].isOpen() && !segmentedLogs[i].isOpen()) {
+            return i;
+        }
+    }
+    Serial.println("No free log stream");
+    return -1;
+}
+
+LogStream* SDUtil::openLog(const char *path) {
+    int8_t i = freeSlot();
+    if (i < 0 || !logFiles[i].open(SD, path)) {
+        return nullptr;
+    }
+    return logs[i].open(&logFiles[i]) ? &logs[i] : nullptr;
+}
+
+// log rotated into <base>-NNNN<ext> segments indexed in <base>.idx, each
+// segment is preallocated to maxBytes and the index to INDEX_CAPACITY
+SegmentedLog* SDUtil::openSegmentedLog(const char *base, const char *ext,
+                                       uint32_t maxBytes, uint32_t maxSpanS) {
+    int8_t i = freeSlot();
+    if (i < 0) {
+        return nullptr;
+    }
+    segmentFiles[i].setCapacity(maxBytes);
+    indexFiles[i].setCapacity(INDEX_CAPACITY);
+    if (!segmentedLogs[i].open(&logs[i], &segmentFiles[i], &indexFiles[i], &store,
+                               base, ext, maxBytes, maxSpanS)) {
+        return nullptr;
+    }
+    return &segmentedLogs[i];
+}
+
+// session in the raw log partition for captures faster than FAT appends,
+// continued if the last session has the same startTS
+LogStream* SDUtil::openRawLog(uint32_t startTS) {
+    int8_t i = freeSlot();
+    if (i < 0) {
+        return nullptr;
+    }
+    BlockSink *sink = openRawSink(startTS);
+    return sink && logs[i].open(sink) ? &logs[i] : nullptr;
+}
+
+// the same session without a LogStream, writes go straight to the card
+BlockSink* SDUtil::openRawSink(uint32_t startTS) {
+    if (!mounted) {
+        return nullptr;
+    }
+    if (!rawReady) {
+        rawReady = rawSink.begin(&hspi, SS_PIN);
+    }
+    if (!rawReady || !rawSink.open(startTS)) {
+        return nullptr;
+    }
+    return &rawSink;
+}
+
+// parts of the segments of a log that hold records between from and to
+uint16_t SDUtil::findLogRange(const char *base, uint32_t from, uint32_t to,
+                              log_range_t *ranges, uint16_t maxRanges) {
+    return LogIndex::find(store, base, from, to, ranges, maxRanges);
+}
+
+void SDUtil::closeLog(LogStream *log) {
+    if (log) {
+        log->close();
+    }
+}
+
+// must be called before deep sleep, buffered records are lost otherwise
+void SDUtil::flushLogs() {
+    for (uint8_t i = 0; i < MAX_LOG_STREAMS; i++) {
+        if (segmentedLogs[i].isOpen()) {
+            segmentedLogs[i].flush();
+        } else {
+            logs[i].flush();
+        }
+    }
+}
+
+// truncates the segments left open by the previous run to their committed
+// length, call after a power-on before any log is opened
+void SDUtil::recoverLogs() {
+    if (!mounted) {
+        return;
+    }
+    File root = SD.open("/");
+    if (!root || !root.isDirectory()) {
+        return;
+    }
+    char path[SDPreallocatedSink::MAX_PATH + 4];
+    File file = root.openNextFile();
+    while (file) {
+        bool isFile = !file.isDirectory();
+        TextWriter(path, sizeof(path)).str(file.path());
+        file.close();
+        if (isFile) {
+            SDPreallocatedSink::recover(path);
+        }
+        file = root.openNextFile();
+    }
+}
+
+// ms until loop() has buffered records to flush, UINT32_MAX if none
+uint32_t SDUtil::untilFlush() {
+    uint32_t next = UINT32_MAX;
+    for (uint8_t i = 0; i < MAX_LOG_STREAMS; i++) {
+        uint32_t left = logs[i].untilFlush();
+        next = left < next ? left : next;
+    }
+    return next;
 }
 
 void SDUtil::listDir(fs::FS &fs, const char *dirname, uint8_t levels) {
@@ -203,5 +331,22 @@ void SDUtil::testFileIO(fs::FS &fs, const char *path) {
 }
 
 void SDUtil::appendFile(const char *path, const char *message) {
+    TRACE_SCOPE(TRACE_SD_APPEND);
     appendFile(SD, path, message);
-}
\ No newline at end of file
+}
+
+// replaces path with a small binary record
+bool SDUtil::writeData(const char *path, const void *data, size_t len) {
+    File file = SD.open(path, FILE_WRITE);
+    if (!file) {
+        return false;
+    }
+    bool ok = file.write((const uint8_t *)data, len) == len;
+    file.close();
+    return ok;
+}
+
+// false unless path holds at least len bytes
+bool SDUtil::readData(const char *path, void *data, size_t len) {
+    return store.read(path, 0, (uint8_t *)data, len) == len;
+}
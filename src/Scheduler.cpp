@@ -0,0 +1,50 @@
+#include "Scheduler.h"
+
+int8_t Scheduler::every(uint32_t periodMs, scheduler_job_t job, void *arg, uint32_t nowMs) {
+    if (count == MAX_JOBS || periodMs == 0) {
+        return -1;
+    }
+    jobs[count] = { job, arg, periodMs, nowMs + periodMs };
+    return count++;
+}
+
+void Scheduler::setPeriod(int8_t id, uint32_t periodMs, uint32_t nowMs) {
+    if (id < 0 || id >= count || periodMs == 0) {
+        return;
+    }
+    entry_t &e = jobs[id];
+    e.periodMs = periodMs;
+    if ((int32_t)(e.nextMs - (nowMs + periodMs)) > 0) {
+        e.nextMs = nowMs + periodMs;
+    }
+}
+
+uint32_t Scheduler::run(uint32_t nowMs) {
+    for (uint8_t i = 0; i < count; i++) {
+        entry_t &e = jobs[i];
+        if ((int32_t)(nowMs - e.nextMs) < 0) {
+            continue;
+        }
+        e.job(e.arg);
+        e.nextMs += e.periodMs;
+        // periods missed entirely (a long stall) are skipped, not replayed
+        if ((int32_t)(nowMs - e.nextMs) >= 0) {
+            e.nextMs += ((nowMs - e.nextMs) / e.periodMs + 1) * e.periodMs;
+        }
+    }
+    return untilNext(nowMs);
+}
+
+uint32_t Scheduler::untilNext(uint32_t nowMs) {
+    uint32_t next = UINT32_MAX;
+    for (uint8_t i = 0; i < count; i++) {
+        int32_t left = (int32_t)(jobs[i].nextMs - nowMs);
+        if (left <= 0) {
+            return 0;
+        }
+        if ((uint32_t)left < next) {
+            next = left;
+        }
+    }
+    return next;
+}
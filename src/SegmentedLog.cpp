@@ -0,0 +1,278 @@
+#include "SegmentedLog.h"
+#include <stddef.h>
+#include <string.h>
+#include "CRC32.h"
+#include "TextWriter.h"
+
+static uint32_t entryCRC(const log_index_entry_t &entry) {
+    return CRC32::compute((const uint8_t *)&entry, offsetof(log_index_entry_t, crc));
+}
+
+void SegmentedLog::segmentPath(const char *base, const char *ext, uint16_t segment, char *path, size_t size) {
+    TextWriter(path, size).str(base).put('-').u32(segment, 4).str(ext);
+}
+
+void SegmentedLog::indexPath(const char *base, char *path, size_t size) {
+    TextWriter(path, size).str(base).str(".idx");
+}
+
+bool SegmentedLog::isValid(const log_index_entry_t &entry) {
+    return entry.crc == entryCRC(entry);
+}
+
+bool SegmentedLog::open(LogStream *log, FileSink *data, FileSink *index, FileStore *store,
+                        const char *base, const char *ext, uint32_t maxBytes, uint32_t maxSpanS) {
+    char path[MAX_PATH];
+    TextWriter(this->base, sizeof(this->base)).str(base);
+    TextWriter(this->ext, sizeof(this->ext)).str(ext);
+    indexPath(base, path, sizeof(path));
+    // a reboot continues the last segment from its latest checkpoint, or
+    // starts the next one if it was closed
+    segmentNumber = 0;
+    resumed = false;
+    if (!index->open(path)) {
+        return false;
+    }
+    uint32_t indexSize = index->size();
+    log_index_entry_t last;
+    if (lastEntry(store, path, indexSize, last)) {
+        segmentNumber = last.segment;
+        if (last.type == LOG_INDEX_CHECKPOINT) {
+            resumed = true;
+            firstTs = last.firstTs;
+            lastTs = last.ts;
+            records = last.records;
+            lastCheckpoint = last.offset;
+        } else {
+            segmentNumber++;
+        }
+    }
+    // pads an entry torn by a power failure, appending after it would
+    // misalign every later entry
+    uint8_t torn = indexSize % sizeof(log_index_entry_t);
+    if (torn) {
+        uint8_t padding[sizeof(log_index_entry_t)] = {};
+        index->write(padding, sizeof(padding) - torn);
+    }
+    this->log = log;
+    this->data = data;
+    this->index = index;
+    this->maxBytes = maxBytes;
+    this->maxSpanS = maxSpanS;
+    headerSize = 0;
+    segmentOpen = false;
+    opened = true;
+    return true;
+}
+
+// latest entry that passes its CRC among the first size bytes of the index
+bool SegmentedLog::lastEntry(FileStore *store, const char *path, uint32_t size, log_index_entry_t &entry) {
+    log_index_entry_t entries[16];
+    const uint32_t chunk = sizeof(entries) / sizeof(entries[0]);
+    uint32_t end = size / sizeof(log_index_entry_t);
+    while (end) {
+        uint32_t start = end > chunk ? end - chunk : 0;
+        size_t bytes = (end - start) * sizeof(log_index_entry_t);
+        if (store->read(path, start * sizeof(log_index_entry_t), (uint8_t *)entries, bytes) != bytes) {
+            return false;
+        }
+        for (uint32_t i = end - start; i-- > 0;) {
+            if (isValid(entries[i])) {
+                entry = entries[i];
+                return true;
+            }
+        }
+        end = start;
+    }
+    return false;
+}
+
+void SegmentedLog::setHeader(const void *header, size_t len) {
+    headerSize = len < MAX_HEADER ? len : MAX_HEADER;
+    memcpy(this->header, header, headerSize);
+}
+
+size_t SegmentedLog::write(uint32_t ts, const uint8_t *data, size_t len, uint16_t count) {
+    if (!opened) {
+        return 0;
+    }
+    if (!segmentOpen && !startSegment(ts)) {
+        return 0;
+    }
+    if (records && (log->size() + len > maxBytes || ts - firstTs >= maxSpanS)) {
+        endSegment();
+        segmentNumber++;
+        if (!startSegment(ts)) {
+            return 0;
+        }
+    }
+    if (log->size() >= nextCheckpoint) {
+        checkpoint(ts);
+    }
+    size_t written = log->write(data, len);
+    records += count;
+    lastTs = ts;
+    return written;
+}
+
+size_t SegmentedLog::print(uint32_t ts, const char *message) {
+    return write(ts, (const uint8_t *)message, strlen(message));
+}
+
+// writes out buffered records and checkpoints the end of the segment, so
+// it is continued from here after deep sleep
+bool SegmentedLog::flush() {
+    if (!opened) {
+        return false;
+    }
+    bool ok = true;
+    if (segmentOpen) {
+        ok = log->flush();
+        if (log->size() != lastCheckpoint) {
+            checkpoint(lastTs);
+        }
+    }
+    return index->sync() && ok;
+}
+
+void SegmentedLog::close() {
+    if (!opened) {
+        return;
+    }
+    if (segmentOpen) {
+        endSegment();
+    }
+    index->close();
+    opened = false;
+}
+
+bool SegmentedLog::startSegment(uint32_t ts) {
+    char path[MAX_PATH];
+    segmentPath(base, ext, segmentNumber, path, sizeof(path));
+    if (!data->open(path) || !log->open(data)) {
+        return false;
+    }
+    segmentOpen = true;
+    if (resumed) {
+        resumed = false;
+        nextCheckpoint = lastCheckpoint + CHECKPOINT_BYTES;
+        return true;
+    }
+    if (log->size() == 0 && headerSize) {
+        log->write(header, headerSize);
+    }
+    firstTs = ts;
+    lastTs = ts;
+    records = 0;
+    nextCheckpoint = 0;
+    return true;
+}
+
+void SegmentedLog::endSegment() {
+    uint32_t size = log->size();
+    log->close();
+    // the last checkpoint bounds the segment should its segment entry be lost
+    if (size != lastCheckpoint) {
+        writeIndex(LOG_INDEX_CHECKPOINT, lastTs, size);
+    }
+    writeIndex(LOG_INDEX_SEGMENT, lastTs, size);
+    index->sync();
+    segmentOpen = false;
+}
+
+void SegmentedLog::checkpoint(uint32_t ts) {
+    uint32_t offset = log->size();
+    writeIndex(LOG_INDEX_CHECKPOINT, ts, offset);
+    lastCheckpoint = offset;
+    nextCheckpoint = offset + CHECKPOINT_BYTES;
+}
+
+void SegmentedLog::writeIndex(uint8_t type, uint32_t ts, uint32_t offset) {
+    log_index_entry_t entry = {};
+    entry.type = type;
+    entry.segment = segmentNumber;
+    entry.ts = ts;
+    entry.firstTs = firstTs;
+    entry.records = records;
+    entry.offset = offset;
+    entry.crc = entryCRC(entry);
+    index->write((const uint8_t *)&entry, sizeof(entry));
+}
+
+uint16_t LogIndex::find(FileStore &store, const char *base, uint32_t from, uint32_t to,
+                        log_range_t *ranges, uint16_t maxRanges) {
+    char path[SegmentedLog::MAX_PATH];
+    SegmentedLog::indexPath(base, path, sizeof(path));
+    // a preallocated index is only read up to its committed length
+    int32_t size = store.size(path);
+    if (size < 0) {
+        return 0;
+    }
+    log_index_entry_t entries[16];
+    uint32_t offset = 0;
+    uint16_t found = 0;
+    // state of the segment being scanned
+    bool inSegment = false;
+    uint16_t segment = 0;
+    uint32_t segmentFirst = 0;
+    // timestamp of the latest checkpoint, the records end there
+    uint32_t segmentLast = 0;
+    log_range_t range = {};
+    bool endKnown = false;
+    for (;;) {
+        size_t len = (uint32_t)size - offset < sizeof(entries) ? (uint32_t)size - offset : sizeof(entries);
+        size_t read = store.read(path, offset, (uint8_t *)entries, len);
+        size_t count = read / sizeof(log_index_entry_t);
+        bool last = count < sizeof(entries) / sizeof(entries[0]);
+        for (size_t i = 0; i < count && found < maxRanges; i++) {
+            const log_index_entry_t &e = entries[i];
+            if (!SegmentedLog::isValid(e)) {
+                continue;
+            }
+            if (!inSegment || e.segment != segment) {
+                // a segment that lost its segment entry ends at its last
+                // checkpoint
+                if (inSegment && segmentFirst <= to && segmentLast >= from) {
+                    ranges[found++] = range;
+                    if (found == maxRanges) {
+                        break;
+                    }
+                }
+                inSegment = true;
+                segment = e.segment;
+                segmentFirst = e.firstTs;
+                segmentLast = e.firstTs;
+                range.segment = segment;
+                // from the start checkpoint, before any record, or from the
+                // top of the file when it failed its CRC
+                range.offset = e.type == LOG_INDEX_CHECKPOINT && e.records == 0 ? e.offset : 0;
+                range.end = 0;
+                endKnown = false;
+            }
+            if (e.type == LOG_INDEX_CHECKPOINT) {
+                segmentLast = e.ts;
+                if (e.ts < from) {
+                    range.offset = e.offset;
+                } else if (e.ts > to && !endKnown) {
+                    range.end = e.offset;
+                    endKnown = true;
+                }
+            } else if (e.type == LOG_INDEX_SEGMENT) {
+                if (e.firstTs <= to && e.ts >= from) {
+                    ranges[found++] = range;
+                }
+                inSegment = false;
+            }
+        }
+        offset += count * sizeof(log_index_entry_t);
+        if (last || found == maxRanges) {
+            break;
+        }
+    }
+    // the segment still being written, records may follow its last
+    // checkpoint
+    if (inSegment && found < maxRanges && segmentFirst <= to) {
+        ranges[found++] = range;
+    }
+    return found;
+}
@@ -0,0 +1,119 @@
+#include "TextWriter.h"
+
+static const uint32_t POW10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+static const uint8_t MAX_DECIMALS = 9;
+
+TextWriter::TextWriter(char *buffer, size_t size) : buffer(buffer), size(size) {
+    if (size) {
+        buffer[0] = '\0';
+    } else {
+        overflow = true;
+    }
+}
+
+TextWriter& TextWriter::put(char c) {
+    if (used + 1 < size) {
+        buffer[used++] = c;
+        buffer[used] = '\0';
+    } else {
+        overflow = true;
+    }
+    return *this;
+}
+
+TextWriter& TextWriter::str(const char *s) {
+    while (*s && !overflow) {
+        put(*s++);
+    }
+    return *this;
+}
+
+// writes value in decimal, zero padded to minDigits
+TextWriter& TextWriter::digits(uint64_t value, uint8_t minDigits) {
+    char tmp[20];
+    uint8_t n = 0;
+    do {
+        tmp[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value && n < sizeof(tmp));
+    while (n < minDigits && n < sizeof(tmp)) {
+        tmp[n++] = '0';
+    }
+    while (n) {
+        put(tmp[--n]);
+    }
+    return *this;
+}
+
+TextWriter& TextWriter::u32(uint32_t value, uint8_t minDigits) {
+    return digits(value, minDigits);
+}
+
+TextWriter& TextWriter::i32(int32_t value) {
+    if (value < 0) {
+        put('-');
+        return digits(-(int64_t)value, 1);
+    }
+    return digits(value, 1);
+}
+
+TextWriter& TextWriter::fixed(int64_t value, uint8_t decimals) {
+    if (decimals > MAX_DECIMALS) {
+        decimals = MAX_DECIMALS;
+    }
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : value;
+    if (value < 0) {
+        put('-');
+    }
+    digits(magnitude / POW10[decimals], 1);
+    if (decimals) {
+        put('.');
+        digits(magnitude % POW10[decimals], decimals);
+    }
+    return *this;
+}
+
+TextWriter& TextWriter::q14(int16_t value, uint8_t decimals) {
+    if (decimals > MAX_DECIMALS) {
+        decimals = MAX_DECIMALS;
+    }
+    // exact halves round to even, matching printf("%.6f", value / 16384.0)
+    int64_t scaled = (int64_t)value * POW10[decimals];
+    uint64_t magnitude = scaled < 0 ? -scaled : scaled;
+    uint64_t rounded = magnitude >> 14;
+    uint32_t rest = magnitude & 0x3FFF;
+    if (rest > 0x2000 || (rest == 0x2000 && (rounded & 1))) {
+        rounded++;
+    }
+    // printf keeps the sign of a negative value that rounds to zero
+    if (scaled < 0 && rounded == 0) {
+        put('-');
+    }
+    return fixed(scaled < 0 ? -(int64_t)rounded : (int64_t)rounded, decimals);
+}
+
+TextWriter& TextWriter::fixedFloat(float value, uint8_t decimals) {
+    if (decimals > MAX_DECIMALS) {
+        decimals = MAX_DECIMALS;
+    }
+    if (value != value) {
+        return str("nan");
+    }
+    double scaled = (double)value * POW10[decimals];
+    if (scaled >= 9.2e18 || scaled <= -9.2e18) {
+        return str(value < 0 ? "-inf" : "inf");
+    }
+    // exact halves round to even, like q14()
+    double magnitude = scaled < 0 ? -scaled : scaled;
+    uint64_t rounded = (uint64_t)magnitude;
+    double rest = magnitude - rounded;
+    if (rest > 0.5 || (rest == 0.5 && (rounded & 1))) {
+        rounded++;
+    }
+    if (value < 0 && rounded == 0) {
+        put('-');
+    }
+    return fixed(value < 0 ? -(int64_t)rounded : (int64_t)rounded, decimals);
+}
@@ -0,0 +1,136 @@
+#include "Trace.h"
+
+#ifdef TRACE_ENABLED
+
+#include <stdio.h>
+#include <atomic>
+
+#ifdef ESP32
+#include <esp32-hal-cpu.h>
+#endif
+
+struct trace_stage_stats_t {
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> totalUs;
+    std::atomic<uint32_t> maxUs;
+    std::atomic<uint32_t> hist[Trace::HIST_BUCKETS];
+};
+
+struct trace_queue_stats_t {
+    std::atomic<uint32_t> depth;
+    std::atomic<uint32_t> maxDepth;
+    std::atomic<uint32_t> drops;
+};
+
+static const char *stageNames[TRACE_STAGES] = {
+    "gps_read", "gps_parse", "mpu_read", "sd_append", "sd_write", "lora_send", "lora_loop"
+};
+static const char *queueNames[TRACE_QUEUES] = {
+    "gps_ring", "mpu_ring", "mpu_fifo", "uplink"
+};
+
+static trace_stage_stats_t stages[TRACE_STAGES];
+static trace_queue_stats_t queues[TRACE_QUEUES];
+static trace_event_t events[Trace::EVENT_RING_SIZE];
+static std::atomic<uint32_t> eventHead{0};
+// cycle counter ticks per microsecond
+static uint32_t cyclesPerUs = 1;
+
+static void raiseMax(std::atomic<uint32_t> &max, uint32_t value) {
+    uint32_t current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+void Trace::begin() {
+#ifdef ESP32
+    cyclesPerUs = getCpuFrequencyMhz();
+#endif
+    reset();
+}
+
+// called from any task on either core, the counters are atomic and a slot
+// of the event ring may at worst be overwritten by a concurrent record
+void Trace::record(trace_stage_t stage, uint32_t start, uint32_t end) {
+    recordUs(stage, start, (end - start) / cyclesPerUs);
+}
+
+void Trace::recordUs(trace_stage_t stage, uint32_t start, uint32_t us) {
+    trace_stage_stats_t &s = stages[stage];
+    s.count.fetch_add(1, std::memory_order_relaxed);
+    s.totalUs.fetch_add(us, std::memory_order_relaxed);
+    raiseMax(s.maxUs, us);
+    uint8_t bucket = us ? 32 - __builtin_clz(us) : 0;
+    if (bucket >= HIST_BUCKETS) {
+        bucket = HIST_BUCKETS - 1;
+    }
+    s.hist[bucket].fetch_add(1, std::memory_order_relaxed);
+    trace_event_t &event = events[eventHead.fetch_add(1, std::memory_order_relaxed) % EVENT_RING_SIZE];
+    event.start = start;
+    event.us = us;
+    event.stage = stage;
+}
+
+void Trace::queue(trace_queue_t queue, uint32_t depth, uint32_t drops) {
+    trace_queue_stats_t &q = queues[queue];
+    q.depth.store(depth, std::memory_order_relaxed);
+    raiseMax(q.maxDepth, depth);
+    q.drops.store(drops, std::memory_order_relaxed);
+}
+
+void Trace::dump(trace_writer_t writer, void *arg, bool withEvents) {
+    char line[256];
+    for (uint8_t i = 0; i < TRACE_STAGES; i++) {
+        trace_stage_stats_t &s = stages[i];
+        int len = snprintf(line, sizeof(line), "{\"stage\":\"%s\",\"n\":%u,\"total_us\":%u,\"max_us\":%u,\"hist\":[",
+                           stageNames[i], (unsigned)s.count.load(), (unsigned)s.totalUs.load(),
+                           (unsigned)s.maxUs.load());
+        // trailing empty buckets are left out
+        uint8_t used = HIST_BUCKETS;
+        while (used && s.hist[used - 1].load() == 0) {
+            used--;
+        }
+        for (uint8_t b = 0; b < used && len < (int)sizeof(line) - 16; b++) {
+            len += snprintf(line + len, sizeof(line) - len, b ? ",%u" : "%u", (unsigned)s.hist[b].load());
+        }
+        snprintf(line + len, sizeof(line) - len, "]}\n");
+        writer(line, arg);
+    }
+    for (uint8_t i = 0; i < TRACE_QUEUES; i++) {
+        trace_queue_stats_t &q = queues[i];
+        snprintf(line, sizeof(line), "{\"queue\":\"%s\",\"depth\":%u,\"max\":%u,\"drops\":%u}\n",
+                 queueNames[i], (unsigned)q.depth.load(), (unsigned)q.maxDepth.load(),
+                 (unsigned)q.drops.load());
+        writer(line, arg);
+    }
+    if (!withEvents) {
+        return;
+    }
+    uint32_t head = eventHead.load();
+    uint32_t count = head < EVENT_RING_SIZE ? head : EVENT_RING_SIZE;
+    for (uint32_t i = head - count; i != head; i++) {
+        const trace_event_t &e = events[i % EVENT_RING_SIZE];
+        snprintf(line, sizeof(line), "{\"event\":\"%s\",\"start\":%u,\"us\":%u}\n",
+                 stageNames[e.stage], (unsigned)e.start, (unsigned)e.us);
+        writer(line, arg);
+    }
+}
+
+void Trace::reset() {
+    for (trace_stage_stats_t &s : stages) {
+        s.count = 0;
+        s.totalUs = 0;
+        s.maxUs = 0;
+        for (std::atomic<uint32_t> &b : s.hist) {
+            b = 0;
+        }
+    }
+    for (trace_queue_stats_t &q : queues) {
+        q.depth = 0;
+        q.maxDepth = 0;
+        q.drops = 0;
+    }
+    eventHead = 0;
+}
+
+#endif
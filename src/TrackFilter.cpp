@@ -0,0 +1,93 @@
+#include "TrackFilter.h"
+
+// metres per degree of latitude
+static const int32_t METRES_PER_DEGREE = 111320;
+
+void TrackFilter::configure(uint16_t toleranceM, uint32_t maxGapS) {
+    tolerance = (int64_t)toleranceM * 1000000 / METRES_PER_DEGREE;
+    if (toleranceM && !tolerance) {
+        tolerance = 1;
+    }
+    this->maxGapS = maxGapS;
+}
+
+int32_t TrackFilter::cosQ15(int32_t lat) {
+    // cos(d) ~ (180^2 - 4 d^2) / (180^2 + d^2), d in hundredths of a degree
+    int64_t d = lat / 10000;
+    int64_t d2 = d * d;
+    return (int32_t)((324000000 - 4 * d2) * 32768 / (324000000 + d2));
+}
+
+track_point_t TrackFilter::point(const gps_fix_t &fix) {
+    track_point_t p = { (uint32_t)fix.ts, fix.lat, fix.lng };
+    return p;
+}
+
+void TrackFilter::setAnchor(const track_point_t &point) {
+    anchor = point;
+    anchorCos = cosQ15(point.lat);
+    anchored = true;
+    held = 0;
+}
+
+bool TrackFilter::add(const gps_fix_t &fix, gps_fix_t &out) {
+    inputCount++;
+    track_point_t p = point(fix);
+    if (!tolerance || !anchored) {
+        setAnchor(p);
+        out = fix;
+        retainedCount++;
+        return true;
+    }
+    if (held == WINDOW || deviates(p)) {
+        // the newest held fix ends the segment, the new one starts a window
+        out = last;
+        setAnchor(window[held - 1]);
+        window[held++] = p;
+        last = fix;
+        retainedCount++;
+        return true;
+    }
+    if (maxGapS && p.ts - anchor.ts >= maxGapS) {
+        // the held fixes are within tolerance of the segment to this one
+        setAnchor(p);
+        out = fix;
+        retainedCount++;
+        return true;
+    }
+    window[held++] = p;
+    last = fix;
+    return false;
+}
+
+bool TrackFilter::flush(gps_fix_t &out) {
+    if (!held) {
+        return false;
+    }
+    out = last;
+    setAnchor(window[held - 1]);
+    retainedCount++;
+    return true;
+}
+
+// true if a held fix is further than the tolerance from its time-synchronized
+// position on the straight movement from the anchor to end
+bool TrackFilter::deviates(const track_point_t &end) const {
+    int64_t dt = end.ts - anchor.ts;
+    int64_t dLat = end.lat - anchor.lat;
+    int64_t dLng = end.lng - anchor.lng;
+    int64_t limit = (int64_t)tolerance * tolerance;
+    for (uint8_t i = 0; i < held; i++) {
+        const track_point_t &p = window[i];
+        int64_t t = p.ts - anchor.ts;
+        // fixes of the same second as end are compared to end itself
+        int64_t eLat = dt > 0 ? dLat * t / dt : dLat;
+        int64_t eLng = dt > 0 ? dLng * t / dt : dLng;
+        int64_t y = p.lat - anchor.lat - eLat;
+        int64_t x = (p.lng - anchor.lng - eLng) * anchorCos >> 15;
+        if (x * x + y * y > limit) {
+            return true;
+        }
+    }
+    return false;
+}
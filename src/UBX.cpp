@@ -0,0 +1,96 @@
+#include "UBX.h"
+#include <string.h>
+
+size_t ubxBuildFrame(uint8_t msgClass, uint8_t msgId, const uint8_t *payload,
+                     uint16_t len, uint8_t *out) {
+    out[0] = UBX_SYNC1;
+    out[1] = UBX_SYNC2;
+    out[2] = msgClass;
+    out[3] = msgId;
+    out[4] = len & 0xFF;
+    out[5] = len >> 8;
+    if (len) {
+        memcpy(out + 6, payload, len);
+    }
+    // 8-bit Fletcher checksum over class, id, length and payload
+    uint8_t ckA = 0, ckB = 0;
+    for (size_t i = 2; i < 6u + len; i++) {
+        ckA += out[i];
+        ckB += ckA;
+    }
+    out[6 + len] = ckA;
+    out[7 + len] = ckB;
+    return len + UBX_FRAME_OVERHEAD;
+}
+
+UBXParser::UBXParser() : state(SYNC1), frameClass(0), frameId(0), frameLength(0),
+                         received(0), ckA(0), ckB(0), badFrames(0) {
+}
+
+void UBXParser::checksum(uint8_t c) {
+    ckA += c;
+    ckB += ckA;
+}
+
+bool UBXParser::feed(uint8_t c) {
+    switch (state) {
+    case SYNC1:
+        if (c == UBX_SYNC1) {
+            state = SYNC2;
+        }
+        break;
+    case SYNC2:
+        state = c == UBX_SYNC2 ? CLASS : (c == UBX_SYNC1 ? SYNC2 : SYNC1);
+        break;
+    case CLASS:
+        ckA = ckB = 0;
+        checksum(c);
+        frameClass = c;
+        state = ID;
+        break;
+    case ID:
+        checksum(c);
+        frameId = c;
+        state = LENGTH1;
+        break;
+    case LENGTH1:
+        checksum(c);
+        frameLength = c;
+        state = LENGTH2;
+        break;
+    case LENGTH2:
+        checksum(c);
+        frameLength |= c << 8;
+        received = 0;
+        if (frameLength > MAX_PAYLOAD) {
+            // not a message we decode, look for the next frame
+            state = SYNC1;
+        } else {
+            state = frameLength ? PAYLOAD : CHECK_A;
+        }
+        break;
+    case PAYLOAD:
+        checksum(c);
+        buffer[received++] = c;
+        if (received == frameLength) {
+            state = CHECK_A;
+        }
+        break;
+    case CHECK_A:
+        if (c == ckA) {
+            state = CHECK_B;
+        } else {
+            badFrames++;
+            state = SYNC1;
+        }
+        break;
+    case CHECK_B:
+        state = SYNC1;
+        if (c == ckB) {
+            return true;
+        }
+        badFrames++;
+        break;
+    }
+    return false;
+}
@@ -0,0 +1,65 @@
+#include "UplinkQueue.h"
+
+bool UplinkQueue::push(const lora_fix_t &fix) {
+    bool kept = true;
+    if (queueCount == SIZE) {
+        droppedCount++;
+        if (pending == SIZE) {
+            // the whole queue is on air
+            return false;
+        }
+        // the oldest fix that is not part of the frame on air makes room
+        lora_fix_t oldest;
+        pop(oldest);
+        kept = false;
+    }
+    queue[(queueHead + queueCount) % SIZE] = fix;
+    queueCount++;
+    return kept;
+}
+
+uint8_t UplinkQueue::transmit(RadioSink &radio, uint8_t maxPayload, uint8_t port) {
+    if (pending || queueCount == 0) {
+        return 0;
+    }
+    uint8_t payload[255];
+    encoder.begin(payload, maxPayload, LORA_PAYLOAD_GPS);
+    uint8_t count = 0;
+    while (count < queueCount && encoder.addFix(queued(count))) {
+        count++;
+    }
+    if (count == 0 || !radio.send(payload, encoder.length(), port)) {
+        return 0;
+    }
+    pending = count;
+    return count;
+}
+
+void UplinkQueue::complete() {
+    if (pending) {
+        dequeue(pending);
+        pending = 0;
+    }
+}
+
+bool UplinkQueue::pop(lora_fix_t &fix) {
+    if (queueCount == pending) {
+        return false;
+    }
+    // the fixes on air stay at the head
+    fix = queued(pending);
+    for (uint8_t i = pending; i > 0; i--) {
+        queue[(queueHead + i) % SIZE] = queued(i - 1);
+    }
+    dequeue(1);
+    return true;
+}
+
+const lora_fix_t& UplinkQueue::queued(uint8_t i) const {
+    return queue[(queueHead + i) % SIZE];
+}
+
+void UplinkQueue::dequeue(uint8_t count) {
+    queueHead = (queueHead + count) % SIZE;
+    queueCount -= count;
+}
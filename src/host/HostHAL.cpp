@@ -0,0 +1,154 @@
+#include "HostHAL.h"
+#include <string.h>
+#include <chrono>
+
+static const auto bootTime = std::chrono::steady_clock::now();
+
+uint32_t halMillis() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - bootTime).count();
+}
+
+uint32_t halMicros() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - bootTime).count();
+}
+
+bool FileByteSource::open(const char *path) {
+    close();
+    file = fopen(path, "rb");
+    return file != nullptr;
+}
+
+void FileByteSource::close() {
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+size_t FileByteSource::read(uint8_t *buffer, size_t len) {
+    return file ? fread(buffer, 1, len, file) : 0;
+}
+
+size_t MemoryByteSource::read(uint8_t *buffer, size_t len) {
+    size_t left = this->len - pos;
+    if (len > left) {
+        len = left;
+    }
+    memcpy(buffer, data + pos, len);
+    pos += len;
+    return len;
+}
+
+bool FileBlockSink::open(const char *path) {
+    close();
+    file = fopen(path, "ab");
+    if (!file) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    fileSize = ftell(file);
+    return true;
+}
+
+size_t FileBlockSink::write(const uint8_t *data, size_t len) {
+    if (!file) {
+        return 0;
+    }
+    size_t written = fwrite(data, 1, len, file);
+    fileSize += written;
+    return written;
+}
+
+bool FileBlockSink::sync() {
+    return file && fflush(file) == 0;
+}
+
+size_t FileBlockSink::size() {
+    return fileSize;
+}
+
+bool FileBlockSink::isOpen() {
+    return file != nullptr;
+}
+
+void FileBlockSink::close() {
+    if (file) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+int32_t HostFileStore::size(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    int32_t size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+size_t HostFileStore::read(const char *path, uint32_t offset, uint8_t *buffer, size_t len) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+    size_t read = fseek(file, offset, SEEK_SET) == 0 ? fread(buffer, 1, len, file) : 0;
+    fclose(file);
+    return read;
+}
+
+size_t MemoryBlockSink::write(const uint8_t *data, size_t len) {
+    bytes.insert(bytes.end(), data, data + len);
+    writes++;
+    return len;
+}
+
+bool MemoryBlockSink::sync() {
+    syncs++;
+    return true;
+}
+
+void MemoryFifoSource::fill(const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (bytes.size() == capacity) {
+            overflow = true;
+            return;
+        }
+        bytes.push_back(data[i]);
+    }
+}
+
+uint16_t MemoryFifoSource::count() {
+    return bytes.size();
+}
+
+bool MemoryFifoSource::read(uint8_t *buffer, uint16_t len) {
+    if (len > bytes.size()) {
+        return false;
+    }
+    memcpy(buffer, bytes.data(), len);
+    bytes.erase(bytes.begin(), bytes.begin() + len);
+    return true;
+}
+
+bool MemoryFifoSource::overflowed() {
+    bool flag = overflow;
+    overflow = false;
+    return flag;
+}
+
+void MemoryFifoSource::reset() {
+    bytes.clear();
+}
+
+bool MemoryRadioSink::send(const uint8_t *data, size_t len, uint8_t port) {
+    if (busy) {
+        return false;
+    }
+    frames.push_back({ port, std::vector<uint8_t>(data, data + len) });
+    return true;
+}
@@ -0,0 +1,95 @@
+#ifndef __HOSTHAL_H__
+#define __HOSTHAL_H__
+
+#include <stdio.h>
+#include <vector>
+#include "HAL.h"
+
+// HAL.h interfaces backed by files and memory, for the native build
+
+// bytes read from a capture file
+class FileByteSource : public ByteSource {
+    public:
+        bool open(const char *path);
+        void close();
+        size_t read(uint8_t *buffer, size_t len) override;
+        ~FileByteSource() { close(); }
+    private:
+        FILE *file = nullptr;
+};
+
+// bytes replayed from memory
+class MemoryByteSource : public ByteSource {
+    public:
+        MemoryByteSource(const uint8_t *data, size_t len) : data(data), len(len) {}
+        size_t read(uint8_t *buffer, size_t len) override;
+    private:
+        const uint8_t *data;
+        size_t len;
+        size_t pos = 0;
+};
+
+// host file opened for appending
+class FileBlockSink : public FileSink {
+    public:
+        bool open(const char *path) override;
+        size_t write(const uint8_t *data, size_t len) override;
+        bool sync() override;
+        size_t size() override;
+        bool isOpen() override;
+        void close() override;
+        ~FileBlockSink() { close(); }
+    private:
+        FILE *file = nullptr;
+        size_t fileSize = 0;
+};
+
+// files on the host disk
+class HostFileStore : public FileStore {
+    public:
+        int32_t size(const char *path) override;
+        size_t read(const char *path, uint32_t offset, uint8_t *buffer, size_t len) override;
+};
+
+// growing buffer, also counts writes and syncs
+class MemoryBlockSink : public BlockSink {
+    public:
+        size_t write(const uint8_t *data, size_t len) override;
+        bool sync() override;
+        size_t size() override { return bytes.size(); }
+        bool isOpen() override { return true; }
+        void close() override {}
+        std::vector<uint8_t> bytes;
+        uint32_t writes = 0;
+        uint32_t syncs = 0;
+};
+
+// sensor FIFO filled by the caller
+class MemoryFifoSource : public FifoSource {
+    public:
+        // appends len bytes, setting the overflow flag past capacity
+        void fill(const uint8_t *data, size_t len);
+        uint16_t count() override;
+        bool read(uint8_t *buffer, uint16_t len) override;
+        bool overflowed() override;
+        void reset() override;
+        size_t capacity = 1024;
+    private:
+        std::vector<uint8_t> bytes;
+        bool overflow = false;
+};
+
+// keeps every frame sent
+class MemoryRadioSink : public RadioSink {
+    public:
+        struct Frame {
+            uint8_t port;
+            std::vector<uint8_t> data;
+        };
+        bool send(const uint8_t *data, size_t len, uint8_t port) override;
+        std::vector<Frame> frames;
+        // send() fails while busy, like LMIC with a frame pending
+        bool busy = false;
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef __WPROGRAM_H__
+#define __WPROGRAM_H__
+
+// Arduino definitions TinyGPSPlus relies on, for the native build
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "HAL.h"
+
+typedef uint8_t byte;
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+#define TWO_PI 6.283185307179586476925286766559
+#define radians(deg) ((deg) * (PI / 180.0))
+#define degrees(rad) ((rad) * (180.0 / PI))
+#define sq(x) ((x) * (x))
+
+inline unsigned long millis() {
+    return halMillis();
+}
+
+#endif
@@ -0,0 +1,342 @@
+// Native replay of the logging pipeline. A GPS capture (NMEA or UBX) and
+// an optional raw DMP FIFO dump go through the same parser, batching, log
+// and uplink code as on the device, with files standing in for the UART,
+// the SD card and the radio:
+//
+//   program [-u] [-r] [-q bits] [-s bytes] [-t metres] [-m fifo.raw] capture.nmea outdir
+//
+// writes the segmented logs outdir/gps-NNNN.txt and outdir/mpu-NNNN.bin
+// (block compressed, version 1 with -r, or packed with smallest-three
+// quaternions of the given bits with -q) with their .idx files, rotating
+// segments at the given size, and prints the uplink frames and the motion
+// feature windows. With -t only
+// the fixes the track filter retains at that tolerance are logged and sent.
+//
+//   program range base from to
+//
+// prints the segment byte ranges of log base (e.g. outdir/gps) holding the
+// records from epoch second from to second to.
+//
+//   program quat
+//
+// encodes random orientations with QuatCodec at every supported width and
+// prints the worst rotation error against the documented bound.
+//
+//   program bench [dir]
+//
+// runs the benchmark suite and prints one JSON line per benchmark, the
+// storage ones appending to dir/bench.bin (the current directory by default).
+
+// the unit tests (test/) bring their own main() and link the rest of the
+// native build
+#ifndef PIO_UNIT_TESTING
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include "HostHAL.h"
+#include "BenchSuite.h"
+#include "GPSParser.h"
+#include "LogStream.h"
+#include "MPUBatch.h"
+#include "MPUCompressor.h"
+#include "MotionFeatures.h"
+#include "QuatCodec.h"
+#include "SegmentedLog.h"
+#include "TrackFilter.h"
+#include "UplinkQueue.h"
+
+// EU868 DR0-DR2 payload limit
+static const uint8_t MAX_PAYLOAD = 51;
+static const uint8_t PORT_GPS = 2;
+static const uint32_t SEGMENT_SPAN_S = 86400;
+static const uint32_t TRACK_MAX_GAP_S = 300;
+
+// segmented log in host files, as SDUtil sets it up on the card
+struct HostLog {
+    FileBlockSink data;
+    FileBlockSink index;
+    HostFileStore store;
+    LogStream stream;
+    SegmentedLog log;
+
+    bool open(const std::string &base, const char *ext, uint32_t maxBytes) {
+        return log.open(&stream, &data, &index, &store, base.c_str(), ext, maxBytes, SEGMENT_SPAN_S);
+    }
+};
+
+static void printFrame(const MemoryRadioSink::Frame &frame) {
+    printf("uplink port %u:", frame.port);
+    for (uint8_t b : frame.data) {
+        printf(" %02x", b);
+    }
+    printf("\n");
+}
+
+static void storeFix(const gps_fix_t &fix, SegmentedLog &log, UplinkQueue &uplinks,
+                     MemoryRadioSink &radio) {
+    char line[48];
+    snprintf(line, sizeof(line), "%lu;%.6f;%.6f\n", (unsigned long)fix.ts,
+             fix.lat / 1e6, fix.lng / 1e6);
+    log.print(fix.ts, line);
+    lora_fix_t uplink = { (uint32_t)fix.ts, fix.lat, fix.lng };
+    uplinks.push(uplink);
+    // no duty cycle here, full frames go out at once
+    if (uplinks.frameFull(MAX_PAYLOAD) && uplinks.transmit(radio, MAX_PAYLOAD, PORT_GPS)) {
+        uplinks.complete();
+    }
+}
+
+static size_t replayGPS(const char *path, bool ubx, TrackFilter &track, SegmentedLog &log,
+                        UplinkQueue &uplinks, MemoryRadioSink &radio) {
+    FileByteSource source;
+    if (!source.open(path)) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 0;
+    }
+    GPSParser parser(ubx);
+    uint8_t buffer[64];
+    size_t read;
+    while ((read = source.read(buffer, sizeof(buffer))) > 0) {
+        for (size_t i = 0; i < read; i++) {
+            if (!parser.feed(buffer[i])) {
+                continue;
+            }
+            gps_fix_t retained;
+            if (track.add(parser.fix(), retained)) {
+                storeFix(retained, log, uplinks, radio);
+            }
+        }
+    }
+    gps_fix_t retained;
+    if (track.flush(retained)) {
+        storeFix(retained, log, uplinks, radio);
+    }
+    while (uplinks.count() && uplinks.transmit(radio, MAX_PAYLOAD, PORT_GPS)) {
+        uplinks.complete();
+    }
+    return parser.fixes();
+}
+
+static uint32_t replayMPU(const char *path, SegmentedLog &log, bool compressed, uint8_t quatBits) {
+    FileByteSource source;
+    if (!source.open(path)) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return 0;
+    }
+    mpu_log_header_t header = {};
+    header.magic = MPU_LOG_MAGIC;
+    if (quatBits) {
+        header.version = MPU_LOG_VERSION_PACKED;
+        header.recordSize = QuatCodec::recordSize(quatBits);
+        header.quatBits = quatBits;
+        compressed = false;
+    } else {
+        header.version = compressed ? MPU_LOG_VERSION_BLOCKS : MPU_LOG_VERSION;
+        header.recordSize = sizeof(mpu_record_t);
+    }
+    log.setHeader(&header, sizeof(header));
+    MPUBatch batch;
+    MotionFeatures *features = new MotionFeatures();
+    batch.setFeatures(features);
+    MPUCompressor *compressor = new MPUCompressor();
+    MemoryFifoSource fifo;
+    // one interrupt per DMP packet, as on the device
+    uint8_t packet[MPUBatch::MAX_PACKET_SIZE];
+    uint32_t ms = 0;
+    uint32_t records = 0;
+    uint32_t blockTS = 0;
+    mpu_record_t record;
+    while (source.read(packet, sizeof(packet)) == sizeof(packet)) {
+        fifo.fill(packet, sizeof(packet));
+        batch.drain(fifo, ms);
+        ms += MPUBatch::SAMPLE_PERIOD_MS;
+        while (batch.samples().pop(record)) {
+            if (quatBits) {
+                uint8_t packed[sizeof(record)];
+                size_t size = QuatCodec::packRecord(record, quatBits, packed);
+                log.write(record.tMs / 1000, packed, size);
+            } else if (!compressed) {
+                log.write(record.tMs / 1000, (const uint8_t *)&record, sizeof(record));
+            } else {
+                if (compressor->pending() == 0) {
+                    blockTS = record.tMs / 1000;
+                }
+                if (compressor->add(record)) {
+                    log.write(blockTS, compressor->block(), compressor->blockSize(),
+                              MPUCompressor::BLOCK_RECORDS);
+                }
+            }
+            records++;
+        }
+        motion_features_t window;
+        char line[MotionFeatures::LINE_SIZE];
+        while (features->windows().pop(window)) {
+            if (MotionFeatures::format(window, line, sizeof(line))) {
+                printf("motion %s", line);
+            }
+        }
+    }
+    uint8_t pending = compressor->pending();
+    if (compressed && compressor->finish()) {
+        log.write(blockTS, compressor->block(), compressor->blockSize(), pending);
+    }
+    delete compressor;
+    delete features;
+    return records;
+}
+
+// benchmark file on the host disk
+class FileBenchStorage : public BenchStorage {
+    public:
+        explicit FileBenchStorage(const std::string &dir) : path(dir + "/bench.bin") {}
+        BlockSink* open() override {
+            return file.open(path.c_str()) ? &file : nullptr;
+        }
+        void remove() override {
+            file.close();
+            ::remove(path.c_str());
+        }
+    private:
+        std::string path;
+        FileBlockSink file;
+};
+
+static void printLine(const char *line, void *arg) {
+    fputs(line, stdout);
+}
+
+static int bench(const char *dir) {
+    FileBenchStorage storage(dir);
+    Benchmark bench(printLine, nullptr);
+    bench.header("native");
+    runBenchmarks(bench, &storage);
+    return 0;
+}
+
+// random unit quaternions in Q14, reproducible
+static void randomQuat(uint32_t &seed, int16_t *q) {
+    float v[4];
+    float norm = 0;
+    for (uint8_t c = 0; c < 4; c++) {
+        seed = seed * 1664525 + 1013904223;
+        v[c] = (int32_t)seed / 2147483648.0f;
+        norm += v[c] * v[c];
+    }
+    norm = sqrtf(norm);
+    for (uint8_t c = 0; c < 4; c++) {
+        q[c] = (int16_t)lroundf(v[c] / norm * 16384);
+    }
+}
+
+static int quat() {
+    static const uint32_t SAMPLES = 1000000;
+    int failed = 0;
+    for (uint8_t bits = QuatCodec::MIN_BITS; bits <= QuatCodec::MAX_BITS; bits++) {
+        uint32_t seed = 1;
+        float worst = 0;
+        double sum = 0;
+        for (uint32_t i = 0; i < SAMPLES; i++) {
+            int16_t q[4], decoded[4];
+            uint8_t packed[8];
+            randomQuat(seed, q);
+            QuatCodec::encode(q, bits, packed);
+            QuatCodec::decode(packed, bits, decoded);
+            float error = QuatCodec::angleDeg(q, decoded);
+            worst = error > worst ? error : worst;
+            sum += error * error;
+        }
+        float bound = QuatCodec::maxErrorDeg(bits);
+        printf("bits %u, bytes %zu, bound %.4f deg, max %.4f deg, rms %.4f deg%s\n", bits,
+               QuatCodec::bytes(bits), bound, worst, sqrt(sum / SAMPLES),
+               worst > bound ? " OUT OF BOUND" : "");
+        failed |= worst > bound;
+    }
+    return failed;
+}
+
+static int range(const char *base, uint32_t from, uint32_t to) {
+    HostFileStore store;
+    log_range_t ranges[64];
+    uint16_t found = LogIndex::find(store, base, from, to, ranges, 64);
+    for (uint16_t i = 0; i < found; i++) {
+        char path[SegmentedLog::MAX_PATH];
+        SegmentedLog::segmentPath(base, "", ranges[i].segment, path, sizeof(path));
+        printf("%s %u %u\n", path, ranges[i].offset, ranges[i].end);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 2 && !strcmp(argv[1], "bench")) {
+        return bench(argc > 2 ? argv[2] : ".");
+    }
+    if (argc == 2 && !strcmp(argv[1], "quat")) {
+        return quat();
+    }
+    if (argc == 5 && !strcmp(argv[1], "range")) {
+        return range(argv[2], strtoul(argv[3], nullptr, 10), strtoul(argv[4], nullptr, 10));
+    }
+    bool ubx = false;
+    bool compressed = true;
+    uint8_t quatBits = 0;
+    uint32_t segmentBytes = 4 * 1024 * 1024;
+    const char *fifoPath = nullptr;
+    TrackFilter track = {};
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (!strcmp(argv[arg], "-u")) {
+            ubx = true;
+        } else if (!strcmp(argv[arg], "-r")) {
+            compressed = false;
+        } else if (!strcmp(argv[arg], "-q") && arg + 1 < argc) {
+            quatBits = strtoul(argv[++arg], nullptr, 10);
+            if (quatBits < QuatCodec::MIN_BITS || quatBits > QuatCodec::MAX_BITS) {
+                fprintf(stderr, "-q takes %u to %u bits\n", QuatCodec::MIN_BITS, QuatCodec::MAX_BITS);
+                return 1;
+            }
+        } else if (!strcmp(argv[arg], "-s") && arg + 1 < argc) {
+            segmentBytes = strtoul(argv[++arg], nullptr, 10);
+        } else if (!strcmp(argv[arg], "-t") && arg + 1 < argc) {
+            track.configure(strtoul(argv[++arg], nullptr, 10), TRACK_MAX_GAP_S);
+        } else if (!strcmp(argv[arg], "-m") && arg + 1 < argc) {
+            fifoPath = argv[++arg];
+        }
+    }
+    if (argc - arg != 2) {
+        fprintf(stderr, "usage: %s [-u] [-r] [-q bits] [-s bytes] [-t metres] [-m fifo.raw] capture outdir\n", argv[0]);
+        return 1;
+    }
+    std::string outdir = argv[arg + 1];
+
+    HostLog gpsLog;
+    if (!gpsLog.open(outdir + "/gps", ".txt", segmentBytes)) {
+        fprintf(stderr, "cannot create %s/gps.idx\n", outdir.c_str());
+        return 1;
+    }
+    UplinkQueue uplinks;
+    MemoryRadioSink radio;
+    size_t fixes = replayGPS(argv[arg], ubx, track, gpsLog.log, uplinks, radio);
+    gpsLog.log.close();
+    for (const MemoryRadioSink::Frame &frame : radio.frames) {
+        printFrame(frame);
+    }
+    printf("fixes %zu, retained %u, frames %zu, dropped %u\n", fixes, track.retained(),
+           radio.frames.size(), uplinks.dropped());
+
+    if (fifoPath) {
+        HostLog mpuLog;
+        if (!mpuLog.open(outdir + "/mpu", ".bin", segmentBytes)) {
+            fprintf(stderr, "cannot create %s/mpu.idx\n", outdir.c_str());
+            return 1;
+        }
+        uint32_t records = replayMPU(fifoPath, mpuLog.log, compressed, quatBits);
+        mpuLog.log.close();
+        printf("mpu records %u\n", records);
+    }
+    return 0;
+}
+
+#endif
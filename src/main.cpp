@@ -1,13 +1,21 @@
 #include <Arduino.h>
 
 #include <TinyGPS++.h>
-#include <TimeLib.h>
 #include <jled.h>
-#include <TimeAlarms.h>
 // #include <WiFi.h>
 #include "SDUtil.h"
-// #include "MPUUtil.h"
+#include "MPUUtil.h"
 #include "GPSUtil.h"
+#include "LoRaUtil.h"
+#include "PipelineUtil.h"
+#include "RTCRing.h"
+#include "BenchSuite.h"
+#include "TextWriter.h"
+#include "Scheduler.h"
+#include "MotionPolicy.h"
+#include "TrackFilter.h"
+#include "MemoryBudget.h"
+#include <sys/time.h>
 
 const uint8_t statusLED_PIN = 14;
 static const uint32_t uS_TO_mS_FACTOR = 1000; /* Conversion factor for micro seconds to seconds */
@@ -18,11 +26,13 @@ static const uint16_t TIME_TO_SLEEP = 1000;   /* Time ESP32 will go to sleep (in
 // SD card control object
 SDUtil *sd = SDUtil::getInstance();
 // MPU-6050 control object
-// MPUUtil *mpu = MPUUtil::getInstance();
+MPUUtil *mpu = MPUUtil::getInstance();
 // GPS control object
 GPSUtil *gps = GPSUtil::getInstance();
 // LoRa communication control object
 LoRaUtil *lora = LoRaUtil::getInstance();
+// acquisition/storage task pipeline
+PipelineUtil *pipeline = PipelineUtil::getInstance();
 // status LED configuration
 auto statusLED = JLed(statusLED_PIN);
 // tag for logging system info
@@ -31,109 +41,358 @@ static const char *tag = "juares";
 esp_reset_reason_t rstReason;
 // variable that stores the time stamp of system start
 RTC_DATA_ATTR time_t startTS = 0;
+// buffered GPS log, kept open while the system runs
+SegmentedLog *gpsLog = nullptr;
+// periodic jobs of the main loop
+Scheduler scheduler;
+int8_t gpsJob = -1;
+// GPS policy changes go to /<startTS>-policy.txt
+char policyPath[24];
 
 // application constants
 const uint16_t GPS_READ_PERIOD_S = 5;
+// slower GPS reads once the MPU reports zero motion, backup mode with a
+// heartbeat fix after GPS_BACKUP_AFTER_S without motion
+const uint16_t GPS_STATIONARY_PERIOD_S = 60;
+const uint16_t GPS_BACKUP_AFTER_S = 600;
+const uint16_t GPS_HEARTBEAT_PERIOD_S = 1800;
+// a heartbeat read gives up after this long without a fix
+const uint32_t GPS_HEARTBEAT_TIMEOUT_MS = 60000;
+// trajectory simplification: a fix is only logged and sent when the track
+// strays more than GPS_TRACK_TOLERANCE_M from a straight line, and at least
+// every GPS_TRACK_MAX_GAP_S
+const uint16_t GPS_TRACK_TOLERANCE_M = 10;
+const uint32_t GPS_TRACK_MAX_GAP_S = 300;
+// update period of the status LED while a pattern runs
+const uint32_t LED_UPDATE_MS = 10;
+// GPS log rotation, a day of fixes is about 600 KB
+const uint32_t GPS_SEGMENT_BYTES = 1024 * 1024;
+const uint32_t GPS_SEGMENT_SPAN_S = 24 * 3600;
+// NAV-PVT rate for the UBX GPS mode, 0 keeps the receiver on NMEA
+#ifndef GPS_UBX_RATE_HZ
+#define GPS_UBX_RATE_HZ 0
+#endif
 
-#if 0
-// sleep mode constants
-RTC_DATA_ATTR bool initialBoot = true;
-
+MotionPolicy gpsPolicy(GPS_READ_PERIOD_S * 1000UL, GPS_STATIONARY_PERIOD_S * 1000UL,
+                       GPS_BACKUP_AFTER_S * 1000UL, GPS_HEARTBEAT_PERIOD_S * 1000UL);
+// start of the heartbeat read that woke the receiver from backup
+uint32_t heartbeatStartMs = 0;
 
-const uint16_t MPU_READ_PERIOD_MS = 2000;
-const uint8_t NUM_SAMPLES = 100;
+#ifdef DUTY_CYCLE_MODE
+// deep sleep duty cycle: every wake takes one MPU sample (and a GPS fix
+// every GPS_READ_PERIOD_S) into RTC memory, the SD card is only mounted
+// once the buffers pass their watermark. The 100 Hz DMP stream is thus
+// decimated to one sample per TIME_TO_SLEEP, about 1 Hz; the FIFO would
+// overflow long before the next wake anyway.
+const uint16_t RTC_MPU_SAMPLES = 192;
+const uint16_t RTC_GPS_FIXES = 32;
+const uint16_t RTC_WATERMARK_PCT = 75;
+const uint16_t GPS_FIX_TIMEOUT_MS = 1500;
+// bound the time awake when the network does not answer: the join at
+// power-on, and a drain's frame (after a join if the session was lost);
+// fixes that were not sent wait in rtcUplinks for the next drain
+const uint32_t LORA_JOIN_TIMEOUT_MS = 60000;
+const uint32_t LORA_UPLINK_TIMEOUT_MS = 30000;
+const uint16_t RTC_UPLINK_FIXES = 32;
+const uint16_t GPS_WAKE_INTERVAL = GPS_READ_PERIOD_S * 1000 / TIME_TO_SLEEP;
+RTC_DATA_ATTR RTCRing<mpu_record_t, RTC_MPU_SAMPLES> rtcSamples;
+RTC_DATA_ATTR RTCRing<gps_fix_t, RTC_GPS_FIXES> rtcFixes;
+RTC_DATA_ATTR RTCRing<lora_fix_t, RTC_UPLINK_FIXES> rtcUplinks;
+RTC_DATA_ATTR uint32_t wakeCount = 0;
+// only the fixes it retains take RTC space
+RTC_DATA_ATTR TrackFilter rtcTrack;
+static_assert(sizeof(rtcSamples) <= MEM_RTC_MPU_SAMPLES, "RTC sample ring exceeds its budget");
+static_assert(sizeof(rtcFixes) <= MEM_RTC_GPS_FIXES, "RTC fix ring exceeds its budget");
+static_assert(sizeof(rtcUplinks) <= MEM_RTC_UPLINKS, "RTC uplink ring exceeds its budget");
+static_assert(sizeof(rtcTrack) <= MEM_RTC_TRACK, "RTC track filter exceeds its budget");
+static_assert(sizeof(startTS) + sizeof(wakeCount) <= MEM_RTC_STATE, "RTC state exceeds its budget");
+#endif
 
+// section bounds from the ESP-IDF linker script
+extern "C" uint8_t _data_start, _data_end, _bss_start, _bss_end;
+extern "C" uint8_t _rtc_data_start, _rtc_data_end, _rtc_bss_start, _rtc_bss_end;
 
-// application variables
-unsigned long time_now = 0;
-auto statusLED = JLed(statusLED_PIN);
-RTC_DATA_ATTR bool dmp_ready = false;  // set true if DMP init was successful
-uint8_t mpu_int_status;   // holds actual interrupt status byte from MPU
-uint8_t dev_status;      // return status after each device operation (0 = success, !0 = error)
-RTC_DATA_ATTR uint16_t packet_size;    // expected DMP packet size (default is 42 bytes)
-uint8_t fifo_buffer[64]; // FIFO storage buffer
+// static footprint against MemoryBudget.h and what the heap has left, the
+// singletons are built by the initialisers above
+void printMemoryReport() {
+  ESP_LOGI(tag, "Static memory: %u B data, %u B bss, %u/%u B RTC",
+           (unsigned)(&_data_end - &_data_start), (unsigned)(&_bss_end - &_bss_start),
+           (unsigned)(&_rtc_data_end - &_rtc_data_start + &_rtc_bss_end - &_rtc_bss_start),
+           (unsigned)MEM_RTC_LIMIT);
+  ESP_LOGI(tag, "Singletons: sd %u/%u, mpu %u/%u, gps %u/%u, lora %u/%u, pipeline %u/%u B",
+           (unsigned)sizeof(*sd), (unsigned)MEM_SD_UTIL, (unsigned)sizeof(*mpu), (unsigned)MEM_MPU_UTIL,
+           (unsigned)sizeof(*gps), (unsigned)MEM_GPS_UTIL, (unsigned)sizeof(*lora), (unsigned)MEM_LORA_UTIL,
+           (unsigned)sizeof(*pipeline), (unsigned)MEM_PIPELINE_UTIL);
+  ESP_LOGI(tag, "Heap: %u B free, %u B largest block",
+           (unsigned)ESP.getFreeHeap(), (unsigned)ESP.getMaxAllocHeap());
+}
 
-// ================================================================
-// ===               INTERRUPT DETECTION ROUTINE                ===
-// ================================================================
+#ifdef BENCHMARK_MODE
+// benchmark results go to the serial port and, one JSON line each, to
+// BENCH_REPORT on the card
+const char *BENCH_FILE = "/bench.bin";
+const char *BENCH_REPORT = "/bench.jsonl";
+// startTS of the raw log session the raw_write benchmarks write to
+const uint32_t BENCH_RAW_SESSION = 0;
 
-volatile bool mpu_interrupt = false;     // indicates whether MPU interrupt pin has gone high
+class SDBenchStorage : public BenchStorage {
+  public:
+    BlockSink* open() override {
+      return file.open(SD, BENCH_FILE) ? &file : nullptr;
+    }
+    void remove() override {
+      file.close();
+      SD.remove(BENCH_FILE);
+    }
+    BlockSink* openRaw() override {
+      return sd->openRawSink(BENCH_RAW_SESSION);
+    }
+  private:
+    SDFileSink file;
+};
 
-void dmpDataReady() {
-    mpu_interrupt = true;
+void printBenchLine(const char *line, void *arg) {
+  Serial.print(line);
+  sd->appendFile(BENCH_REPORT, line);
 }
 
+// runs the benchmark suite before anything else is started, never returns
+void runDeviceBenchmarks() {
+  SDBenchStorage storage;
+  Benchmark bench(printBenchLine, nullptr);
+
+  sd->setup();
+  bench.header("esp32");
+  runBenchmarks(bench, &storage);
+  ESP_LOGI(tag, "Benchmarks done.");
+  for (;;)
+    delay(1000);
+}
 #endif
 
-void readGPS() {
-  char strBuffer[50];
-  char filename[20];
+void readGPS(void *arg) {
+  // heartbeat read, the receiver goes back to backup after the fix
+  if (gps->inBackup()) {
+    gps->setBackup(false);
+    heartbeatStartMs = millis();
+  }
+  pipeline->requestGPSRead();
+}
+
+// written to the policy log by the storage task
+void logGPSPolicy() {
+  gps_policy_t policy = gpsPolicy.policy();
+
+  pipeline->logPolicy(time(nullptr), policy, gpsPolicy.gpsPeriodMs());
+  ESP_LOGI(tag, "GPS policy: %s", MotionPolicy::name(policy));
+}
+
+// follows the motion state reported by the MPU, see MotionPolicy
+void updateGPSPolicy(uint32_t storedFixes) {
+  uint32_t nowMs = millis();
+
+  if (gpsPolicy.update(mpu->isMoving(), nowMs)) {
+    scheduler.setPeriod(gpsJob, gpsPolicy.gpsPeriodMs(), nowMs);
+    if (gpsPolicy.gpsBackup()) {
+      pipeline->cancelGPSRead();
+      pipeline->flushTrack();
+    }
+    gps->setBackup(gpsPolicy.gpsBackup());
+    logGPSPolicy();
+  } else if (gpsPolicy.gpsBackup() && !gps->inBackup() &&
+             (storedFixes || nowMs - heartbeatStartMs >= GPS_HEARTBEAT_TIMEOUT_MS)) {
+    // heartbeat done, with or without a fix
+    pipeline->cancelGPSRead();
+    gps->setBackup(true);
+  }
+}
+
+void openLogs() {
+  char base[SegmentedLog::MAX_PATH];
+
+  TextWriter(base, sizeof(base)).put('/').u32(startTS).str("-gps");
+  gpsLog = sd->openSegmentedLog(base, ".txt", GPS_SEGMENT_BYTES, GPS_SEGMENT_SPAN_S);
+  TextWriter(policyPath, sizeof(policyPath)).put('/').u32(startTS).str("-policy.txt");
+  mpu->openLog(startTS);
+}
 
-  sprintf(filename, "/%lu-gps.txt", startTS);
-  gps->getLocation(strBuffer);
-  sd->appendFile(filename, strBuffer);
-  lora->do_send(strBuffer);
-  statusLED.Blink(250, 250).Repeat(2);
+void startLogs() {
+  openLogs();
+  pipeline->setLogs(gpsLog, mpu, policyPath);
+  logGPSPolicy();
 }
 
+#ifdef DUTY_CYCLE_MODE
+// moves the RTC buffers to the SD card
+void drainRTCBuffers() {
+  char strBuffer[GPSParser::FIX_LINE_SIZE];
+  gps_fix_t fix;
+  mpu_record_t record;
+
+  sd->setup();
+  // resumes the LoRaWAN session saved before sleeping, or joins again
+  lora->setup();
+  openLogs();
+  // fixes an earlier drain could not send go first
+  lora_fix_t uplink;
+  while (rtcUplinks.pop(uplink))
+    lora->queueFix(uplink);
+  while (rtcFixes.pop(fix)) {
+    if (gpsLog && GPSParser::formatFix(fix, strBuffer, sizeof(strBuffer)))
+      gpsLog->print(fix.ts, strBuffer);
+    uplink = { (uint32_t)fix.ts, fix.lat, fix.lng };
+    lora->queueFix(uplink);
+  }
+  while (rtcSamples.pop(record))
+    mpu->writeRecord(record);
+  mpu->flushLog();
+  sd->flushLogs();
+  gps_aid_t aid;
+  if (gps->getAid(aid))
+    sd->writeData(GPSUtil::AID_FILE, &aid, sizeof(aid));
+  ESP_LOGI(tag, "RTC buffers drained, %u samples lost", rtcSamples.overflows + rtcFixes.overflows);
+  // one frame per drain, the rest of the queue waits for the next one
+  lora->flush();
+  unsigned long start = millis();
+  while (lora->flushing() && millis() - start < LORA_UPLINK_TIMEOUT_MS)
+    lora->loop();
+  while (lora->takeFix(uplink))
+    rtcUplinks.push(uplink);
+  lora->saveSession();
+}
+
+// joins before the first deep sleep, so drains only send their frame
+void joinLoRa() {
+  unsigned long start = millis();
+  while (!lora->isIdle() && millis() - start < LORA_JOIN_TIMEOUT_MS)
+    lora->loop();
+  lora->saveSession();
+  ESP_LOGI(tag, "LoRaWAN join %s", lora->isIdle() ? "done" : "timed out");
+}
+
+// samples into RTC memory and goes back to deep sleep, never returns
+void dutyCycle() {
+  mpu_record_t record;
+  gps_fix_t fix;
+  struct timeval tv;
+
+  // nothing is sampled before the first fix sets the time
+  if (startTS && mpu->readSample(record)) {
+    gettimeofday(&tv, nullptr);
+    record.tMs = (tv.tv_sec - startTS) * 1000 + tv.tv_usec / 1000;
+    rtcSamples.push(record);
+  }
+  // the receiver keeps running through deep sleep, the UART driver and
+  // task are only brought up on the wakes that read it
+  bool readGPS = wakeCount++ % GPS_WAKE_INTERVAL == 0;
+  if (readGPS)
+    gps->setup(GPS_UBX_RATE_HZ);
+  if (readGPS && gps->waitFix(fix, GPS_FIX_TIMEOUT_MS)) {
+    if (!startTS) {
+      startTS = time(nullptr);
+      ESP_LOGI(tag, "GPS fixed after %u ms.", gps->ttffMs());
+    }
+    gps_fix_t retained;
+    rtcTrack.configure(GPS_TRACK_TOLERANCE_M, GPS_TRACK_MAX_GAP_S);
+    if (rtcTrack.add(fix, retained))
+      rtcFixes.push(retained);
+  }
+  if (rtcSamples.size() * 100 >= rtcSamples.capacity() * RTC_WATERMARK_PCT ||
+      rtcFixes.size() * 100 >= rtcFixes.capacity() * RTC_WATERMARK_PCT)
+    drainRTCBuffers();
+  esp_sleep_enable_timer_wakeup(TIME_TO_SLEEP * uS_TO_mS_FACTOR);
+  Serial.flush();
+  esp_deep_sleep_start();
+}
+#endif
+
 void setup()
 {
   rstReason = esp_reset_reason();
   Serial.begin(115200);
-  gps->setup();
+#ifdef TRACE_ENABLED
+  Trace::begin();
+#endif
+#ifdef BENCHMARK_MODE
+  runDeviceBenchmarks();
+#endif
+#ifdef DUTY_CYCLE_MODE
+  if (rstReason == ESP_RST_DEEPSLEEP)
+  {
+    // short wake: neither SD nor LoRa are brought up
+    mpu->wakeup();
+    dutyCycle();
+  }
+#endif
+  gps->setup(GPS_UBX_RATE_HZ);
   sd->setup();
   lora->setup();
-  // program periodical functions for GPS reading
-  Alarm.timerRepeat(GPS_READ_PERIOD_S, readGPS);   
   // configure the sleep timer for the system
   esp_sleep_enable_timer_wakeup(TIME_TO_SLEEP * uS_TO_mS_FACTOR);
   if (rstReason == ESP_RST_POWERON)
   {
-    // mpu->setup();
-    // signal that GPS is waiting to fix
-    ESP_LOGI(tag, "Waiting for GPS fix...");
-    statusLED.Blink(250, 250).Forever();
-    while (!gps->isFixed())
-    {
-      statusLED.Update();
-    };
-    ESP_LOGI(tag, "GPS fixed.");
-    // update system data from GPS
-    gps->updateSystemTime();
-    startTS = now();
-    ESP_LOGI("System first boot.");
+    // segments of the previous run are not reopened, drop their
+    // preallocated tails
+    sd->recoverLogs();
+    mpu->setup();
+    // the receiver may have lost its backup RAM along with the power
+    gps_aid_t aid;
+    if (sd->readData(GPSUtil::AID_FILE, &aid, sizeof(aid)) && GPSAid::valid(aid))
+      gps->sendAid(aid);
+    ESP_LOGI(tag, "System first boot.");
   }
   else
   {
-    // mpu->wakeup();
+    mpu->wakeup();
   }
-}
-
-void loop()
-{
-  Alarm.delay(1);
-  statusLED.Update();
-#if 0
-  if (!dmp_ready)
-    return;
-
-  // smartDelay(MPU_READ_PERIOD_MS);
-  // reads the MPU data
-  read_mpu();
-
-  // if buffer full
-  if (cur_sample >= (0.8 * NUM_SAMPLES))
+  printMemoryReport();
+#ifdef DUTY_CYCLE_MODE
+  if (rstReason == ESP_RST_POWERON)
+    joinLoRa();
+  dutyCycle();
+#else
+  pipeline->track().configure(GPS_TRACK_TOLERANCE_M, GPS_TRACK_MAX_GAP_S);
+  // the pipeline runs from boot, the logs are attached once the first fix
+  // has set the system time that names them
+  pipeline->setup(nullptr, nullptr);
+  // program periodical functions for GPS reading
+  gpsJob = scheduler.every(gpsPolicy.gpsPeriodMs(), readGPS, nullptr, millis());
+  if (startTS)
   {
-    ESP_LOGI(tag, "%d", cur_sample);
-    write_mpu_data();
-    // reset buffer index
-    cur_sample = 0;
+    startLogs();
   }
   else
   {
-    Serial.println("Going to sleep now");
-    Serial.flush();
-    esp_deep_sleep_start();
+    // signal that GPS is waiting to fix
+    ESP_LOGI(tag, "Waiting for GPS fix...");
+    statusLED.Blink(250, 250).Forever();
   }
 #endif
+}
+
+void loop()
+{
+  uint32_t storedFixes = pipeline->takeStoredFixes();
+  if (!startTS && gps->isFixed())
+  {
+    // system time was set by the GPS task along with the fix
+    startTS = time(nullptr);
+    ESP_LOGI(tag, "GPS fixed after %u ms.", gps->ttffMs());
+    statusLED.Stop();
+    startLogs();
+  }
+  if (storedFixes && startTS)
+    statusLED.Blink(250, 250).Repeat(2);
+  if (startTS)
+    updateGPSPolicy(storedFixes);
+  uint32_t waitMs = scheduler.run(millis());
+  // a running pattern needs regular updates and the LEDC clock, which
+  // stops in light sleep
+  bool ledActive = statusLED.Update();
+  if (ledActive && waitMs > LED_UPDATE_MS)
+    waitMs = LED_UPDATE_MS;
+  // 's' on the serial console prints the pipeline statistics
+  if (Serial.available() && Serial.read() == 's')
+    pipeline->printStats();
+  pipeline->idle(waitMs, !ledActive);
 }
\ No newline at end of file
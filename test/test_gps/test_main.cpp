@@ -0,0 +1,215 @@
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "GPSAid.h"
+#include "GPSParser.h"
+
+// 2024-03-23 12:35:19 UTC, TinyGPSPlus reads two-digit years as 20xx
+static const time_t FIX_TS = 1711197319;
+
+void setUp() {}
+void tearDown() {}
+
+// feeds "$<body>*<checksum>\r\n", returns the number of fixes it completed
+static int feedSentence(GPSParser &parser, const char *body, bool corrupt = false) {
+    uint8_t checksum = 0;
+    for (const char *c = body; *c; c++) {
+        checksum ^= *c;
+    }
+    char sentence[128];
+    snprintf(sentence, sizeof(sentence), "$%s*%02X\r\n", body, corrupt ? checksum ^ 1 : checksum);
+    int fixes = 0;
+    for (const char *c = sentence; *c; c++) {
+        fixes += parser.feed(*c);
+    }
+    return fixes;
+}
+
+static int feedPVT(GPSParser &parser, const ubx_nav_pvt_t &pvt) {
+    uint8_t frame[sizeof(pvt) + UBX_FRAME_OVERHEAD];
+    size_t len = ubxBuildFrame(UBX_CLASS_NAV, UBX_NAV_PVT, (const uint8_t *)&pvt, sizeof(pvt), frame);
+    int fixes = 0;
+    for (size_t i = 0; i < len; i++) {
+        fixes += parser.feed(frame[i]);
+    }
+    return fixes;
+}
+
+static ubx_nav_pvt_t pvtFix() {
+    ubx_nav_pvt_t pvt = {};
+    pvt.year = 2024;
+    pvt.month = 3;
+    pvt.day = 23;
+    pvt.hour = 12;
+    pvt.min = 35;
+    pvt.sec = 19;
+    pvt.valid = 0x03;
+    pvt.fixType = 3;
+    pvt.flags = 0x01;
+    pvt.numSV = 9;
+    pvt.lat = 481173004;
+    pvt.lon = -115166665;
+    pvt.hAcc = 2549;
+    return pvt;
+}
+
+void test_nmea_rmc_fix() {
+    GPSParser parser;
+    TEST_ASSERT_EQUAL(1, feedSentence(parser, "GPRMC,123519.00,A,4807.038,N,01131.000,E,0.0,0.0,230324,,,A"));
+    const gps_fix_t &fix = parser.fix();
+    TEST_ASSERT_TRUE(parser.hasTime());
+    TEST_ASSERT_EQUAL_INT32(FIX_TS, fix.ts);
+    TEST_ASSERT_EQUAL_INT32(48117300, fix.lat);
+    TEST_ASSERT_EQUAL_INT32(11516667, fix.lng);
+    TEST_ASSERT_EQUAL_UINT16(GPS_ACCURACY_UNKNOWN, fix.hAcc);
+}
+
+void test_nmea_fix_type() {
+    GPSParser parser;
+    feedSentence(parser, "GPRMC,123519.00,A,4807.038,N,01131.000,E,0.0,0.0,230324,,,A");
+    TEST_ASSERT_EQUAL(1, feedSentence(parser, "GPGGA,123520.00,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,"));
+    TEST_ASSERT_EQUAL_UINT8(3, parser.fix().fixType);
+    TEST_ASSERT_EQUAL_UINT8(8, parser.fix().numSV);
+    // GSA tells a 2D fix
+    feedSentence(parser, "GPGSA,A,2,04,05,09,12,,,,,,,,,2.5,1.3,2.1");
+    TEST_ASSERT_EQUAL(1, feedSentence(parser, "GPGGA,123521.00,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,"));
+    TEST_ASSERT_EQUAL_UINT8(2, parser.fix().fixType);
+}
+
+void test_nmea_dead_reckoning_is_no_fix() {
+    GPSParser parser;
+    TEST_ASSERT_EQUAL(0, feedSentence(parser, "GPGGA,123520.00,4807.038,N,01131.000,E,6,08,0.9,545.4,M,46.9,M,,"));
+}
+
+void test_nmea_bad_checksum() {
+    GPSParser parser;
+    TEST_ASSERT_EQUAL(0, feedSentence(parser, "GPRMC,123519.00,A,4807.038,N,01131.000,E,0.0,0.0,230324,,,A", true));
+    TEST_ASSERT_EQUAL_UINT32(0, parser.fixes());
+}
+
+void test_ubx_fix() {
+    GPSParser parser(true);
+    TEST_ASSERT_EQUAL(1, feedPVT(parser, pvtFix()));
+    const gps_fix_t &fix = parser.fix();
+    TEST_ASSERT_EQUAL_INT32(FIX_TS, fix.ts);
+    // 1e-7 to 1e-6 degrees, rounded away from zero
+    TEST_ASSERT_EQUAL_INT32(48117300, fix.lat);
+    TEST_ASSERT_EQUAL_INT32(-11516667, fix.lng);
+    TEST_ASSERT_EQUAL_UINT16(25, fix.hAcc);
+    TEST_ASSERT_EQUAL_UINT8(3, fix.fixType);
+    TEST_ASSERT_EQUAL_UINT8(9, fix.numSV);
+}
+
+void test_ubx_no_fix_keeps_time() {
+    GPSParser parser(true);
+    ubx_nav_pvt_t pvt = pvtFix();
+    pvt.flags = 0;
+    pvt.fixType = 0;
+    TEST_ASSERT_EQUAL(0, feedPVT(parser, pvt));
+    TEST_ASSERT_TRUE(parser.hasTime());
+    TEST_ASSERT_EQUAL_INT32(FIX_TS, GPSParser::toEpoch(parser.time()));
+}
+
+void test_ubx_bad_checksum() {
+    GPSParser parser(true);
+    ubx_nav_pvt_t pvt = pvtFix();
+    uint8_t frame[sizeof(pvt) + UBX_FRAME_OVERHEAD];
+    size_t len = ubxBuildFrame(UBX_CLASS_NAV, UBX_NAV_PVT, (const uint8_t *)&pvt, sizeof(pvt), frame);
+    frame[len - 1] ^= 0xFF;
+    int fixes = 0;
+    for (size_t i = 0; i < len; i++) {
+        fixes += parser.feed(frame[i]);
+    }
+    TEST_ASSERT_EQUAL(0, fixes);
+    // the next intact frame is still parsed
+    TEST_ASSERT_EQUAL(1, feedPVT(parser, pvt));
+}
+
+void test_format_fix() {
+    gps_fix_t fix = {};
+    fix.ts = FIX_TS;
+    fix.lat = -8050000;
+    fix.lng = 34900001;
+    char line[GPSParser::FIX_LINE_SIZE];
+    TEST_ASSERT_EQUAL(strlen("1711197319;-8.050000;34.900001\n"),
+                      GPSParser::formatFix(fix, line, sizeof(line)));
+    TEST_ASSERT_EQUAL_STRING("1711197319;-8.050000;34.900001\n", line);
+    TEST_ASSERT_EQUAL(0, GPSParser::formatFix(fix, line, 8));
+}
+
+static int32_t getI32(const uint8_t *p) {
+    return (int32_t)((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+void test_aid_frame() {
+    gps_fix_t fix = {};
+    fix.ts = FIX_TS;
+    fix.lat = 48117300;
+    fix.lng = -11516667;
+    fix.hAcc = 25;
+    gps_aid_t aid;
+    GPSAid::fromFix(fix, aid);
+    TEST_ASSERT_TRUE(GPSAid::valid(aid));
+    uint8_t frame[GPSAid::FRAME_SIZE];
+    TEST_ASSERT_EQUAL(GPSAid::FRAME_SIZE, GPSAid::frame(aid, frame));
+    UBXParser parser;
+    int frames = 0;
+    for (size_t i = 0; i < sizeof(frame); i++) {
+        frames += parser.feed(frame[i]);
+    }
+    TEST_ASSERT_EQUAL(1, frames);
+    TEST_ASSERT_EQUAL_UINT8(UBX_CLASS_MGA, parser.msgClass());
+    TEST_ASSERT_EQUAL_UINT8(UBX_MGA_INI, parser.msgId());
+    TEST_ASSERT_EQUAL_UINT16(20, parser.length());
+    const uint8_t *pos = parser.payload();
+    // POS_LLH, message version 0
+    TEST_ASSERT_EQUAL_UINT8(0x01, pos[0]);
+    TEST_ASSERT_EQUAL_UINT8(0x00, pos[1]);
+    // 1e-6 to 1e-7 degrees
+    TEST_ASSERT_EQUAL_INT32(481173000, getI32(pos + 4));
+    TEST_ASSERT_EQUAL_INT32(-115166670, getI32(pos + 8));
+    TEST_ASSERT_EQUAL_INT32(0, getI32(pos + 12));
+    // 1 km for the unknown altitude plus the fix accuracy
+    TEST_ASSERT_EQUAL_INT32(100000 + 250, getI32(pos + 16));
+}
+
+void test_aid_accuracy_unknown() {
+    gps_fix_t fix = {};
+    fix.hAcc = GPS_ACCURACY_UNKNOWN;
+    gps_aid_t aid;
+    GPSAid::fromFix(fix, aid);
+    TEST_ASSERT_EQUAL_UINT32(105000, GPSAid::accuracyCm(aid));
+}
+
+void test_aid_validity() {
+    gps_fix_t fix = {};
+    fix.ts = FIX_TS;
+    fix.lat = 48117300;
+    gps_aid_t aid;
+    GPSAid::fromFix(fix, aid);
+    gps_aid_t changed = aid;
+    changed.lat++;
+    TEST_ASSERT_FALSE(GPSAid::valid(changed));
+    // blank RTC memory or card file
+    gps_aid_t blank = {};
+    TEST_ASSERT_FALSE(GPSAid::valid(blank));
+    changed = aid;
+    changed.magic = 0;
+    TEST_ASSERT_FALSE(GPSAid::valid(changed));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_nmea_rmc_fix);
+    RUN_TEST(test_nmea_fix_type);
+    RUN_TEST(test_nmea_dead_reckoning_is_no_fix);
+    RUN_TEST(test_nmea_bad_checksum);
+    RUN_TEST(test_ubx_fix);
+    RUN_TEST(test_ubx_no_fix_keeps_time);
+    RUN_TEST(test_ubx_bad_checksum);
+    RUN_TEST(test_format_fix);
+    RUN_TEST(test_aid_frame);
+    RUN_TEST(test_aid_accuracy_unknown);
+    RUN_TEST(test_aid_validity);
+    return UNITY_END();
+}
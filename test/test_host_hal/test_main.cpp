@@ -0,0 +1,108 @@
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "HostHAL.h"
+
+static const char *PATH = "test_host_hal.bin";
+
+void setUp() {
+    remove(PATH);
+}
+
+void tearDown() {
+    remove(PATH);
+}
+
+void test_memory_byte_source() {
+    const uint8_t data[] = { 1, 2, 3, 4, 5 };
+    MemoryByteSource source(data, sizeof(data));
+    uint8_t buffer[4];
+    TEST_ASSERT_EQUAL(4, source.read(buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_MEMORY(data, buffer, 4);
+    TEST_ASSERT_EQUAL(1, source.read(buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_UINT8(5, buffer[0]);
+    TEST_ASSERT_EQUAL(0, source.read(buffer, sizeof(buffer)));
+}
+
+void test_file_sink_and_store() {
+    const uint8_t data[] = "abcdefgh";
+    HostFileStore store;
+    TEST_ASSERT_EQUAL_INT32(-1, store.size(PATH));
+    FileBlockSink sink;
+    TEST_ASSERT_TRUE(sink.open(PATH));
+    TEST_ASSERT_EQUAL(8, sink.write(data, 8));
+    TEST_ASSERT_TRUE(sink.sync());
+    TEST_ASSERT_EQUAL(8, sink.size());
+    sink.close();
+    TEST_ASSERT_FALSE(sink.isOpen());
+    TEST_ASSERT_EQUAL(0, sink.write(data, 8));
+    // reopening appends
+    TEST_ASSERT_TRUE(sink.open(PATH));
+    TEST_ASSERT_EQUAL(8, sink.size());
+    sink.write(data, 2);
+    sink.close();
+    TEST_ASSERT_EQUAL_INT32(10, store.size(PATH));
+    uint8_t buffer[8];
+    TEST_ASSERT_EQUAL(4, store.read(PATH, 6, buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_MEMORY("ghab", buffer, 4);
+
+    FileByteSource source;
+    TEST_ASSERT_TRUE(source.open(PATH));
+    TEST_ASSERT_EQUAL(8, source.read(buffer, sizeof(buffer)));
+    TEST_ASSERT_EQUAL_MEMORY(data, buffer, 8);
+    TEST_ASSERT_EQUAL(2, source.read(buffer, sizeof(buffer)));
+}
+
+void test_memory_block_sink() {
+    const uint8_t data[] = { 9, 8, 7 };
+    MemoryBlockSink sink;
+    sink.write(data, 3);
+    sink.write(data, 1);
+    sink.sync();
+    TEST_ASSERT_EQUAL(4, sink.size());
+    TEST_ASSERT_EQUAL_UINT32(2, sink.writes);
+    TEST_ASSERT_EQUAL_UINT32(1, sink.syncs);
+    TEST_ASSERT_EQUAL_UINT8(9, sink.bytes[3]);
+}
+
+void test_memory_fifo_overflow() {
+    uint8_t data[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    MemoryFifoSource fifo;
+    fifo.capacity = 6;
+    fifo.fill(data, 4);
+    TEST_ASSERT_EQUAL_UINT16(4, fifo.count());
+    TEST_ASSERT_FALSE(fifo.overflowed());
+    uint8_t buffer[8];
+    TEST_ASSERT_FALSE(fifo.read(buffer, 5));
+    TEST_ASSERT_TRUE(fifo.read(buffer, 3));
+    TEST_ASSERT_EQUAL_MEMORY(data, buffer, 3);
+    // 1 byte left, 5 more fit
+    fifo.fill(data, 8);
+    TEST_ASSERT_EQUAL_UINT16(6, fifo.count());
+    TEST_ASSERT_TRUE(fifo.overflowed());
+    // the flag is cleared once read
+    TEST_ASSERT_FALSE(fifo.overflowed());
+    fifo.reset();
+    TEST_ASSERT_EQUAL_UINT16(0, fifo.count());
+}
+
+void test_memory_radio_busy() {
+    const uint8_t data[] = { 0xAA, 0xBB };
+    MemoryRadioSink radio;
+    TEST_ASSERT_TRUE(radio.send(data, 2, 3));
+    radio.busy = true;
+    TEST_ASSERT_FALSE(radio.send(data, 1, 3));
+    TEST_ASSERT_EQUAL(1, radio.frames.size());
+    TEST_ASSERT_EQUAL_UINT8(3, radio.frames[0].port);
+    TEST_ASSERT_EQUAL_MEMORY(data, radio.frames[0].data.data(), 2);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_memory_byte_source);
+    RUN_TEST(test_file_sink_and_store);
+    RUN_TEST(test_memory_block_sink);
+    RUN_TEST(test_memory_fifo_overflow);
+    RUN_TEST(test_memory_radio_busy);
+    return UNITY_END();
+}
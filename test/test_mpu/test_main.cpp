@@ -0,0 +1,313 @@
+#include <unity.h>
+#include <math.h>
+#include <string.h>
+#include "HostHAL.h"
+#include "MPUBatch.h"
+#include "MPUCompressor.h"
+#include "MotionFeatures.h"
+#include "QuatCodec.h"
+
+static const uint8_t PACKET_SIZE = MPUBatch::MAX_PACKET_SIZE;
+// packets per drain, well below the 1024-byte FIFO
+static const uint8_t DRAIN_PACKETS = 20;
+
+// the ring alone is 12 KB, kept out of the test stack
+static MPUBatch batch;
+static MemoryFifoSource fifo;
+
+void setUp() {
+    batch.clear();
+    batch.setTimeBase(0);
+    mpu_record_t record;
+    while (batch.samples().pop(record)) {
+    }
+    fifo.reset();
+}
+
+void tearDown() {}
+
+static void putBE32(uint8_t *p, int16_t upper) {
+    p[0] = (uint16_t)upper >> 8;
+    p[1] = upper & 0xFF;
+    p[2] = 0x12;
+    p[3] = 0x34;
+}
+
+// MotionApps20 packet whose channels derive from n
+static void packet(uint32_t n, uint8_t *out) {
+    memset(out, 0, PACKET_SIZE);
+    for (uint8_t c = 0; c < 4; c++) {
+        putBE32(out + 4 * c, (int16_t)(n * 4 + c));
+    }
+    for (uint8_t c = 0; c < 3; c++) {
+        putBE32(out + 16 + 4 * c, (int16_t)(-(int32_t)n - c));
+        putBE32(out + 28 + 4 * c, (int16_t)(1000 + n + c));
+    }
+}
+
+static void fillPackets(uint32_t first, uint8_t count) {
+    uint8_t buffer[PACKET_SIZE];
+    for (uint8_t i = 0; i < count; i++) {
+        packet(first + i, buffer);
+        fifo.fill(buffer, sizeof(buffer));
+    }
+}
+
+static mpu_record_t testRecord(uint32_t i) {
+    mpu_record_t r;
+    r.tMs = i * MPUBatch::SAMPLE_PERIOD_MS;
+    r.q[0] = 16000 - i;
+    r.q[1] = (int16_t)(i * 7);
+    r.q[2] = -(int16_t)(i * 3);
+    r.q[3] = 100;
+    for (uint8_t c = 0; c < 3; c++) {
+        r.g[c] = (int16_t)((i * 37 + c * 11) % 200) - 100;
+        r.a[c] = (int16_t)(c == 2 ? 8192 : 0) + (int16_t)(i % 5);
+    }
+    return r;
+}
+
+void test_batch_decodes_full_batches() {
+    uint32_t lastMs = 0;
+    for (uint32_t n = 0; n < NUM_SAMPLES; n += DRAIN_PACKETS) {
+        fillPackets(n, DRAIN_PACKETS);
+        lastMs = (n + DRAIN_PACKETS - 1) * MPUBatch::SAMPLE_PERIOD_MS;
+        TEST_ASSERT_TRUE(batch.drain(fifo, lastMs));
+        TEST_ASSERT_EQUAL(DRAIN_PACKETS * PACKET_SIZE, batch.fifoCount());
+        // records are handed over a whole batch at a time
+        TEST_ASSERT_EQUAL(n + DRAIN_PACKETS < NUM_SAMPLES ? 0 : NUM_SAMPLES, batch.samples().size());
+    }
+    mpu_record_t record;
+    for (uint32_t n = 0; n < NUM_SAMPLES; n++) {
+        TEST_ASSERT_TRUE(batch.samples().pop(record));
+        TEST_ASSERT_EQUAL_UINT32(n * MPUBatch::SAMPLE_PERIOD_MS, record.tMs);
+        TEST_ASSERT_EQUAL_INT16(n * 4 + 1, record.q[1]);
+        TEST_ASSERT_EQUAL_INT16(-(int32_t)n - 2, record.g[2]);
+        TEST_ASSERT_EQUAL_INT16(1000 + n, record.a[0]);
+    }
+}
+
+void test_batch_partial_packet_waits() {
+    fillPackets(0, 2);
+    uint8_t half[PACKET_SIZE / 2] = {};
+    fifo.fill(half, sizeof(half));
+    TEST_ASSERT_TRUE(batch.drain(fifo, 10));
+    TEST_ASSERT_EQUAL(sizeof(half), fifo.count());
+}
+
+void test_batch_overflow_resets() {
+    uint32_t before = batch.overflows();
+    fillPackets(0, 30);
+    TEST_ASSERT_FALSE(batch.drain(fifo, 0));
+    TEST_ASSERT_EQUAL_UINT32(before + 1, batch.overflows());
+    TEST_ASSERT_EQUAL(0, fifo.count());
+}
+
+void test_batch_read_one() {
+    fillPackets(5, 2);
+    mpu_record_t record;
+    batch.setTimeBase(100);
+    TEST_ASSERT_TRUE(batch.readOne(fifo, 250, record));
+    TEST_ASSERT_EQUAL_UINT32(150, record.tMs);
+    TEST_ASSERT_EQUAL_INT16(20, record.q[0]);
+    TEST_ASSERT_EQUAL(PACKET_SIZE, fifo.count());
+    TEST_ASSERT_EQUAL(0, batch.samples().size());
+}
+
+static void compressRoundTrip(uint8_t count) {
+    MPUCompressor compressor;
+    mpu_record_t records[MPUCompressor::BLOCK_RECORDS];
+    mpu_record_t decoded[MPUCompressor::BLOCK_RECORDS];
+    size_t blockSize = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        records[i] = testRecord(i);
+        if (compressor.add(records[i])) {
+            blockSize = compressor.blockSize();
+        }
+    }
+    if (count < MPUCompressor::BLOCK_RECORDS) {
+        blockSize = compressor.finish();
+    }
+    TEST_ASSERT_GREATER_THAN(0, blockSize);
+    TEST_ASSERT_TRUE(blockSize < count * sizeof(mpu_record_t) || count == 1);
+    TEST_ASSERT_EQUAL(count, MPUCompressor::decode(compressor.block(), blockSize, decoded,
+                                                   MPUCompressor::BLOCK_RECORDS));
+    TEST_ASSERT_EQUAL_MEMORY(records, decoded, count * sizeof(mpu_record_t));
+}
+
+void test_compress_full_block() {
+    compressRoundTrip(MPUCompressor::BLOCK_RECORDS);
+}
+
+void test_compress_partial_blocks() {
+    compressRoundTrip(1);
+    compressRoundTrip(17);
+}
+
+void test_compress_rejects_corruption() {
+    MPUCompressor compressor;
+    for (uint8_t i = 0; i < 10; i++) {
+        compressor.add(testRecord(i));
+    }
+    size_t size = compressor.finish();
+    uint8_t block[MPUCompressor::MAX_BLOCK_SIZE];
+    memcpy(block, compressor.block(), size);
+    mpu_record_t decoded[MPUCompressor::BLOCK_RECORDS];
+    block[size - 1] ^= 0x01;
+    TEST_ASSERT_EQUAL(-1, MPUCompressor::decode(block, size, decoded, MPUCompressor::BLOCK_RECORDS));
+    // torn
+    TEST_ASSERT_EQUAL(-1, MPUCompressor::decode(compressor.block(), size - 1, decoded,
+                                                MPUCompressor::BLOCK_RECORDS));
+}
+
+// one window of batches with accelG(t) on the vertical axis and a
+// rotation of turnDeg(t) about it, t in seconds
+static motion_features_t featureWindow(float (*accelG)(float), float (*turnDeg)(float)) {
+    MotionFeatures features;
+    mpu_batch_t batch;
+    for (uint32_t b = 0; b < MotionFeatures::WINDOW_BATCHES; b++) {
+        for (uint8_t i = 0; i < NUM_SAMPLES; i++) {
+            uint32_t n = b * NUM_SAMPLES + i;
+            float t = n * MPUBatch::SAMPLE_PERIOD_MS / 1000.0f;
+            float half = turnDeg(t) * (float)M_PI / 360;
+            batch.ms[i] = n * MPUBatch::SAMPLE_PERIOD_MS;
+            batch.q[0][i] = (int16_t)lroundf(cosf(half) * 16384);
+            batch.q[1][i] = 0;
+            batch.q[2][i] = 0;
+            batch.q[3][i] = (int16_t)lroundf(sinf(half) * 16384);
+            batch.a[0][i] = 0;
+            batch.a[1][i] = 0;
+            batch.a[2][i] = (int16_t)lroundf(accelG(t) * MotionFeatures::ACCEL_LSB_PER_G);
+            for (uint8_t c = 0; c < 3; c++) {
+                batch.g[c][i] = 0;
+            }
+        }
+        batch.count = NUM_SAMPLES;
+        features.process(batch, 0);
+    }
+    motion_features_t window = {};
+    TEST_ASSERT_TRUE(features.windows().pop(window));
+    return window;
+}
+
+static float still(float t) { return 1.0f; }
+// 2 Hz bounce of 0.3 g, one step per period
+static float walking(float t) { return 1.0f + 0.3f * sinf(2 * (float)M_PI * 2 * t); }
+static float noTurn(float t) { return 0; }
+// 90 degrees over the minute of the window
+static float turning(float t) { return 1.5f * t; }
+
+void test_features_still() {
+    motion_features_t window = featureWindow(still, noTurn);
+    TEST_ASSERT_EQUAL_UINT16(MotionFeatures::WINDOW_BATCHES * NUM_SAMPLES, window.samples);
+    TEST_ASSERT_TRUE(window.rmsMg <= 1);
+    TEST_ASSERT_TRUE(window.peakMg <= 1);
+    TEST_ASSERT_INT32_WITHIN(1, 1000, window.meanMg);
+    TEST_ASSERT_EQUAL_UINT16(0, window.steps);
+    TEST_ASSERT_EQUAL_UINT16(0, window.impacts);
+    TEST_ASSERT_EQUAL_UINT16(0, window.rotationDeg);
+    TEST_ASSERT_EQUAL_UINT8(0, window.activePct);
+}
+
+void test_features_steps() {
+    motion_features_t window = featureWindow(walking, noTurn);
+    // the filters settle within the first steps
+    TEST_ASSERT_INT32_WITHIN(3, 2 * 60, window.steps);
+    // 0.3 g / sqrt(2)
+    TEST_ASSERT_INT32_WITHIN(10, 212, window.rmsMg);
+    // plus the overshoot of the high-pass while it settles
+    TEST_ASSERT_TRUE(window.peakMg >= 300 && window.peakMg <= 350);
+    TEST_ASSERT_EQUAL_UINT16(0, window.impacts);
+    TEST_ASSERT_EQUAL_UINT8(100, window.activePct);
+}
+
+void test_features_rotation() {
+    motion_features_t window = featureWindow(still, turning);
+    TEST_ASSERT_INT32_WITHIN(2, 90, window.rotationDeg);
+    TEST_ASSERT_INT32_WITHIN(2, 90, window.tiltDeg);
+    TEST_ASSERT_EQUAL_UINT16(0, window.steps);
+    // the orientation at the end of the window
+    int16_t q[4], end[4] = { 11585, 0, 0, 11585 };
+    QuatCodec::decode(window.orientation, MotionFeatures::ORIENTATION_BITS, q);
+    TEST_ASSERT_TRUE(QuatCodec::angleDeg(q, end) <= 2);
+}
+
+// random unit quaternions in Q14, reproducible
+static void randomQuat(uint32_t &seed, int16_t *q) {
+    float v[4];
+    float norm = 0;
+    for (uint8_t c = 0; c < 4; c++) {
+        seed = seed * 1664525 + 1013904223;
+        v[c] = (int32_t)seed / 2147483648.0f;
+        norm += v[c] * v[c];
+    }
+    norm = sqrtf(norm);
+    for (uint8_t c = 0; c < 4; c++) {
+        q[c] = (int16_t)lroundf(v[c] / norm * 16384);
+    }
+}
+
+void test_quat_error_within_bound() {
+    static const uint32_t SAMPLES = 20000;
+    for (uint8_t bits = QuatCodec::MIN_BITS; bits <= QuatCodec::MAX_BITS; bits++) {
+        uint32_t seed = bits;
+        float bound = QuatCodec::maxErrorDeg(bits);
+        for (uint32_t i = 0; i < SAMPLES; i++) {
+            int16_t q[4], decoded[4];
+            uint8_t packed[8];
+            randomQuat(seed, q);
+            TEST_ASSERT_EQUAL(QuatCodec::bytes(bits), QuatCodec::encode(q, bits, packed));
+            QuatCodec::decode(packed, bits, decoded);
+            TEST_ASSERT_TRUE(QuatCodec::angleDeg(q, decoded) <= bound);
+        }
+    }
+}
+
+void test_quat_identity_and_sign() {
+    int16_t identity[4] = { 16384, 0, 0, 0 };
+    int16_t negated[4] = { -16384, 0, 0, 0 };
+    int16_t decoded[4];
+    uint8_t packed[8];
+    QuatCodec::encode(negated, QuatCodec::MIN_BITS, packed);
+    QuatCodec::decode(packed, QuatCodec::MIN_BITS, decoded);
+    // q and -q are the same rotation
+    TEST_ASSERT_TRUE(QuatCodec::angleDeg(identity, decoded) <= QuatCodec::maxErrorDeg(QuatCodec::MIN_BITS));
+}
+
+void test_quat_packed_record() {
+    mpu_record_t record = testRecord(3);
+    record.q[0] = 16384;
+    record.q[1] = record.q[2] = record.q[3] = 0;
+    uint8_t packed[sizeof(mpu_record_t)];
+    for (uint8_t bits = QuatCodec::MIN_BITS; bits <= QuatCodec::MAX_BITS; bits++) {
+        TEST_ASSERT_EQUAL(QuatCodec::recordSize(bits), QuatCodec::packRecord(record, bits, packed));
+        mpu_record_t unpacked;
+        QuatCodec::unpackRecord(packed, bits, unpacked);
+        TEST_ASSERT_EQUAL_UINT32(record.tMs, unpacked.tMs);
+        TEST_ASSERT_EQUAL_MEMORY(record.g, unpacked.g, sizeof(record.g));
+        TEST_ASSERT_EQUAL_MEMORY(record.a, unpacked.a, sizeof(record.a));
+        // the record is packed, the quaternions are compared aligned
+        int16_t q[4], decoded[4];
+        memcpy(q, record.q, sizeof(q));
+        memcpy(decoded, unpacked.q, sizeof(decoded));
+        TEST_ASSERT_TRUE(QuatCodec::angleDeg(q, decoded) <= QuatCodec::maxErrorDeg(bits));
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_batch_decodes_full_batches);
+    RUN_TEST(test_batch_partial_packet_waits);
+    RUN_TEST(test_batch_overflow_resets);
+    RUN_TEST(test_batch_read_one);
+    RUN_TEST(test_compress_full_block);
+    RUN_TEST(test_compress_partial_blocks);
+    RUN_TEST(test_compress_rejects_corruption);
+    RUN_TEST(test_features_still);
+    RUN_TEST(test_features_steps);
+    RUN_TEST(test_features_rotation);
+    RUN_TEST(test_quat_error_within_bound);
+    RUN_TEST(test_quat_identity_and_sign);
+    RUN_TEST(test_quat_packed_record);
+    return UNITY_END();
+}
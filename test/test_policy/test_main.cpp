@@ -0,0 +1,181 @@
+#include <unity.h>
+#include "MotionPolicy.h"
+#include "Scheduler.h"
+#include "TrackFilter.h"
+
+void setUp() {}
+void tearDown() {}
+
+static void countRun(void *arg) {
+    (*(uint32_t *)arg)++;
+}
+
+void test_scheduler_cadence() {
+    Scheduler scheduler;
+    uint32_t runs = 0;
+    TEST_ASSERT_EQUAL_INT8(0, scheduler.every(1000, countRun, &runs, 0));
+    TEST_ASSERT_EQUAL_UINT32(500, scheduler.run(500));
+    TEST_ASSERT_EQUAL_UINT32(0, runs);
+    // a late run keeps the cadence
+    TEST_ASSERT_EQUAL_UINT32(800, scheduler.run(1200));
+    TEST_ASSERT_EQUAL_UINT32(1, runs);
+    TEST_ASSERT_EQUAL_UINT32(1000, scheduler.run(2000));
+    TEST_ASSERT_EQUAL_UINT32(2, runs);
+}
+
+void test_scheduler_skips_missed_periods() {
+    Scheduler scheduler;
+    uint32_t runs = 0;
+    scheduler.every(1000, countRun, &runs, 0);
+    TEST_ASSERT_EQUAL_UINT32(500, scheduler.run(5500));
+    TEST_ASSERT_EQUAL_UINT32(1, runs);
+}
+
+void test_scheduler_wraps() {
+    Scheduler scheduler;
+    uint32_t runs = 0;
+    uint32_t start = UINT32_MAX - 300;
+    scheduler.every(1000, countRun, &runs, start);
+    TEST_ASSERT_EQUAL_UINT32(500, scheduler.run(start + 500));
+    TEST_ASSERT_EQUAL_UINT32(0, runs);
+    scheduler.run(start + 1000);
+    TEST_ASSERT_EQUAL_UINT32(1, runs);
+}
+
+void test_scheduler_earliest_job_and_period() {
+    Scheduler scheduler;
+    uint32_t fast = 0, slow = 0;
+    scheduler.every(300, countRun, &fast, 0);
+    int8_t id = scheduler.every(10000, countRun, &slow, 0);
+    TEST_ASSERT_EQUAL_UINT32(300, scheduler.untilNext(0));
+    // a shorter period brings the next run forward
+    scheduler.setPeriod(id, 100, 0);
+    TEST_ASSERT_EQUAL_UINT32(100, scheduler.untilNext(0));
+    scheduler.run(100);
+    TEST_ASSERT_EQUAL_UINT32(1, slow);
+    TEST_ASSERT_EQUAL_UINT32(0, fast);
+}
+
+void test_scheduler_full() {
+    Scheduler scheduler;
+    uint32_t runs = 0;
+    for (uint8_t i = 0; i < Scheduler::MAX_JOBS; i++) {
+        TEST_ASSERT_EQUAL_INT8(i, scheduler.every(1000, countRun, &runs, 0));
+    }
+    TEST_ASSERT_EQUAL_INT8(-1, scheduler.every(1000, countRun, &runs, 0));
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, Scheduler().untilNext(0));
+}
+
+void test_motion_policy() {
+    MotionPolicy policy(1000, 10000, 60000, 600000);
+    TEST_ASSERT_EQUAL(GPS_POLICY_MOVING, policy.policy());
+    TEST_ASSERT_EQUAL_UINT32(1000, policy.gpsPeriodMs());
+    TEST_ASSERT_FALSE(policy.update(true, 0));
+    TEST_ASSERT_TRUE(policy.update(false, 1000));
+    TEST_ASSERT_EQUAL(GPS_POLICY_STATIONARY, policy.policy());
+    TEST_ASSERT_EQUAL_UINT32(10000, policy.gpsPeriodMs());
+    TEST_ASSERT_FALSE(policy.update(false, 60999));
+    TEST_ASSERT_TRUE(policy.update(false, 61000));
+    TEST_ASSERT_TRUE(policy.gpsBackup());
+    TEST_ASSERT_EQUAL_UINT32(600000, policy.gpsPeriodMs());
+    // any motion returns to the fast period at once
+    TEST_ASSERT_TRUE(policy.update(true, 62000));
+    TEST_ASSERT_EQUAL(GPS_POLICY_MOVING, policy.policy());
+    TEST_ASSERT_FALSE(policy.gpsBackup());
+}
+
+void test_motion_policy_restarts_still_time() {
+    MotionPolicy policy(1000, 10000, 60000, 600000);
+    policy.update(false, 0);
+    policy.update(true, 30000);
+    policy.update(false, 40000);
+    TEST_ASSERT_FALSE(policy.update(false, 90000));
+    TEST_ASSERT_EQUAL(GPS_POLICY_STATIONARY, policy.policy());
+}
+
+static gps_fix_t trackFix(uint32_t ts, int32_t lat, int32_t lng) {
+    gps_fix_t fix = {};
+    fix.ts = ts;
+    fix.lat = lat;
+    fix.lng = lng;
+    return fix;
+}
+
+void test_track_unconfigured_passes_through() {
+    TrackFilter track = {};
+    gps_fix_t out;
+    for (uint32_t i = 0; i < 5; i++) {
+        TEST_ASSERT_TRUE(track.add(trackFix(i, 0, i * 100), out));
+        TEST_ASSERT_EQUAL_INT32(i * 100, out.lng);
+    }
+    TEST_ASSERT_EQUAL_UINT32(5, track.retained());
+}
+
+void test_track_straight_line() {
+    TrackFilter track = {};
+    track.configure(10, 0);
+    gps_fix_t out;
+    TEST_ASSERT_TRUE(track.add(trackFix(0, 0, 0), out));
+    // constant speed along a line, nothing strays
+    for (uint32_t i = 1; i < 20; i++) {
+        TEST_ASSERT_FALSE(track.add(trackFix(i, i * 100, i * 100), out));
+    }
+    TEST_ASSERT_TRUE(track.flush(out));
+    TEST_ASSERT_EQUAL_INT32(1900, out.lat);
+    TEST_ASSERT_EQUAL_UINT32(2, track.retained());
+    TEST_ASSERT_EQUAL_UINT32(20, track.inputs());
+}
+
+void test_track_corner() {
+    TrackFilter track = {};
+    // 10 m is about 90 micro-degrees of latitude
+    track.configure(10, 0);
+    gps_fix_t out;
+    track.add(trackFix(0, 0, 0), out);
+    for (uint32_t i = 1; i <= 10; i++) {
+        TEST_ASSERT_FALSE(track.add(trackFix(i, i * 100, 0), out));
+    }
+    // turning east, the corner fix is retained
+    bool retained = false;
+    for (uint32_t i = 1; i <= 3 && !retained; i++) {
+        retained = track.add(trackFix(10 + i, 1000, i * 100), out);
+    }
+    TEST_ASSERT_TRUE(retained);
+    TEST_ASSERT_EQUAL_INT32(1000, out.lat);
+    TEST_ASSERT_EQUAL_INT32(0, out.lng);
+}
+
+void test_track_max_gap() {
+    TrackFilter track = {};
+    track.configure(10, 300);
+    gps_fix_t out;
+    track.add(trackFix(0, 0, 0), out);
+    TEST_ASSERT_FALSE(track.add(trackFix(100, 0, 0), out));
+    // a standing asset still reports
+    TEST_ASSERT_TRUE(track.add(trackFix(300, 0, 0), out));
+    TEST_ASSERT_EQUAL_UINT32(300, out.ts);
+}
+
+void test_track_cosine() {
+    TEST_ASSERT_INT32_WITHIN(70, 32768, TrackFilter::cosQ15(0));
+    // cos(60) = 0.5, 0.2% off at most
+    TEST_ASSERT_INT32_WITHIN(70, 16384, TrackFilter::cosQ15(60000000));
+    TEST_ASSERT_INT32_WITHIN(70, 16384, TrackFilter::cosQ15(-60000000));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_scheduler_cadence);
+    RUN_TEST(test_scheduler_skips_missed_periods);
+    RUN_TEST(test_scheduler_wraps);
+    RUN_TEST(test_scheduler_earliest_job_and_period);
+    RUN_TEST(test_scheduler_full);
+    RUN_TEST(test_motion_policy);
+    RUN_TEST(test_motion_policy_restarts_still_time);
+    RUN_TEST(test_track_unconfigured_passes_through);
+    RUN_TEST(test_track_straight_line);
+    RUN_TEST(test_track_corner);
+    RUN_TEST(test_track_max_gap);
+    RUN_TEST(test_track_cosine);
+    return UNITY_END();
+}
@@ -0,0 +1,233 @@
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "HostHAL.h"
+#include "LogStream.h"
+#include "SegmentedLog.h"
+
+// host files of the segmented log tests, in the working directory
+static const char *BASE = "test_storage_log";
+static const char *EXT = ".txt";
+
+static LogStream stream;
+static uint8_t data[LogStream::BUFFER_SIZE * 2];
+
+static void removeLog() {
+    char path[SegmentedLog::MAX_PATH];
+    SegmentedLog::indexPath(BASE, path, sizeof(path));
+    remove(path);
+    for (uint16_t segment = 0; segment < 4; segment++) {
+        SegmentedLog::segmentPath(BASE, EXT, segment, path, sizeof(path));
+        remove(path);
+    }
+}
+
+void setUp() {
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)i;
+    }
+    removeLog();
+}
+
+void tearDown() {
+    removeLog();
+}
+
+// host stand-in for the files SDUtil opens on the card
+struct HostLog {
+    FileBlockSink segment;
+    FileBlockSink index;
+    HostFileStore store;
+    SegmentedLog log;
+
+    bool open(uint32_t maxBytes) {
+        return log.open(&stream, &segment, &index, &store, BASE, EXT, maxBytes, 86400);
+    }
+};
+
+void test_log_buffers_partial_sectors() {
+    MemoryBlockSink sink;
+    TEST_ASSERT_TRUE(stream.open(&sink));
+    TEST_ASSERT_EQUAL(100, stream.write(data, 100));
+    TEST_ASSERT_EQUAL(0, sink.bytes.size());
+    TEST_ASSERT_EQUAL(100, stream.size());
+    TEST_ASSERT_TRUE(stream.flush());
+    TEST_ASSERT_EQUAL(100, sink.bytes.size());
+    TEST_ASSERT_EQUAL_UINT32(1, sink.syncs);
+    TEST_ASSERT_EQUAL_MEMORY(data, sink.bytes.data(), 100);
+    stream.close();
+}
+
+void test_log_writes_whole_sectors() {
+    MemoryBlockSink sink;
+    TEST_ASSERT_TRUE(stream.open(&sink));
+    stream.write(data, 100);
+    stream.flush();
+    // a full buffer goes out up to the last sector boundary of the file
+    TEST_ASSERT_EQUAL(LogStream::BUFFER_SIZE, stream.write(data, LogStream::BUFFER_SIZE));
+    size_t written = sink.bytes.size();
+    TEST_ASSERT_EQUAL(0, written % LogStream::SECTOR_SIZE);
+    TEST_ASSERT_GREATER_THAN(100, written);
+    TEST_ASSERT_EQUAL(100 + LogStream::BUFFER_SIZE, stream.size());
+    stream.close();
+    TEST_ASSERT_EQUAL(100 + LogStream::BUFFER_SIZE, sink.bytes.size());
+    TEST_ASSERT_EQUAL_MEMORY(data, sink.bytes.data() + 100, LogStream::BUFFER_SIZE);
+}
+
+void test_log_large_write() {
+    MemoryBlockSink sink;
+    TEST_ASSERT_TRUE(stream.open(&sink));
+    TEST_ASSERT_EQUAL(sizeof(data), stream.write(data, sizeof(data)));
+    stream.close();
+    TEST_ASSERT_EQUAL(sizeof(data), sink.bytes.size());
+    TEST_ASSERT_EQUAL_MEMORY(data, sink.bytes.data(), sizeof(data));
+}
+
+void test_log_closed() {
+    TEST_ASSERT_FALSE(stream.open(nullptr));
+    TEST_ASSERT_EQUAL(0, stream.write(data, 10));
+    TEST_ASSERT_FALSE(stream.flush());
+}
+
+// count 7-byte records a second apart from ts, flushed every second one
+static void writeRecords(SegmentedLog &log, uint32_t ts, uint8_t count) {
+    for (uint8_t i = 0; i < count; i++) {
+        log.print(ts + i, "record\n");
+        if (i % 2) {
+            log.flush();
+        }
+    }
+}
+
+void test_index_find() {
+    HostLog host;
+    TEST_ASSERT_TRUE(host.open(1024 * 1024));
+    writeRecords(host.log, 1000, 10);
+    host.log.close();
+    log_range_t ranges[4];
+    TEST_ASSERT_EQUAL(1, LogIndex::find(host.store, BASE, 1004, 1005, ranges, 4));
+    TEST_ASSERT_EQUAL_UINT16(0, ranges[0].segment);
+    // checkpoints at the flushes, after records 1001, 1003, ...; 1004
+    // follows the one of 1003
+    TEST_ASSERT_EQUAL_UINT32(4 * 7, ranges[0].offset);
+    TEST_ASSERT_EQUAL_UINT32(8 * 7, ranges[0].end);
+    TEST_ASSERT_EQUAL(0, LogIndex::find(host.store, BASE, 2000, 3000, ranges, 4));
+}
+
+void test_index_segments() {
+    HostLog host;
+    // five records per segment
+    TEST_ASSERT_TRUE(host.open(5 * 7));
+    writeRecords(host.log, 1000, 10);
+    host.log.close();
+    log_range_t ranges[4];
+    TEST_ASSERT_EQUAL(2, LogIndex::find(host.store, BASE, 1000, 1009, ranges, 4));
+    TEST_ASSERT_EQUAL_UINT16(0, ranges[0].segment);
+    TEST_ASSERT_EQUAL_UINT16(1, ranges[1].segment);
+    TEST_ASSERT_EQUAL(1, LogIndex::find(host.store, BASE, 1007, 1009, ranges, 4));
+    TEST_ASSERT_EQUAL_UINT16(1, ranges[0].segment);
+}
+
+// an index append torn by a power failure is padded on reopen
+void test_index_torn_entry() {
+    HostLog host;
+    TEST_ASSERT_TRUE(host.open(1024 * 1024));
+    writeRecords(host.log, 1000, 10);
+    host.log.flush();
+    host.index.close();
+    host.segment.close();
+    char path[SegmentedLog::MAX_PATH];
+    SegmentedLog::indexPath(BASE, path, sizeof(path));
+    FILE *file = fopen(path, "ab");
+    fwrite("garbage", 1, 7, file);
+    fclose(file);
+    for (uint8_t reopen = 0; reopen < 2; reopen++) {
+        HostLog again;
+        TEST_ASSERT_TRUE(again.open(1024 * 1024));
+        TEST_ASSERT_EQUAL_UINT16(0, again.log.segment());
+        if (reopen) {
+            writeRecords(again.log, 1010, 2);
+        }
+        again.log.close();
+        TEST_ASSERT_EQUAL(0, again.store.size(path) % sizeof(log_index_entry_t));
+    }
+    log_range_t ranges[4];
+    TEST_ASSERT_EQUAL(1, LogIndex::find(host.store, BASE, 1011, 1011, ranges, 4));
+    TEST_ASSERT_EQUAL_UINT16(0, ranges[0].segment);
+    TEST_ASSERT_EQUAL_UINT32(10 * 7, ranges[0].offset);
+}
+
+void test_index_entry_crc() {
+    log_index_entry_t entry = {};
+    TEST_ASSERT_FALSE(SegmentedLog::isValid(entry));
+}
+
+// flips the CRC of the index entries of segment that match type, from
+// the nth one on and count of them
+static void corruptEntries(uint16_t segment, uint8_t type, uint8_t nth, uint8_t count) {
+    char path[SegmentedLog::MAX_PATH];
+    SegmentedLog::indexPath(BASE, path, sizeof(path));
+    FILE *file = fopen(path, "r+b");
+    log_index_entry_t entry;
+    uint8_t seen = 0;
+    for (long pos = 0; count && fread(&entry, sizeof(entry), 1, file) == 1; pos += sizeof(entry)) {
+        if (entry.segment != segment || entry.type != type || seen++ < nth) {
+            continue;
+        }
+        entry.crc ^= 1;
+        fseek(file, pos, SEEK_SET);
+        fwrite(&entry, sizeof(entry), 1, file);
+        fseek(file, pos + sizeof(entry), SEEK_SET);
+        count--;
+    }
+    fclose(file);
+}
+
+// a segment that lost its segment entry ends at its last checkpoint
+void test_index_lost_segment_entry() {
+    HostLog host;
+    TEST_ASSERT_TRUE(host.open(5 * 7));
+    writeRecords(host.log, 1000, 10);
+    host.log.close();
+    corruptEntries(0, LOG_INDEX_SEGMENT, 0, 1);
+    log_range_t ranges[4];
+    TEST_ASSERT_EQUAL(1, LogIndex::find(host.store, BASE, 1007, 1009, ranges, 4));
+    TEST_ASSERT_EQUAL_UINT16(1, ranges[0].segment);
+    // the unflushed last record is still covered by the end checkpoint
+    TEST_ASSERT_EQUAL(1, LogIndex::find(host.store, BASE, 1004, 1004, ranges, 4));
+    TEST_ASSERT_EQUAL_UINT16(0, ranges[0].segment);
+}
+
+// without a valid start checkpoint the segment is read from its top
+void test_index_lost_start_checkpoint() {
+    HostLog host;
+    TEST_ASSERT_TRUE(host.open(5 * 7));
+    for (uint8_t i = 0; i < 6; i++) {
+        host.log.print(1000 + i, "record\n");
+    }
+    host.log.close();
+    log_range_t ranges[4];
+    corruptEntries(0, LOG_INDEX_CHECKPOINT, 0, 1);
+    TEST_ASSERT_EQUAL(1, LogIndex::find(host.store, BASE, 1000, 1002, ranges, 4));
+    TEST_ASSERT_EQUAL_UINT16(0, ranges[0].segment);
+    TEST_ASSERT_EQUAL_UINT32(0, ranges[0].offset);
+    // the end checkpoint too, the segment entry comes first
+    corruptEntries(0, LOG_INDEX_CHECKPOINT, 1, 1);
+    TEST_ASSERT_EQUAL(1, LogIndex::find(host.store, BASE, 1000, 1002, ranges, 4));
+    TEST_ASSERT_EQUAL_UINT32(0, ranges[0].offset);
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_log_buffers_partial_sectors);
+    RUN_TEST(test_log_writes_whole_sectors);
+    RUN_TEST(test_log_large_write);
+    RUN_TEST(test_log_closed);
+    RUN_TEST(test_index_find);
+    RUN_TEST(test_index_segments);
+    RUN_TEST(test_index_torn_entry);
+    RUN_TEST(test_index_entry_crc);
+    RUN_TEST(test_index_lost_segment_entry);
+    RUN_TEST(test_index_lost_start_checkpoint);
+    return UNITY_END();
+}
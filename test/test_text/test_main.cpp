@@ -0,0 +1,87 @@
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "TextWriter.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_integers() {
+    char line[32];
+    TextWriter(line, sizeof(line)).u32(4294967295u).put(';').u32(7, 3).put(';').i32(-2147483647 - 1);
+    TEST_ASSERT_EQUAL_STRING("4294967295;007;-2147483648", line);
+}
+
+// every int16 as a 1e-3 and 1e-6 fixed point value, like the coordinates
+void test_fixed_matches_printf() {
+    char expected[32], line[32];
+    for (int32_t v = INT16_MIN; v <= INT16_MAX; v++) {
+        snprintf(expected, sizeof(expected), "%s%d.%03d", v < 0 ? "-" : "", abs(v) / 1000, abs(v) % 1000);
+        TextWriter(line, sizeof(line)).fixed(v, 3);
+        TEST_ASSERT_EQUAL_STRING(expected, line);
+        snprintf(expected, sizeof(expected), "%.6f", v / 1e6);
+        TextWriter(line, sizeof(line)).fixed(v, 6);
+        TEST_ASSERT_EQUAL_STRING(expected, line);
+    }
+}
+
+// printf rounds the exact binary value half to even
+void test_q14_matches_printf() {
+    char expected[32], line[32];
+    for (int32_t v = INT16_MIN; v <= INT16_MAX; v++) {
+        snprintf(expected, sizeof(expected), "%.6f", v / 16384.0);
+        TextWriter(line, sizeof(line)).q14(v, 6);
+        TEST_ASSERT_EQUAL_STRING(expected, line);
+        snprintf(expected, sizeof(expected), "%.2f", v / 16384.0);
+        TextWriter(line, sizeof(line)).q14(v, 2);
+        TEST_ASSERT_EQUAL_STRING(expected, line);
+    }
+}
+
+void test_fixed_float() {
+    char expected[32], line[32];
+    for (int32_t v = INT16_MIN; v <= INT16_MAX; v += 7) {
+        float value = v / 128.0f;
+        snprintf(expected, sizeof(expected), "%.3f", value);
+        TextWriter(line, sizeof(line)).fixedFloat(value, 3);
+        TEST_ASSERT_EQUAL_STRING(expected, line);
+    }
+    TextWriter(line, sizeof(line)).fixedFloat(NAN, 2);
+    TEST_ASSERT_EQUAL_STRING("nan", line);
+    TextWriter(line, sizeof(line)).fixedFloat(INFINITY, 2);
+    TEST_ASSERT_EQUAL_STRING("inf", line);
+    TextWriter(line, sizeof(line)).fixedFloat(-INFINITY, 2);
+    TEST_ASSERT_EQUAL_STRING("-inf", line);
+}
+
+// a short buffer keeps the same prefix as snprintf
+void test_overflow_truncates() {
+    char expected[32], line[32];
+    int full = snprintf(expected, sizeof(expected), "%u;%.6f", 1711197319u, -8.05);
+    for (size_t size = 0; size <= (size_t)full + 1; size++) {
+        memset(line, 'x', sizeof(line));
+        snprintf(expected, size, "%u;%.6f", 1711197319u, -8.05);
+        TextWriter writer(line, size);
+        writer.u32(1711197319u).put(';').fixed(-8050000, 6);
+        TEST_ASSERT_EQUAL(size <= (size_t)full, writer.overflowed());
+        if (size) {
+            TEST_ASSERT_EQUAL_STRING(expected, line);
+            TEST_ASSERT_EQUAL(strlen(expected), writer.length());
+        } else {
+            TEST_ASSERT_EQUAL(0, writer.length());
+        }
+        // nothing written past the buffer
+        TEST_ASSERT_EQUAL('x', line[size]);
+    }
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_integers);
+    RUN_TEST(test_fixed_matches_printf);
+    RUN_TEST(test_q14_matches_printf);
+    RUN_TEST(test_fixed_float);
+    RUN_TEST(test_overflow_truncates);
+    return UNITY_END();
+}
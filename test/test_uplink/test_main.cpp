@@ -0,0 +1,175 @@
+#include <unity.h>
+#include "HostHAL.h"
+#include "LoRaPayload.h"
+#include "UplinkQueue.h"
+
+// EU868 DR0-DR2 payload limit
+static const uint8_t MAX_PAYLOAD = 51;
+static const uint8_t PORT = 2;
+
+void setUp() {}
+void tearDown() {}
+
+static lora_fix_t testFix(uint32_t i) {
+    lora_fix_t fix = { 1711197319 + i * 5, -8050000 + (int32_t)i * 17, -34900000 - (int32_t)i * 23 };
+    return fix;
+}
+
+static int decodeFrame(LoRaPayloadDecoder &decoder, const MemoryRadioSink::Frame &frame,
+                       lora_fix_t *fixes, size_t maxFixes) {
+    return decoder.decode(frame.data.data(), frame.data.size(), fixes, maxFixes);
+}
+
+void test_payload_round_trip() {
+    uint8_t frame[MAX_PAYLOAD];
+    LoRaPayloadEncoder encoder;
+    LoRaPayloadDecoder decoder;
+    lora_fix_t decoded[8];
+    uint8_t type = 0;
+    // each frame carries its own time reference
+    for (uint32_t f = 0; f < 2; f++) {
+        encoder.begin(frame, sizeof(frame), LORA_PAYLOAD_GPS);
+        for (uint32_t i = 0; i < 3; i++) {
+            TEST_ASSERT_TRUE(encoder.addFix(testFix(f * 3 + i)));
+        }
+        TEST_ASSERT_EQUAL(3, decoder.decode(frame, encoder.length(), decoded, 8, &type));
+        TEST_ASSERT_EQUAL_UINT8(LORA_PAYLOAD_GPS, type);
+        for (uint32_t i = 0; i < 3; i++) {
+            lora_fix_t fix = testFix(f * 3 + i);
+            TEST_ASSERT_EQUAL_UINT32(fix.ts, decoded[i].ts);
+            TEST_ASSERT_EQUAL_INT32(fix.lat, decoded[i].lat);
+            TEST_ASSERT_EQUAL_INT32(fix.lng, decoded[i].lng);
+        }
+    }
+}
+
+void test_payload_packed() {
+    uint8_t frame[MAX_PAYLOAD];
+    LoRaPayloadEncoder encoder(true, true);
+    LoRaPayloadDecoder decoder;
+    lora_fix_t decoded[1];
+    encoder.begin(frame, sizeof(frame), LORA_PAYLOAD_GPS);
+    TEST_ASSERT_TRUE(encoder.addFix(testFix(0)));
+    TEST_ASSERT_TRUE(frame[0] & LORA_PAYLOAD_PACKED_FLAG);
+    TEST_ASSERT_EQUAL(1, decoder.decode(frame, encoder.length(), decoded, 1));
+    // 24-bit fractions of the range, about 1.2 m / 2.4 m
+    TEST_ASSERT_INT32_WITHIN(11, testFix(0).lat, decoded[0].lat);
+    TEST_ASSERT_INT32_WITHIN(22, testFix(0).lng, decoded[0].lng);
+}
+
+void test_payload_frame_limit() {
+    uint8_t frame[MAX_PAYLOAD];
+    LoRaPayloadEncoder encoder;
+    encoder.begin(frame, sizeof(frame), LORA_PAYLOAD_GPS);
+    uint32_t added = 0;
+    while (encoder.addFix(testFix(added))) {
+        added++;
+    }
+    TEST_ASSERT_EQUAL(added, encoder.count());
+    TEST_ASSERT_TRUE(encoder.length() <= sizeof(frame));
+    TEST_ASSERT_GREATER_THAN(1, added);
+}
+
+// frames that never arrive leave the later ones intact
+void test_payload_lost_frame_mid_sequence() {
+    uint8_t frames[5][MAX_PAYLOAD];
+    size_t lengths[5];
+    LoRaPayloadEncoder encoder;
+    LoRaPayloadDecoder decoder;
+    lora_fix_t decoded[2];
+    for (uint32_t f = 0; f < 5; f++) {
+        encoder.begin(frames[f], MAX_PAYLOAD, LORA_PAYLOAD_GPS);
+        encoder.addFix(testFix(f * 2));
+        encoder.addFix(testFix(f * 2 + 1));
+        lengths[f] = encoder.length();
+    }
+    for (uint32_t f = 0; f < 5; f++) {
+        // the second and third frame are lost
+        if (f == 1 || f == 2) {
+            continue;
+        }
+        TEST_ASSERT_EQUAL(2, decoder.decode(frames[f], lengths[f], decoded, 2));
+        TEST_ASSERT_EQUAL_UINT32(testFix(f * 2).ts, decoded[0].ts);
+        TEST_ASSERT_EQUAL_UINT32(testFix(f * 2 + 1).ts, decoded[1].ts);
+    }
+}
+
+void test_payload_rejects_leading_delta() {
+    // header, then a 5 s delta without an absolute record before it
+    const uint8_t frame[] = { LORA_PAYLOAD_GPS, 5 << 1, 0, 0, 0, 0, 0, 0, 0, 0 };
+    LoRaPayloadDecoder decoder;
+    lora_fix_t decoded[1];
+    TEST_ASSERT_EQUAL(-1, decoder.decode(frame, sizeof(frame), decoded, 1));
+}
+
+void test_queue_keeps_fixes_until_sent() {
+    UplinkQueue queue;
+    MemoryRadioSink radio;
+    LoRaPayloadDecoder decoder(false, false);
+    lora_fix_t decoded[8];
+    for (uint32_t i = 0; i < 3; i++) {
+        TEST_ASSERT_TRUE(queue.push(testFix(i)));
+    }
+    radio.busy = true;
+    TEST_ASSERT_EQUAL_UINT8(0, queue.transmit(radio, MAX_PAYLOAD, PORT));
+    radio.busy = false;
+    TEST_ASSERT_EQUAL_UINT8(3, queue.transmit(radio, MAX_PAYLOAD, PORT));
+    TEST_ASSERT_EQUAL_UINT8(3, queue.inFlight());
+    // one frame at a time
+    TEST_ASSERT_EQUAL_UINT8(0, queue.transmit(radio, MAX_PAYLOAD, PORT));
+    queue.cancel();
+    TEST_ASSERT_EQUAL_UINT8(3, queue.count());
+    TEST_ASSERT_EQUAL_UINT8(3, queue.transmit(radio, MAX_PAYLOAD, PORT));
+    queue.complete();
+    TEST_ASSERT_EQUAL_UINT8(0, queue.count());
+    TEST_ASSERT_EQUAL(2, radio.frames.size());
+    TEST_ASSERT_EQUAL_UINT8(PORT, radio.frames[1].port);
+    TEST_ASSERT_EQUAL(3, decodeFrame(decoder, radio.frames[1], decoded, 8));
+    TEST_ASSERT_EQUAL_UINT32(testFix(2).ts, decoded[2].ts);
+}
+
+void test_queue_full_drops_oldest_not_on_air() {
+    UplinkQueue queue;
+    MemoryRadioSink radio;
+    for (uint32_t i = 0; i < UplinkQueue::SIZE; i++) {
+        TEST_ASSERT_TRUE(queue.push(testFix(i)));
+    }
+    uint8_t onAir = queue.transmit(radio, MAX_PAYLOAD, PORT);
+    TEST_ASSERT_GREATER_THAN(0, onAir);
+    TEST_ASSERT_FALSE(queue.push(testFix(100)));
+    TEST_ASSERT_EQUAL_UINT32(1, queue.dropped());
+    TEST_ASSERT_EQUAL_UINT8(UplinkQueue::SIZE, queue.count());
+    queue.complete();
+    // the frame on air left, the oldest fix after it was the one dropped
+    lora_fix_t fix;
+    TEST_ASSERT_TRUE(queue.pop(fix));
+    TEST_ASSERT_EQUAL_UINT32(testFix(onAir + 1).ts, fix.ts);
+}
+
+void test_queue_pop_skips_frame_on_air() {
+    UplinkQueue queue;
+    MemoryRadioSink radio;
+    for (uint32_t i = 0; i < 4; i++) {
+        queue.push(testFix(i));
+    }
+    // room for two fixes in the frame
+    TEST_ASSERT_EQUAL_UINT8(2, queue.transmit(radio, 2 * UplinkQueue::FIX_RECORD_SIZE + 4, PORT));
+    lora_fix_t fix;
+    TEST_ASSERT_TRUE(queue.pop(fix));
+    TEST_ASSERT_EQUAL_UINT32(testFix(2).ts, fix.ts);
+    TEST_ASSERT_EQUAL_UINT8(2, queue.inFlight());
+    TEST_ASSERT_EQUAL_UINT8(3, queue.count());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_payload_round_trip);
+    RUN_TEST(test_payload_packed);
+    RUN_TEST(test_payload_frame_limit);
+    RUN_TEST(test_payload_lost_frame_mid_sequence);
+    RUN_TEST(test_payload_rejects_leading_delta);
+    RUN_TEST(test_queue_keeps_fixes_until_sent);
+    RUN_TEST(test_queue_full_drops_oldest_not_on_air);
+    RUN_TEST(test_queue_pop_skips_frame_on_air);
+    return UNITY_END();
+}
@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""Converts binary MPU logs (/<startTS>-mpu-NNNN.bin) back to the CSV layout
+previously written by the firmware:
+
+    ts;qw;qx;qy;qz;gX;gY;gZ;aX;aY;aZ
+
+The binary layout is described in include/MPURecord.h, the compressed
+block format of version 2 logs in include/MPUCompressor.h and the
+smallest-three quaternions of version 3 logs in include/QuatCodec.h.
+Corrupted or torn blocks are skipped and reported on stderr.
+"""
+import math
+import struct
+import sys
+import zlib
+
+MPU_LOG_MAGIC = 0x55504D4A
+MPU_LOG_VERSION = 1
+MPU_LOG_VERSION_BLOCKS = 2
+MPU_LOG_VERSION_PACKED = 3
+MPU_BLOCK_MAGIC = 0x4255504D
+HEADER = struct.Struct('<IHHIB3x')
+RECORD = struct.Struct('<I4h3h3h')
+BLOCK_HEADER = struct.Struct('<IHBBI')
+CHANNELS = 11
+Q14 = 16384.0
+
+
+def read_varint(data, pos):
+    value = 0
+    for n in range(5):
+        byte = data[pos + n]
+        value |= (byte & 0x7F) << (7 * n)
+        if not byte & 0x80:
+            return value, pos + n + 1
+    raise ValueError('bad varint')
+
+
+def wrap(value, bits):
+    value &= (1 << bits) - 1
+    return value - (1 << bits) if value >> (bits - 1) else value
+
+
+def decode_block(payload, count):
+    first = list(RECORD.unpack_from(payload, 0))
+    first[0] = wrap(first[0], 32)
+    records = [first]
+    pos = RECORD.size
+    if count == 1:
+        return records
+    bases = []
+    widths = []
+    for _ in range(CHANNELS):
+        zigzag, pos = read_varint(payload, pos)
+        bases.append((zigzag >> 1) ^ -(zigzag & 1))
+        widths.append(payload[pos])
+        pos += 1
+    bits = int.from_bytes(payload[pos:], 'little')
+    shift = 0
+    for _ in range(count - 1):
+        record = []
+        for c in range(CHANNELS):
+            value = (bits >> shift) & ((1 << widths[c]) - 1)
+            shift += widths[c]
+            delta = wrap(value + bases[c], 32)
+            record.append(wrap(records[-1][c] + delta, 32 if c == 0 else 16))
+        records.append(record)
+    return records
+
+
+def read_blocks(data, offset):
+    """Yields the records of every intact block, resynchronising on the
+    block magic after a damaged one; offset is the file position of data."""
+    pos = 0
+    magic = struct.pack('<I', MPU_BLOCK_MAGIC)
+    while pos + BLOCK_HEADER.size <= len(data):
+        block_magic, length, count, _, crc = BLOCK_HEADER.unpack_from(data, pos)
+        payload = data[pos + BLOCK_HEADER.size:pos + BLOCK_HEADER.size + length]
+        if (block_magic == MPU_BLOCK_MAGIC and count and len(payload) == length
+                and zlib.crc32(payload) == crc):
+            for record in decode_block(payload, count):
+                yield record
+            pos += BLOCK_HEADER.size + length
+            continue
+        sys.stderr.write('damaged block at offset %d skipped\n' % (offset + pos))
+        nxt = data.find(magic, pos + 1)
+        if nxt < 0:
+            break
+        pos = nxt
+
+
+def decode_quat(data, bits):
+    """Smallest-three quaternion back to Q14 (w, x, y, z)."""
+    packed = int.from_bytes(data, 'little')
+    largest = packed & 3
+    steps = (1 << bits) - 2
+    q = [0.0] * 4
+    shift = 2
+    for c in range(4):
+        if c == largest:
+            continue
+        u = (packed >> shift) & ((1 << bits) - 1)
+        q[c] = u * math.sqrt(2) / steps - math.sqrt(0.5)
+        shift += bits
+    rest = 1 - sum(x * x for x in q)
+    q[largest] = math.sqrt(rest) if rest > 0 else 0.0
+    return [int(round(x * Q14)) for x in q]
+
+
+def read_packed(src, record_size, bits):
+    quat_size = (2 + 3 * bits + 7) // 8
+    tail = struct.Struct('<3h3h')
+    while True:
+        raw = src.read(record_size)
+        if len(raw) < record_size:
+            break
+        t_ms, = struct.unpack_from('<I', raw)
+        yield [t_ms] + decode_quat(raw[4:4 + quat_size], bits) + list(
+            tail.unpack_from(raw, 4 + quat_size))
+
+
+def read_records(src, record_size):
+    while True:
+        raw = src.read(record_size)
+        if len(raw) < record_size:
+            break
+        yield RECORD.unpack(raw)
+
+
+def decode(src, dst):
+    magic, version, record_size, start_ts, quat_bits = HEADER.unpack(src.read(HEADER.size))
+    if magic != MPU_LOG_MAGIC:
+        raise ValueError('not an MPU log (bad magic 0x%08x)' % magic)
+    if version == MPU_LOG_VERSION_PACKED:
+        expected = 4 + (2 + 3 * quat_bits + 7) // 8 + 12
+    else:
+        expected = RECORD.size
+    if (version not in (MPU_LOG_VERSION, MPU_LOG_VERSION_BLOCKS, MPU_LOG_VERSION_PACKED)
+            or record_size != expected):
+        raise ValueError('unsupported MPU log version %d (record size %d)'
+                         % (version, record_size))
+    if version == MPU_LOG_VERSION_PACKED:
+        records = read_packed(src, record_size, quat_bits)
+    elif version == MPU_LOG_VERSION_BLOCKS:
+        records = read_blocks(src.read(), HEADER.size)
+    else:
+        records = read_records(src, record_size)
+    for t_ms, qw, qx, qy, qz, gx, gy, gz, ax, ay, az in records:
+        t_ms &= 0xFFFFFFFF
+        dst.write('%d.%03d;%.6f;%.6f;%.6f;%.6f;%d;%d;%d;%d;%d;%d\n' % (
+            start_ts + t_ms // 1000, t_ms % 1000,
+            qw / Q14, qx / Q14, qy / Q14, qz / Q14,
+            gx, gy, gz, ax, ay, az))
+
+
+def main(argv):
+    if len(argv) < 2:
+        sys.stderr.write('usage: %s <mpu.bin> [out.csv]\n' % argv[0])
+        return 1
+    with open(argv[1], 'rb') as src:
+        if len(argv) > 2:
+            with open(argv[2], 'w') as dst:
+                decode(src, dst)
+        else:
+            decode(src, sys.stdout)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
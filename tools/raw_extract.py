@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Copies the sessions of the raw log partition out of an SD card image or
+block device:
+
+    raw_extract.py /dev/sdX [outdir]
+
+Without outdir the sessions are only listed. Each session is written to
+outdir/<startTS>-raw-NN.bin, an MPU log that tools/mpu_decode.py reads.
+The partition and superblock layout is described in include/RawLog.h.
+The card needs an MBR with a FAT partition for the regular logs and a
+partition of type 0xda for the raw log, e.g. created with fdisk.
+"""
+import os
+import struct
+import sys
+import zlib
+
+RAW_LOG_PARTITION_TYPE = 0xDA
+RAW_LOG_MAGIC = 0x4C574152
+RAW_LOG_VERSION = 1
+SECTOR_SIZE = 512
+MAX_SESSIONS = 30
+SUPERBLOCK = struct.Struct('<IHBBII')
+SESSION = struct.Struct('<IIII')
+CRC_OFFSET = SUPERBLOCK.size + MAX_SESSIONS * SESSION.size
+
+
+def read_sector(dev, sector):
+    dev.seek(sector * SECTOR_SIZE)
+    data = dev.read(SECTOR_SIZE)
+    if len(data) != SECTOR_SIZE:
+        raise ValueError('short read at sector %d' % sector)
+    return data
+
+
+def find_partition(dev):
+    mbr = read_sector(dev, 0)
+    if mbr[510:512] != b'\x55\xaa':
+        raise ValueError('no MBR')
+    for i in range(4):
+        entry = mbr[446 + i * 16:462 + i * 16]
+        if entry[4] == RAW_LOG_PARTITION_TYPE:
+            return struct.unpack_from('<II', entry, 8)
+    raise ValueError('no raw log partition (type 0x%02x)' % RAW_LOG_PARTITION_TYPE)
+
+
+def read_superblock(dev, start):
+    """Returns the sessions of the intact superblock copy with the higher
+    sequence number."""
+    best = None
+    for slot in range(2):
+        data = read_sector(dev, start + slot)
+        magic, version, sessions, _, seq, _ = SUPERBLOCK.unpack_from(data)
+        crc, = struct.unpack_from('<I', data, CRC_OFFSET)
+        if magic != RAW_LOG_MAGIC or version != RAW_LOG_VERSION or sessions > MAX_SESSIONS:
+            continue
+        if crc != zlib.crc32(data[:CRC_OFFSET]) & 0xFFFFFFFF:
+            continue
+        if best is None or ((seq - best[0]) & 0xFFFFFFFF) < 0x80000000:
+            best = (seq, [SESSION.unpack_from(data, SUPERBLOCK.size + n * SESSION.size)
+                          for n in range(sessions)])
+    if best is None:
+        raise ValueError('no intact superblock')
+    return best[1]
+
+
+def main(argv):
+    if len(argv) < 2:
+        sys.stderr.write('usage: %s <device or image> [outdir]\n' % argv[0])
+        return 1
+    outdir = argv[2] if len(argv) > 2 else None
+    with open(argv[1], 'rb') as dev:
+        start, sectors = find_partition(dev)
+        sessions = read_superblock(dev, start)
+        for n, (start_ts, first, length, _) in enumerate(sessions):
+            print('session %d: startTS %d, sector %d, %d bytes' % (n, start_ts, first, length))
+            if outdir is None:
+                continue
+            path = os.path.join(outdir, '%d-raw-%02d.bin' % (start_ts, n))
+            dev.seek((start + first) * SECTOR_SIZE)
+            with open(path, 'wb') as dst:
+                left = length
+                while left:
+                    chunk = dev.read(min(left, 1 << 20))
+                    if not chunk:
+                        raise ValueError('session %d runs past the device end' % n)
+                    dst.write(chunk)
+                    left -= len(chunk)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))